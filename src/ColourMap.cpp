@@ -286,6 +286,36 @@ Colour ColourMap::getfast(float value)
   return precalc[c];
 }
 
+void ColourMap::getfast(const float* values, unsigned int count, Colour* colours)
+{
+  //Batch lookup of precalculated colours, values of HUGE_VAL (no data) map to zero colour
+  float scale = (samples-1) * irange;
+  if (log)
+  {
+    float lmin = LOG10(minimum);
+    for (unsigned int i=0; i<count; i++)
+    {
+      int c = (int)(scale * (LOG10(values[i]) - lmin));
+      if (c > samples - 1) c = samples - 1;
+      if (c < 0) c = 0;
+      colours[i] = precalc[c];
+    }
+  }
+  else
+  {
+    //Index calculation kept branch free so it vectorises
+    for (unsigned int i=0; i<count; i++)
+    {
+      int c = (int)(scale * (values[i] - minimum));
+      c = c > samples - 1 ? samples - 1 : c;
+      c = c < 0 ? 0 : c;
+      colours[i] = precalc[c];
+    }
+  }
+  for (unsigned int i=0; i<count; i++)
+    if (values[i] == HUGE_VALF) colours[i].value = 0;
+}
+
 Colour ColourMap::get(float value)
 {
   return getFromScaled(scaleValue(value));
@@ -593,6 +623,8 @@ void ColourMap::loadTexture(bool repeat)
   calibrate(0, 1);
   unsigned char paletteData[4*samples];
   Colour col;
+  nonzero.resize(samples+1);
+  nonzero[0] = 0;
   for (int i=0; i<samples; i++)
   {
     col = get(i / (float)(samples-1));
@@ -601,6 +633,7 @@ void ColourMap::loadTexture(bool repeat)
     paletteData[i*4+1] = col.g;
     paletteData[i*4+2] = col.b;
     paletteData[i*4+3] = col.a;
+    nonzero[i+1] = nonzero[i] + (col.value != 0);
   }
 
   glActiveTexture(GL_TEXTURE0);
@@ -623,6 +656,19 @@ void ColourMap::loadTexture(bool repeat)
   glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+bool ColourMap::empty(float min, float max)
+{
+  //Are all texture samples looked up by scaled values in [min,max] zero?
+  //(includes the neighbouring samples on each side to allow for rounding)
+  if (!nonzero.size()) return false;
+  int first = floor(min * samples) - 1;
+  int last = floor(max * samples) + 1;
+  if (first < 0) first = 0;
+  if (last > samples-1) last = samples-1;
+  if (first > last) return false;
+  return nonzero[last+1] == nonzero[first];
+}
+
 void ColourMap::loadPalette(std::string data)
 {
   //Two types of palette data accepted
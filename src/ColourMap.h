@@ -77,6 +77,7 @@ public:
   bool calibrated;
   bool opaque;
   TextureData* texture;
+  std::vector<unsigned int> nonzero; //Running count of non-zero texture samples
 
   ColourMap(DrawState& drawstate, std::string name="", std::string props="");
   ~ColourMap()
@@ -97,12 +98,14 @@ public:
   void calibrate(float min, float max);
   void calibrate(FloatValues* dataValues=NULL);
   Colour getfast(float value);
+  void getfast(const float* values, unsigned int count, Colour* colours);
   Colour get(float value);
   float scaleValue(float value);
   Colour getFromScaled(float scaledValue);
   void draw(DrawState& drawstate, Properties& colourbarprops, int startx, int starty, int length, int breadth, Colour& printColour, bool vertical);
   void setComponent(int component_index);
   void loadTexture(bool repeat=false);
+  bool empty(float min, float max);
   void loadPalette(std::string data);
   void print();
 };
@@ -0,0 +1,294 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+** Copyright (c) 2016, Monash University
+** All rights reserved.
+** Redistribution and use in source and binary forms, with or without modification,
+** are permitted provided that the following conditions are met:
+**
+**       * Redistributions of source code must retain the above copyright notice,
+**          this list of conditions and the following disclaimer.
+**       * Redistributions in binary form must reproduce the above copyright
+**         notice, this list of conditions and the following disclaimer in the
+**         documentation and/or other materials provided with the distribution.
+**       * Neither the name of the Monash University nor the names of its contributors
+**         may be used to endorse or promote products derived from this software
+**         without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+** THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+** PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+** HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+** OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**
+** Contact:
+*%  Owen Kaluza - Owen.Kaluza(at)monash.edu
+*%
+*% Development Team :
+*%  http://www.underworldproject.org/aboutus.html
+**
+**~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+#include "DepthSort.h"
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//Items per block of work when calculating distances in parallel
+#define SORT_BLOCK (1 << 16)
+
+void DepthSort::clear()
+{
+  wait();
+  result.clear();
+  sorted.clear();
+  x.clear();
+  y.clear();
+  z.clear();
+  keys.clear();
+  swap.clear();
+  valid = false;
+}
+
+void DepthSort::resize(unsigned int count)
+{
+  //Allocate for count items, keys initialised in item order
+  wait();
+  result.clear();
+  sorted.clear();
+  x.resize(count);
+  y.resize(count);
+  z.resize(count);
+  keys.resize(count);
+  swap.resize(count);
+  for (unsigned int i=0; i<count; i++)
+  {
+    keys[i].key = 0;
+    keys[i].index = i;
+  }
+  valid = false;
+}
+
+void DepthSort::distances(const float* M, float mindist, float maxdist, int threads)
+{
+  //Calculate eye distances (-eyeZ) of all items, quantised to integer keys between 0 and maxKey
+  //Keys are written in item order, replacing the previous sorted order
+  if (bits > 24) bits = 24; //Beyond float precision
+  unsigned int count = keys.size();
+  unsigned int blocks = (count + SORT_BLOCK - 1) / SORT_BLOCK;
+  float multiplier = maxdist > mindist ? maxKey() / (maxdist - mindist) : 0;
+  parallel_for(blocks, [&](unsigned int b)
+  {
+    unsigned int i = b * SORT_BLOCK;
+    unsigned int end = min(i + SORT_BLOCK, count);
+#if defined(__AVX__)
+    __m256 m2 = _mm256_set1_ps(-M[2]), m6 = _mm256_set1_ps(-M[6]), m10 = _mm256_set1_ps(-M[10]);
+    __m256 m14 = _mm256_set1_ps(-M[14]);
+    __m256 lo = _mm256_set1_ps(mindist), hi = _mm256_set1_ps(maxdist), mul = _mm256_set1_ps(multiplier);
+    for (; i+8 <= end; i += 8)
+    {
+      __m256 d = _mm256_mul_ps(m2, _mm256_loadu_ps(&x[i]));
+      d = _mm256_add_ps(d, _mm256_mul_ps(m6, _mm256_loadu_ps(&y[i])));
+      d = _mm256_add_ps(d, _mm256_mul_ps(m10, _mm256_loadu_ps(&z[i])));
+      d = _mm256_add_ps(d, m14);
+      d = _mm256_min_ps(hi, _mm256_max_ps(lo, d));
+      __m256i k = _mm256_cvttps_epi32(_mm256_mul_ps(mul, _mm256_sub_ps(d, lo)));
+      //Interleave keys with indices, 4 at a time
+      __m128i k0 = _mm256_castsi256_si128(k);
+      __m128i k1 = _mm256_extractf128_si256(k, 1);
+      __m128i n0 = _mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3));
+      __m128i n1 = _mm_add_epi32(n0, _mm_set1_epi32(4));
+      _mm_storeu_si128((__m128i*)&keys[i], _mm_unpacklo_epi32(k0, n0));
+      _mm_storeu_si128((__m128i*)&keys[i+2], _mm_unpackhi_epi32(k0, n0));
+      _mm_storeu_si128((__m128i*)&keys[i+4], _mm_unpacklo_epi32(k1, n1));
+      _mm_storeu_si128((__m128i*)&keys[i+6], _mm_unpackhi_epi32(k1, n1));
+    }
+#elif defined(__SSE2__)
+    __m128 m2 = _mm_set1_ps(-M[2]), m6 = _mm_set1_ps(-M[6]), m10 = _mm_set1_ps(-M[10]);
+    __m128 m14 = _mm_set1_ps(-M[14]);
+    __m128 lo = _mm_set1_ps(mindist), hi = _mm_set1_ps(maxdist), mul = _mm_set1_ps(multiplier);
+    for (; i+4 <= end; i += 4)
+    {
+      __m128 d = _mm_mul_ps(m2, _mm_loadu_ps(&x[i]));
+      d = _mm_add_ps(d, _mm_mul_ps(m6, _mm_loadu_ps(&y[i])));
+      d = _mm_add_ps(d, _mm_mul_ps(m10, _mm_loadu_ps(&z[i])));
+      d = _mm_add_ps(d, m14);
+      d = _mm_min_ps(hi, _mm_max_ps(lo, d));
+      __m128i k = _mm_cvttps_epi32(_mm_mul_ps(mul, _mm_sub_ps(d, lo)));
+      //Interleave keys with indices
+      __m128i n = _mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3));
+      _mm_storeu_si128((__m128i*)&keys[i], _mm_unpacklo_epi32(k, n));
+      _mm_storeu_si128((__m128i*)&keys[i+2], _mm_unpackhi_epi32(k, n));
+    }
+#endif
+    for (; i < end; i++)
+    {
+      float d = -(M[2] * x[i] + M[6] * y[i] + M[10] * z[i] + M[14]);
+      d = min(maxdist, max(mindist, d));
+      keys[i].key = (uint32_t)(multiplier * (d - mindist));
+      keys[i].index = i;
+    }
+  }, threads);
+}
+
+void DepthSort::sort(int threads)
+{
+  //Stable LSD radix sort of keys, 8 bits per pass,
+  //each thread builds a histogram of its chunk then scatters to its own offsets within each bucket
+  unsigned int count = keys.size();
+  if (count < 2) return;
+  swap.resize(count);
+  unsigned int workers = threads > 0 ? threads : std::thread::hardware_concurrency();
+  unsigned int chunks = count / SORT_BLOCK + 1;
+  if (chunks > workers) chunks = workers;
+  if (chunks < 1) chunks = 1;
+  unsigned int chunksize = (count + chunks - 1) / chunks;
+  std::vector<unsigned int> hist(chunks * 256);
+  SortKey* src = keys.data();
+  SortKey* dst = swap.data();
+  for (unsigned int shift = 0; shift < bits; shift += 8)
+  {
+    std::fill(hist.begin(), hist.end(), 0);
+    parallel_for(chunks, [&](unsigned int c)
+    {
+      unsigned int* h = &hist[c * 256];
+      unsigned int end = min((c+1) * chunksize, count);
+      for (unsigned int i = c * chunksize; i < end; i++)
+        h[(src[i].key >> shift) & 0xff]++;
+    }, chunks);
+
+    //Offsets by bucket then chunk, skip pass if all keys have the same value for these bits
+    unsigned int sum = 0;
+    bool skip = false;
+    for (unsigned int b = 0; b < 256 && !skip; b++)
+    {
+      unsigned int start = sum;
+      for (unsigned int c = 0; c < chunks; c++)
+      {
+        unsigned int n = hist[c * 256 + b];
+        hist[c * 256 + b] = sum;
+        sum += n;
+      }
+      if (sum - start == count) skip = true;
+    }
+    if (skip) continue;
+
+    parallel_for(chunks, [&](unsigned int c)
+    {
+      unsigned int* h = &hist[c * 256];
+      unsigned int end = min((c+1) * chunksize, count);
+      for (unsigned int i = c * chunksize; i < end; i++)
+        dst[h[(src[i].key >> shift) & 0xff]++] = src[i];
+    }, chunks);
+    std::swap(src, dst);
+  }
+
+  //Sorted data ends up in swap after an odd number of passes
+  if (src != keys.data())
+    keys.swap(swap);
+}
+
+bool DepthSort::update(const float* M, float mindist, float maxdist, float skip, int threads)
+{
+  //Sort for a new view, keeping the previous order when the view direction has rotated
+  //less than skip degrees (order depends only on the direction, the third row of the modelview matrix),
+  //returns false if the previous order was kept
+  float dir[3] = {M[2], M[6], M[10]};
+  float len = sqrt(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+  if (len > 0)
+    for (int i=0; i<3; i++)
+      dir[i] /= len;
+  float angle = 180;
+  if (valid)
+  {
+    float cosangle = dir[0]*view[0] + dir[1]*view[1] + dir[2]*view[2];
+    angle = acos(min(1.0f, max(-1.0f, cosangle))) * 180.0 / M_PI;
+  }
+  if (valid && angle < skip)
+    return false;
+
+  distances(M, mindist, maxdist, threads);
+  sort(threads);
+  memcpy(view, dir, sizeof(view));
+  valid = true;
+  return true;
+}
+
+void DepthSort::request(const float* M, float mindist, float maxdist, float skip, int threads)
+{
+  //Queue a sort for this view on the worker thread, replacing any view still waiting,
+  //keys and positions must not be modified until wait() returns (resize/clear wait first)
+  std::lock_guard<std::mutex> guard(mutex);
+  memcpy(matrix, M, sizeof(matrix));
+  range[0] = mindist;
+  range[1] = maxdist;
+  threshold = skip;
+  workthreads = threads;
+  requested = true;
+  if (!running)
+  {
+    //Previous worker has finished, clean up and start another
+    if (worker.joinable()) worker.join();
+    running = true;
+    worker = std::thread(&DepthSort::run, this);
+  }
+}
+
+void DepthSort::run()
+{
+  //Worker thread, sorts for the most recently requested view until none waiting
+  std::unique_lock<std::mutex> lock(mutex);
+  while (requested)
+  {
+    requested = false;
+    float M[16], mindist = range[0], maxdist = range[1];
+    float skip = threshold;
+    memcpy(M, matrix, sizeof(M));
+    int threads = workthreads;
+    lock.unlock();
+    bool changed = update(M, mindist, maxdist, skip, threads);
+    lock.lock();
+    if (changed)
+    {
+      result.assign(keys.begin(), keys.end());
+      ready = true;
+      if (completed) completed();
+    }
+  }
+  running = false;
+}
+
+bool DepthSort::collect()
+{
+  //Take a completed background sort order, returns true if a new order is available from order()
+  std::lock_guard<std::mutex> guard(mutex);
+  if (!ready) return false;
+  sorted.swap(result);
+  ready = false;
+  background = true;
+  return true;
+}
+
+bool DepthSort::busy()
+{
+  //Background sort in progress or completed order not yet collected
+  std::lock_guard<std::mutex> guard(mutex);
+  return running || ready;
+}
+
+bool DepthSort::wait()
+{
+  //Wait for background sorting to complete, the latest order is then used from keys,
+  //returns true if it had not been collected
+  if (worker.joinable()) worker.join();
+  bool changed = ready;
+  ready = background = false;
+  return changed;
+}
@@ -0,0 +1,106 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+** Copyright (c) 2016, Monash University
+** All rights reserved.
+** Redistribution and use in source and binary forms, with or without modification,
+** are permitted provided that the following conditions are met:
+**
+**       * Redistributions of source code must retain the above copyright notice,
+**          this list of conditions and the following disclaimer.
+**       * Redistributions in binary form must reproduce the above copyright
+**         notice, this list of conditions and the following disclaimer in the
+**         documentation and/or other materials provided with the distribution.
+**       * Neither the name of the Monash University nor the names of its contributors
+**         may be used to endorse or promote products derived from this software
+**         without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+** THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+** PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+** HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+** OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**
+** Contact:
+*%  Owen Kaluza - Owen.Kaluza(at)monash.edu
+*%
+*% Development Team :
+*%  http://www.underworldproject.org/aboutus.html
+**
+**~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+#ifndef DepthSort__
+#define DepthSort__
+#include "Include.h"
+#include "Util.h"
+
+//Sort key, quantised distance from the view plane and item index
+typedef struct
+{
+  uint32_t key;
+  uint32_t index;
+} SortKey;
+
+//Depth sort engine for points and triangles
+//Item positions are stored as separate x,y,z arrays so distances can be calculated with SIMD,
+//keys are sorted with a parallel LSD radix sort using per-thread histograms
+class DepthSort
+{
+  std::vector<SortKey> swap;
+  float view[3];              //View direction keys were last sorted for
+  bool valid;                 //Keys sorted for view direction
+
+  //Background sorting, keys and positions are used by the worker while running,
+  //completed orders are passed back through result
+  std::thread worker;
+  std::mutex mutex;
+  bool running;               //Worker active
+  bool requested;             //View queued for worker
+  bool ready;                 //Completed order waiting in result
+  bool background;            //Current order is from background sort
+  float matrix[16];           //Queued view
+  float range[2];
+  float threshold;
+  int workthreads;
+  std::vector<SortKey> result;
+  std::vector<SortKey> sorted; //Last collected background order
+  void run();
+public:
+  std::vector<float> x, y, z; //Item positions
+  std::vector<SortKey> keys;  //Item keys, ascending order of distance after sort()
+  unsigned int bits;          //Key bits used for quantised distance (8-24)
+  std::function<void()> completed; //Called on the worker thread when an order is ready to collect
+
+  DepthSort(unsigned int bits=16) : valid(false), running(false), requested(false), ready(false), background(false), bits(bits) {}
+  ~DepthSort() {wait();}
+
+  unsigned int size() {return keys.size();}
+  uint32_t maxKey() {return (1 << bits) - 1;}
+  unsigned long bytes() {return (x.capacity() + y.capacity() + z.capacity()) * sizeof(float) + (keys.capacity() + swap.capacity()) * sizeof(SortKey);}
+
+  void clear();
+  void resize(unsigned int count);
+  void set(unsigned int i, const float* pos)
+  {
+    x[i] = pos[0];
+    y[i] = pos[1];
+    z[i] = pos[2];
+  }
+  void distances(const float* modelView, float mindist, float maxdist, int threads=0);
+  void sort(int threads=0);
+  bool update(const float* modelView, float mindist, float maxdist, float skip, int threads=0);
+
+  void request(const float* modelView, float mindist, float maxdist, float skip, int threads=0);
+  bool collect();
+  bool busy();
+  bool wait();
+  //Sorted keys, from last background sort if collected, otherwise from update()
+  std::vector<SortKey>& order() {return background ? sorted : keys;}
+};
+
+#endif //DepthSort__
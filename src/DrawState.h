@@ -35,6 +35,10 @@ public:
   float min[3], max[3], dims[3];
   float *x_coords, *y_coords;  // Saves arrays of x,y points on circle for set segment count
   int segments = 0;    // Saves segment count for circle based objects
+  std::function<void()> redisplay; // Request a frame, called from background depth sort workers on completion
+  bool reduced = false;     // Points drawn at reduced level of detail this frame
+  bool refinetimer = false; // Idle timer started to refine reduced detail
+  bool fulldetail = false;  // View idle, draw points at full detail until it moves
 
   //TriSurfaces, Lines, Points, Volumes
   Shader* prog[lucMaxType];
@@ -247,6 +251,14 @@ public:
     defaults["texturesize"] = {0, 0, 0};
     // | object(volume) | int[3] | Volume texture offset (for crop)
     defaults["textureoffset"] = {0, 0, 0};
+    // | object(volume) | integer | Brick size in voxels for value range summaries, used to skip empty space when rendering and in isosurface extraction, 0 to disable
+    defaults["bricksize"] = 16;
+    // | object(volume) | integer | Maximum texture size in voxels per axis, larger volumes are split into blocks rendered separately, 0 for hardware limit
+    defaults["texturelimit"] = 0;
+    // | object(volume) | integer | Number of reduced resolution levels to build, each half the size of the last, the coarsest is drawn while the view is moving and refined a level at a time when idle, 0=disabled
+    defaults["texturelevels"] = 0;
+    // | object(volume) | string | Filter for reduced resolution levels, "box" averages each 2x2x2 block of voxels, "max" keeps the largest value so thin bright features remain visible
+    defaults["levelfilter"] = "box";
 
     // | object(vector) | real | Arrow head size as a multiple of width
     defaults["arrowhead"] = 2.0;
@@ -265,6 +277,8 @@ public:
     defaults["fade"] = false;
     // | object(tracer) | real | Tracer scaling multiplier, applies to all tracer objects
     defaults["scaletracers"] = 1.0;
+    // | object(tracer) | boolean | Draw tracers as line trails built on the GPU, advancing a step uploads only the newest positions
+    defaults["trails"] = false;
 
     // | object(shape) | real | Shape width scaling factor
     defaults["shapewidth"] = 1.0;
@@ -418,16 +432,52 @@ public:
     defaults["pointmaxcount"] = 0;
     // | global | integer | Point distance sub-sampling factor
     defaults["pointdistsample"] = 0;
+    // | global | integer | Point spatial brick grid resolution for approximate depth sorting of large point sets, bricks are sorted each frame instead of points, 0=disabled
+    defaults["pointbricks"] = 0;
+    // | global | real | Rotation in degrees after which the point order within each visible brick is re-sorted
+    defaults["pointbrickresort"] = 30.0;
+    // | global | real | Point level of detail target spacing in pixels, each brick draws the coarsest level with points this close on screen, full detail is drawn when the view is idle (requires pointbricks), 0=disabled
+    defaults["pointlod"] = 0.0;
+    // | global | real | Point level of detail frame time budget in milliseconds, spacing is increased while drawing points takes longer, 0=disabled
+    defaults["pointlodbudget"] = 0.0;
     // | global | boolean | Point size/type attributes can be applied per object (requires more GPU ram)
     defaults["pointattribs"] = true;
     // | global | boolean | Point distance size attenuation (points shrink when further from viewer ie: perspective)
     defaults["pointattenuate"] = true;
     // | global | integer | Automatic depth sorting, -1=on, 0=disabled, >0=timer
     defaults["sort"] = -1;
+    // | global | real | Keep the previous depth sort order when the view direction has rotated less than this many degrees since the last sort
+    defaults["sortskip"] = 1.0;
+    // | global | boolean | Skip objects (and point bricks) with bounding box outside the view frustum when sorting and uploading indices
+    defaults["culling"] = true;
+    // | global | boolean | Depth sort on a background thread, drawing continues with the previous order until the new order is ready (interactive only)
+    defaults["sortthread"] = false;
+    // | global | boolean | Draw shapes and vector arrows by instancing one template mesh per shape and quality when supported, instead of generating triangles for every element
+    defaults["glyphinstancing"] = true;
     // | global | boolean | Cache timestep varying data in ram
     defaults["cache"] = false;
-    // | global | boolean | Cache timestep varying data on gpu as well as ram (only if model size permits)
+    // | global | real | Cache memory limit in megabytes, least recently used timesteps are removed when exceeded (0=unlimited)
+    defaults["cachesize"] = 2048.0;
+    // | global | boolean | Never remove first and last timesteps from cache
+    defaults["cachepin"] = false;
+    // | global | boolean | Cache timestep varying data on gpu as well as ram, cached steps keep their vertex/index buffers and sort order so revisiting needs no reload or upload
     defaults["gpucache"] = false;
+    // | global | real | Graphics memory limit in megabytes for buffers kept by cached timesteps (gpucache), least recently used steps release theirs when exceeded (0=unlimited)
+    defaults["gpucachesize"] = 512.0;
+    // | global | integer | Number of following timesteps to load in the background while current step is displayed, 0=disabled
+    defaults["prefetch"] = 0;
+    // | global | integer | Worker threads for parallel processing of data, 0=one per processor core
+    defaults["threads"] = 0;
+    // | global | boolean | Load timestep geometry from binary .lvcache files when present and newer than the database (see: export lvcache)
+    defaults["lvcache"] = true;
+    // | global | string | Compression codec for geometry data written to database, none/deflate/shuffle (shuffle groups float bytes by significance before deflate, smaller but only readable by versions that store the codec)
+    defaults["codec"] = "deflate";
+    // | global | boolean | Defer loading value data from database until referenced by a property (colourby, opacityby, sizeby, filters etc) or read (data list, export, python data access)
+    defaults["lazyvalues"] = true;
+    // | global | boolean | Keep optimised triangle meshes in ram for reuse when the same source mesh is loaded again, memory used is counted against cachesize
+    defaults["meshcache"] = true;
+    // | global | string | Directory to store optimised triangle meshes (.lvmesh files named by source data hash) for reuse across sessions, empty=disabled
+    defaults["meshcachepath"] = "";
 
 #ifdef DEBUG
     //std::cerr << std::setw(2) << defaults << std::endl;
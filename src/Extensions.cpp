@@ -26,6 +26,7 @@ PFNGLBUFFERDATAPROC glBufferData;
 PFNGLBUFFERSUBDATAPROC glBufferSubData;
 PFNGLUNMAPBUFFERPROC glUnmapBuffer;
 PFNGLDELETEBUFFERSPROC glDeleteBuffers;
+PFNGLGETBUFFERPARAMETERIVPROC glGetBufferParameteriv;
 PFNGLCREATESHADERPROC glCreateShader;
 PFNGLDELETESHADERPROC glDeleteShader;
 PFNGLSHADERSOURCEPROC glShaderSource;
@@ -64,6 +65,8 @@ PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray;
 PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointer;
 PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArray;
 PFNGLISPROGRAMPROC glIsProgram;
+PFNGLVERTEXATTRIBDIVISORARBPROC glVertexAttribDivisorARB;
+PFNGLDRAWELEMENTSINSTANCEDARBPROC glDrawElementsInstancedARB;
 #endif
 
 void OpenGL_Extensions_Init()
@@ -87,6 +90,7 @@ void OpenGL_Extensions_Init()
   glBufferSubData = (PFNGLBUFFERSUBDATAPROC) GetProcAddress("glBufferSubData");
   glUnmapBuffer = (PFNGLUNMAPBUFFERPROC) GetProcAddress("glUnmapBuffer");
   glDeleteBuffers = (PFNGLDELETEBUFFERSPROC) GetProcAddress("glDeleteBuffers");
+  glGetBufferParameteriv = (PFNGLGETBUFFERPARAMETERIVPROC) GetProcAddress("glGetBufferParameteriv");
   glCreateShader = (PFNGLCREATESHADERPROC) GetProcAddress("glCreateShader");
   glDeleteShader = (PFNGLDELETESHADERPROC) GetProcAddress("glDeleteShader");
   glShaderSource = (PFNGLSHADERSOURCEPROC) GetProcAddress("glShaderSource");
@@ -125,6 +129,8 @@ void OpenGL_Extensions_Init()
   glVertexAttribPointer = (PFNGLVERTEXATTRIBPOINTERPROC) GetProcAddress("glVertexAttribPointer");
   glDisableVertexAttribArray = (PFNGLDISABLEVERTEXATTRIBARRAYPROC) GetProcAddress("glDisableVertexAttribArray");
   glIsProgram = (PFNGLISPROGRAMPROC) GetProcAddress("glIsProgram");
+  glVertexAttribDivisorARB = (PFNGLVERTEXATTRIBDIVISORARBPROC) GetProcAddress("glVertexAttribDivisorARB");
+  glDrawElementsInstancedARB = (PFNGLDRAWELEMENTSINSTANCEDARBPROC) GetProcAddress("glDrawElementsInstancedARB");
 #endif
 }
 
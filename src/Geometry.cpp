@@ -179,10 +179,9 @@ void GeomData::getColour(Colour& colour, unsigned int idx)
   FloatValues* vals = colourData();
   if (cmap && vals)
   {
-    if (vals->size() == 1) idx = 0;  //Single colour value only provided
+    //Single colour value only provided: the last (only) value is used
     //assert(idx < values->size());
-    if (idx >= vals->size()) idx = vals->size() - 1;
-    float val = colourData(idx);
+    float val = colourData(min(idx, vals->size() - 1));
     if (val == HUGE_VAL) 
     {
       colour.value = 0;
@@ -192,23 +191,21 @@ void GeomData::getColour(Colour& colour, unsigned int idx)
   }
   else if (colours.size() > 0)
   {
-    if (colours.size() == 1) idx = 0;  //Single colour only provided
-    if (idx >= colours.size()) idx = colours.size() - 1;
+    //Single colour only provided: the last (only) colour is used
     //assert(idx < colours.size());
-    colour.value = colours[idx];
+    colour.value = colours[min(idx, colours.size() - 1)];
   }
   else if (rgb.size() > 0)
   {
-    if (idx >= rgb.size()/3) idx = rgb.size()/3 - 1;
-    colour.r = rgb[idx*3];
-    colour.g = rgb[idx*3+1];
-    colour.b = rgb[idx*3+2];
+    unsigned int c = min(idx, rgb.size()/3 - 1);
+    colour.r = rgb[c*3];
+    colour.g = rgb[c*3+1];
+    colour.b = rgb[c*3+2];
     colour.a = 255;
   }
   else if (luminance.size() > 0)
   {
-    if (idx >= luminance.size()) idx = luminance.size() - 1;
-    colour.r = colour.g = colour.b = luminance[idx];
+    colour.r = colour.g = colour.b = luminance[min(idx, luminance.size() - 1)];
     colour.a = 255;
   }
   else
@@ -229,6 +226,90 @@ void GeomData::getColour(Colour& colour, unsigned int idx)
   colour.a *= draw->opacity;
 }
 
+void GeomData::getColours(Colour* out, unsigned int start, unsigned int count)
+{
+  //Batch version of getColour() for indices start to start+count-1,
+  //indices past the end of the colour data use the last entry
+  ColourMap* cmap = draw->colourMap;
+  FloatValues* vals = colourData();
+  auto available = [&](unsigned int size) {return size > start ? min(size - start, count) : 0;};
+  unsigned int mapped = 0; //Count of values coloured by map, may contain HUGE_VAL (no data)
+  if (cmap && vals)
+  {
+    //Single colour value only provided: every entry uses the last (only) value
+    unsigned int size = vals->size();
+    unsigned int n = size == 1 ? 0 : available(size);
+    if (n) cmap->getfast((float*)vals->ref(start), n, out);
+    if (n < count) cmap->getfast((float*)vals->ref(size-1), 1, &out[n]);
+    for (unsigned int i=n+1; i<count; i++)
+      out[i] = out[n];
+    mapped = size;
+  }
+  else if (colours.size() > 0)
+  {
+    //Single colour only provided: every entry uses the last (only) colour
+    unsigned int size = colours.size();
+    unsigned int n = size == 1 ? 0 : available(size);
+    if (n) memcpy(out, colours.ref(start), n * sizeof(Colour));
+    for (unsigned int i=n; i<count; i++)
+      out[i].value = colours[size-1];
+  }
+  else if (rgb.size() > 0)
+  {
+    unsigned int size = rgb.size()/3;
+    for (unsigned int i=0; i<count; i++)
+    {
+      unsigned int idx = start + i;
+      if (idx >= size) idx = size - 1;
+      out[i].r = rgb[idx*3];
+      out[i].g = rgb[idx*3+1];
+      out[i].b = rgb[idx*3+2];
+      out[i].a = 255;
+    }
+  }
+  else if (luminance.size() > 0)
+  {
+    unsigned int size = luminance.size();
+    for (unsigned int i=0; i<count; i++)
+    {
+      unsigned int idx = start + i;
+      if (idx >= size) idx = size - 1;
+      out[i].r = out[i].g = out[i].b = luminance[idx];
+      out[i].a = 255;
+    }
+  }
+  else
+  {
+    for (unsigned int i=0; i<count; i++)
+      out[i] = draw->colour;
+  }
+
+  //Set opacity using own value map...
+  ColourMap* omap = draw->opacityMap;
+  vals = valueData(draw->opacityIdx);
+  if (omap && vals && vals->size() > draw->opacityIdx)
+  {
+    std::vector<Colour> opacity(count);
+    unsigned int n = available(vals->size());
+    if (n) omap->getfast((float*)vals->ref(start), n, opacity.data());
+    for (unsigned int i=0; i<n; i++)
+    {
+      //No data entries stay transparent, as in getColour()
+      unsigned int idx = mapped == 1 ? 0 : min(start + i, mapped - 1);
+      if (mapped && colourData(idx) == HUGE_VAL) continue;
+      out[i].a = opacity[i].a;
+    }
+  }
+
+  //Apply opacity from drawing object override level if set
+  float opacity = draw->opacity;
+  if (opacity != 1.0)
+  {
+    for (unsigned int i=0; i<count; i++)
+      out[i].a *= opacity;
+  }
+}
+
 unsigned int GeomData::valuesLookup(const json& by)
 {
   //Gets a valid value index by property, either actual index or string label
@@ -353,6 +434,7 @@ Geometry::Geometry(DrawState& drawstate) : view(NULL), elements(0),
                        allhidden(false), internal(false), unscale(false),
                        type(lucMinType), total(0), redraw(true), reload(true)
 {
+  partial = false;
   drawcount = 0;
 }
 
@@ -367,6 +449,17 @@ void Geometry::close() //Called on quit or gl context destroy
 {
 }
 
+size_t Geometry::bufferSize(GLuint buffer)
+{
+  //Allocated size of a buffer object in bytes
+  if (!buffer || !glIsBuffer(buffer)) return 0;
+  GLint size = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return size;
+}
+
 void Geometry::clear(bool all)
 {
   total = 0;
@@ -385,6 +478,7 @@ void Geometry::clear(bool all)
       {
         geom.erase(geom.begin()+idx);
         if (hidden.size() > idx) hidden.erase(hidden.begin()+idx);
+        if (culled.size() > idx) culled.erase(culled.begin()+idx);
       }
     }
     else
@@ -409,6 +503,7 @@ void Geometry::remove(DrawingObject* draw)
       delete geom[i];
       geom.erase(geom.begin()+i);
       if (hidden.size() > (unsigned int)i) hidden.erase(hidden.begin()+i);
+      if (culled.size() > (unsigned int)i) culled.erase(culled.begin()+i);
     }
   }
 }
@@ -430,6 +525,12 @@ void Geometry::clearValues(DrawingObject* draw, std::string label)
       for (auto vals : g->values)
         if (label.length() == 0 || vals->label == label)
           vals->clear();
+
+      //Cleared values are not to be loaded later
+      if (label.length() == 0)
+        g->deferred.clear();
+      else
+        g->deferred.erase(label);
     }
   }
 }
@@ -662,12 +763,41 @@ void Geometry::redrawObject(DrawingObject* draw)
       debug_print("Reloading object: %s\n", draw->name().c_str());
       //Flag reload of texture
       if (geom[i]->texture) geom[i]->texture->texture->width = 0;
-      reload = true;
-      return;
+      //Upload this object's vertex range only if supported, otherwise reload all
+      geom[i]->dirty = true;
+      if (partial)
+        redraw = true;
+      else
+        reload = true;
     }
   }
 }
 
+bool Geometry::dirtyObjects(std::vector<unsigned int>& objects)
+{
+  //Get objects flagged for upload, returns false if vertex counts differ from the
+  //last full upload, vbo ranges are then invalid and a full reload is required
+  objects.clear();
+  if (vbocounts.size() != geom.size()) return false;
+  for (unsigned int i = 0; i < geom.size(); i++)
+  {
+    if (geom[i]->count != vbocounts[i]) return false;
+    if (geom[i]->dirty) objects.push_back(i);
+  }
+  return true;
+}
+
+void Geometry::uploaded()
+{
+  //Full vbo upload done, save layout and clear flags
+  vbocounts.resize(geom.size());
+  for (unsigned int i = 0; i < geom.size(); i++)
+  {
+    vbocounts[i] = geom[i]->count;
+    geom[i]->dirty = false;
+  }
+}
+
 void Geometry::init() //Called on GL init
 {
   reload = true;
@@ -945,6 +1075,31 @@ bool Geometry::drawable(unsigned int idx)
   return false;
 }
 
+//Depth sorting on a worker thread, only for interactive use as the previous order is drawn until complete
+bool Geometry::backgroundSort()
+{
+  return drawstate.global("sortthread") && !drawstate.automate;
+}
+
+bool Geometry::cull()
+{
+  //Flag objects with bounding box entirely outside the view frustum,
+  //returns true if any have moved in or out of view since the last call
+  bool enabled = drawstate.global("culling");
+  if (enabled) view->getFrustum();
+  bool changed = false;
+  culled.resize(geom.size(), false);
+  for (unsigned int i=0; i<geom.size(); i++)
+  {
+    //Skip objects without bounds
+    bool outside = enabled && geom[i]->min[0] <= geom[i]->max[0] &&
+                   !view->boxVisible(geom[i]->min, geom[i]->max);
+    if (outside != culled[i]) changed = true;
+    culled[i] = outside;
+  }
+  return changed;
+}
+
 std::vector<GeomData*> Geometry::getAllObjects(DrawingObject* draw)
 {
   //Get passed object's data store
@@ -1072,7 +1227,7 @@ void Geometry::read(GeomData* geomdata, unsigned int n, lucGeometryDataType dtyp
     total += n;
 
     //Update bounds on single vertex reads (except labels)
-    if (n == 1 && type != lucLabelType) // && !internal)
+    if (n == 1 && data && type != lucLabelType) // && !internal)
     {
       if (unscale)
       {
@@ -1129,6 +1284,37 @@ GeomData* Geometry::read(GeomData* geom, unsigned int n, const void* data, std::
   return geom; //Return data store pointer
 }
 
+GeomData* Geometry::adopt(DrawingObject* draw, unsigned int n, lucGeometryDataType dtype, DataContainer* source, int width, int height, int depth)
+{
+  //As read(), but the store takes over the source data instead of copying it
+  GeomData* geomdata = read(draw, 0, dtype, NULL, width, height, depth);
+  if (n == 0) return geomdata;
+
+  geomdata->data[dtype]->adopt(source);
+  if (dtype == lucVertexData)
+  {
+    geomdata->count += n;
+    total += n;
+  }
+  return geomdata;
+}
+
+GeomData* Geometry::adopt(DrawingObject* draw, unsigned int n, DataContainer* source, std::string label)
+{
+  //As read(), but the labelled value store takes over the source data instead of copying it
+  GeomData* geomdata = read(draw, 0, NULL, label);
+  if (n == 0) return geomdata;
+
+  FloatValues* store = NULL;
+  for (auto vals : geomdata->values)
+  {
+    if (vals->label == label)
+      store = vals;
+  }
+  store->adopt(source);
+  return geomdata;
+}
+
 //Read a triangle with optional resursive splitting and y/z swap
 void Geometry::addTriangle(DrawingObject* obj, float* a, float* b, float* c, int level, bool swapY)
 {
@@ -1239,6 +1425,37 @@ void Geometry::insertFixed(Geometry* fixed)
   //std::cout << fixed->total << " + NEW TOTAL == " << total << std::endl;
 }
 
+void Geometry::append(DrawingObject* draw, GeomData* source)
+{
+  //Copy data generated in a separate store onto the end of the object's current store,
+  //indices are offset to follow the existing vertices
+  if (!source || source->count == 0) return;
+  GeomData* geomdata = getObjectStore(draw);
+  if (!geomdata) geomdata = add(draw);
+
+  unsigned int offset = geomdata->count;
+  if (offset > 0)
+  {
+    for (unsigned int j=0; j<source->indices.size(); j++)
+      source->indices.value[j] += offset;
+  }
+
+  for (int t=lucMinDataType; t<lucMaxDataType; t++)
+  {
+    DataContainer* src = source->data[t];
+    if (!src || !geomdata->data[t] || src->size() == 0) continue;
+    geomdata->data[t]->read(src->count(), src->ref());
+  }
+
+  geomdata->count += source->count;
+  total += source->count;
+  if (source->min[0] <= source->max[0])
+  {
+    geomdata->checkPointMinMax(source->min);
+    geomdata->checkPointMinMax(source->max);
+  }
+}
+
 void Geometry::label(DrawingObject* draw, const char* labels)
 {
   //Get passed object's most recently added data store and add vertex labels (newline separated)
@@ -1389,7 +1606,6 @@ int compareParticle(const void *a, const void *b)
 //         if zero a default value is automatically calculated based on length & scale
 // head_scale: scaling factor for head radius compared to shaft, if zero then no arrow head is drawn
 // segment_count: number of primitives to draw circular geometry with, 16 is usually a good default
-#define RADIUS_DEFAULT_RATIO 0.02   // Default radius as a ratio of length
 void Geometry::drawVector(DrawingObject *draw, float pos[3], float vector[3], float scale, float radius0, float radius1, float head_scale, int segment_count)
 {
   std::vector<unsigned int> indices;
@@ -1424,9 +1640,6 @@ void Geometry::drawVector(DrawingObject *draw, float pos[3], float vector[3], fl
   if (head_scale > 0 && head_scale < 1.0)
     head_scale = 0.5 * head_scale / RADIUS_DEFAULT_RATIO; // Convert from fraction of length to multiple of radius
 
-  // Get circle coords
-  drawstate.cacheCircleCoords(segment_count);
-
   // Render a 3d arrow, cone with base for head, cylinder for shaft
 
   // Length of the drawn vector = vector magnitude * scaling factor
@@ -1455,7 +1668,11 @@ void Geometry::drawVector(DrawingObject *draw, float pos[3], float vector[3], fl
     read(draw, 1, lucVertexData, vertex.ref());
     return;
   }
-  else if (length > headD)
+
+  // Get circle coords
+  drawstate.cacheCircleCoords(segment_count);
+
+  if (length > headD)
   {
     int v;
     for (v=0; v <= segment_count; v++)
@@ -1834,26 +2051,36 @@ Glyphs::Glyphs(DrawState& drawstate) : Geometry(drawstate)
   //Create sub-renderers
   lines = new Lines(drawstate);
   tris = new TriSurfaces(drawstate);
-  tris->internal = lines->internal = true;
+  instances = new Instances(drawstate);
+  tris->internal = lines->internal = instances->internal = true;
+  tessellate = false;
 }
 
 Glyphs::~Glyphs()
 {
   delete lines;
   delete tris;
+  delete instances;
 }
 
 void Glyphs::close()
 {
   lines->close();
   tris->close();
+  instances->close();
   Geometry::close();
 }
 
+size_t Glyphs::gpuMemory()
+{
+  return lines->gpuMemory() + tris->gpuMemory() + instances->gpuMemory();
+}
+
 void Glyphs::setup(View* vp, float* min, float* max)
 {
   lines->setup(vp, min, max);
   tris->setup(vp, min, max);
+  instances->setup(vp);
   Geometry::setup(vp, min, max);
 }
 
@@ -1870,8 +2097,11 @@ void Glyphs::display()
 
   if (!reload && drawstate.global("gpucache"))
   {
-    //Skip re-gen of internal geometry shapes
-    redraw = false;
+    //Skip re-gen of internal geometry shapes, unless objects are flagged for partial update
+    bool dirty = false;
+    for (unsigned int i=0; partial && i<geom.size(); i++)
+      dirty |= geom[i]->dirty;
+    if (!dirty) redraw = false;
   }
 
   //Render in parent display call
@@ -1882,6 +2112,79 @@ void Glyphs::update()
 {
   tris->update();
   lines->update();
+  instances->update();
+}
+
+#define GLYPH_BLOCK 16384 //Elements per task when generating glyphs in parallel
+
+void Glyphs::generate(DrawingObject* draw, unsigned int count, int segments, const GlyphGenerator& func)
+{
+  //Circle coords are shared, must be cached for the only segment count used before threads start
+  if (segments > 0) drawstate.cacheCircleCoords(segments);
+
+  unsigned int blocks = (count + GLYPH_BLOCK - 1) / GLYPH_BLOCK;
+  int threads = drawstate.global("threads");
+  if (blocks <= 1 || threads == 1)
+  {
+    func(tris, lines, instances, draw, 0, count);
+    return;
+  }
+
+  //Each block of elements is generated into its own containers, stored under a scratch
+  //object so the shared drawing object is not modified from the worker threads
+  std::vector<DrawingObject*> keys(blocks);
+  std::vector<Geometry*> outputs(blocks * 2);
+  std::vector<Instances*> blockinstances(blocks);
+  Geometry* targets[2] = {tris, lines};
+  for (unsigned int b=0; b<blocks; b++)
+  {
+    keys[b] = new DrawingObject(drawstate);
+    for (int g=0; g<2; g++)
+    {
+      Geometry* out = outputs[b*2+g] = new Geometry(drawstate);
+      out->type = targets[g]->type;
+      out->internal = true;
+      out->unscale = targets[g]->unscale;
+      out->iscale = targets[g]->iscale;
+    }
+    blockinstances[b] = new Instances(drawstate);
+  }
+
+  parallel_for(blocks, [&](unsigned int b)
+  {
+    unsigned int start = b * GLYPH_BLOCK;
+    func(outputs[b*2], outputs[b*2+1], blockinstances[b], keys[b], start, min(start + GLYPH_BLOCK, count));
+  }, threads);
+
+  //Concatenate in element order so output matches serial generation
+  for (int g=0; g<2; g++)
+  {
+    //Allocate the combined size up front
+    GeomData* dest = targets[g]->getObjectStore(draw);
+    for (int t=lucMinDataType; dest && t<lucMaxDataType; t++)
+    {
+      if (!dest->data[t]) continue;
+      unsigned long size = dest->data[t]->size();
+      for (unsigned int b=0; b<blocks; b++)
+      {
+        GeomData* src = outputs[b*2+g]->getObjectStore(keys[b]);
+        if (src) size += src->data[t]->size();
+      }
+      dest->data[t]->resize(size);
+    }
+
+    for (unsigned int b=0; b<blocks; b++)
+      targets[g]->append(draw, outputs[b*2+g]->getObjectStore(keys[b]));
+  }
+
+  for (unsigned int b=0; b<blocks; b++)
+  {
+    instances->append(blockinstances[b]);
+    delete blockinstances[b];
+    delete outputs[b*2];
+    delete outputs[b*2+1];
+    delete keys[b];
+  }
 }
 
 void Glyphs::draw()
@@ -1899,12 +2202,31 @@ void Glyphs::draw()
     glPopMatrix();
   }
 
+  if (instances->total)
+  {
+    glPushMatrix();
+    if (instances->unscale)
+      glScalef(instances->iscale[0], instances->iscale[1], instances->iscale[2]);
+
+    instances->draw();
+
+    glPopMatrix();
+  }
+
   if (lines->total)
     lines->draw();
 }
 
 void Glyphs::jsonWrite(DrawingObject* draw, json& obj)
 {
+  //Instanced glyphs have no triangles to export, generate them then switch back on next display
+  if (instances->total && view)
+  {
+    tessellate = true;
+    update();
+    tessellate = false;
+    reload = true;
+  }
   tris->jsonWrite(draw, obj);
   lines->jsonWrite(draw, obj);
 }
@@ -43,6 +43,7 @@
 #include "Shaders.h"
 #include "TimeStep.h"
 #include "base64.h"
+#include "DepthSort.h"
 
 #ifndef Geometry__
 #define Geometry__
@@ -68,13 +69,6 @@ typedef struct
   float* vertex; //Pointer to vertex
 } PIndex;
 
-typedef struct
-{
-  unsigned short distance;
-  GLuint index[3]; //global indices
-  float* vertex; //Pointer to vertex to calc distance from (usually centroid)
-} TIndex;
-
 //Geometry object data store
 #define MAX_DATA_ARRAYS 64
 class GeomData
@@ -89,6 +83,7 @@ public:
   unsigned int depth;
   char* labelptr;
   bool opaque;   //Flag for opaque geometry, render first, don't depth sort
+  bool dirty;    //Vertex buffer range needs upload, see Geometry::redrawObject()
   unsigned int fixedOffset; //Offset to end of fixed value data
   ImageLoader* texture; //Texture
   std::vector<Filter> filterCache;
@@ -114,6 +109,7 @@ public:
 
   std::vector<DataContainer*> data;
   std::vector<FloatValues*> values;
+  std::map<std::string, std::vector<int> > deferred; //Value data not yet loaded, database row ids by label
 
   static unsigned int byteSize(lucGeometryDataType type)
   {
@@ -124,7 +120,7 @@ public:
     return sizeof(float);
   }
 
-  GeomData(DrawingObject* draw, lucGeometryType type) : draw(draw), count(0), width(0), height(0), depth(0), labelptr(NULL), opaque(false), type(type)
+  GeomData(DrawingObject* draw, lucGeometryType type) : draw(draw), count(0), width(0), height(0), depth(0), labelptr(NULL), opaque(false), dirty(false), type(type)
   {
     data.resize(MAX_DATA_ARRAYS); //Maximum increased to allow predefined data plus generic value data arrays
     data[lucVertexData] = &vertices;
@@ -169,6 +165,7 @@ public:
   void mapToColour(Colour& colour, float value);
   int colourCount();
   void getColour(Colour& colour, unsigned int idx);
+  void getColours(Colour* colours, unsigned int start, unsigned int count);
   unsigned int valuesLookup(const json& by);
   bool filter(unsigned int idx);
   FloatValues* colourData();
@@ -191,38 +188,23 @@ public:
   }
 };
 
-//Class for surface vertices, sorting, collating & averaging normals
-class Vertex
+//Optimised unstructured triangle mesh, duplicate vertices merged
+class MeshData
 {
 public:
-  Vertex() : vert(NULL), ref(-1), vcount(1) {}
+  bool vnormals;    //Calculate vertex normals
+  bool optimise;    //Merge duplicate vertices
+  bool vertColour;  //Average per-vertex colour values of merged vertices
+  std::vector<float> vertices;
+  std::vector<Vec3d> normals;
+  std::vector<float> values;
+  std::vector<GLuint> indices;
 
-  float* vert;
-  int ref;
-  int id;
-  int vcount;
+  MeshData() : vnormals(false), optimise(false), vertColour(false) {}
 
-  bool operator<(const Vertex &rhs) const
-  {
-    //Comparison for vertex sort
-    if (vert[0] != rhs.vert[0]) return vert[0] < rhs.vert[0];
-    if (vert[1] != rhs.vert[1]) return vert[1] < rhs.vert[1];
-    return vert[2] < rhs.vert[2];
-  }
-
-  bool operator==(const Vertex &rhs) const
-  {
-    //Comparison for equality
-    return fabs(vert[0] - rhs.vert[0]) < 0.001 && fabs(vert[1] - rhs.vert[1]) < 0.001 && fabs(vert[2] - rhs.vert[2]) < 0.001;
-  }
-};
-
-//Comparison for sort by id
-struct vertexIdSort
-{
-  bool operator()(const Vertex &a, const Vertex &b)
+  size_t bytes()
   {
-    return (a.id < b.id);
+    return sizeof(float) * (vertices.size() + values.size()) + sizeof(Vec3d) * normals.size() + sizeof(GLuint) * indices.size();
   }
 };
 
@@ -234,11 +216,20 @@ protected:
   View* view;
   std::vector<GeomData*> geom;
   std::vector<bool> hidden;
+  std::vector<bool> culled; //Outside view frustum at last cull()
+  bool partial; //Supports uploading the vbo ranges of changed objects only
+  std::vector<unsigned int> vbocounts; //Vertices of each object in vbo at last full upload
   unsigned int elements;
   unsigned int drawcount;
   bool flat2d; //Flag for flat surfaces in 2d
   DrawingObject* cached;
 
+  bool backgroundSort();
+  bool cull();
+  bool isCulled(unsigned int idx) {return idx < culled.size() && culled[idx];}
+  bool dirtyObjects(std::vector<unsigned int>& objects);
+  void uploaded();
+
 public:
   DrawState& drawstate;
   //Store the actual maximum bounding box
@@ -253,10 +244,12 @@ public:
   virtual ~Geometry();
 
   void clear(bool all=false); //Called before new data loaded
-  void remove(DrawingObject* draw);
+  virtual void remove(DrawingObject* draw);
   void clearValues(DrawingObject* draw, std::string label="");
   void clearData(DrawingObject* draw, lucGeometryDataType dtype);
   virtual void close(); //Called on quit & before gl context recreated
+  virtual size_t gpuMemory() {return 0;} //Graphics memory held in buffers and textures
+  static size_t bufferSize(GLuint buffer);
 
   void compareMinMax(float* min, float* max);
   void dump(std::ostream& csv, DrawingObject* draw=NULL);
@@ -282,9 +275,12 @@ public:
   void read(GeomData* geomdata, unsigned int n, lucGeometryDataType dtype, const void* data, int width=0, int height=0, int depth=0);
   GeomData* read(DrawingObject* draw, unsigned int n, const void* data, std::string label);
   GeomData* read(GeomData* geom, unsigned int n, const void* data, std::string label);
+  GeomData* adopt(DrawingObject* draw, unsigned int n, lucGeometryDataType dtype, DataContainer* source, int width=0, int height=0, int depth=0);
+  GeomData* adopt(DrawingObject* draw, unsigned int n, DataContainer* source, std::string label);
   void addTriangle(DrawingObject* obj, float* a, float* b, float* c, int level, bool swapY=false);
   void setupObject(DrawingObject* draw);
   void insertFixed(Geometry* fixed);
+  void append(DrawingObject* draw, GeomData* source);
   void label(DrawingObject* draw, const char* labels);
   void label(DrawingObject* draw, std::vector<std::string> labels);
   void print();
@@ -324,57 +320,137 @@ class TriSurfaces : public Geometry
 {
   friend class Volumes; //Allow private access from Volumes, QuadSurfaces
   friend class QuadSurfaces;
-  TIndex *tidx;
-  TIndex *swap;
+  std::vector<GLuint> tidx;    //Global vertex indices of sorted (transparent) triangles, 3 per sort item
+  std::vector<GLuint> opaqueidx; //Global vertex indices of opaque triangles, drawn first unsorted
+  DepthSort sorter;
+  bool listed;
   unsigned int tricount;
   unsigned int idxcount;
   std::vector<unsigned int> counts;
   std::vector<Vec3d> centroids;
 protected:
   std::vector<Distance> surf_sort;
-  GLuint indexvbo, vbo;
+  GLuint indexvbo, backvbo, vbo; //backvbo: previous index buffer when sorting in background
 public:
   TriSurfaces(DrawState& drawstate, bool flat2Dflag=false);
   ~TriSurfaces();
   virtual void close();
+  virtual size_t gpuMemory();
   virtual void update();
   int triCount(int index);
   void loadMesh();
   void loadBuffers();
+  void packBuffers(const std::vector<unsigned int>& objects, const std::vector<unsigned char*>& ptrs);
+  bool updateBuffers();
   void loadList();
-  void calcTriangleNormals(int index, std::vector<Vertex> &verts, std::vector<Vec3d> &normals);
+  void optimiseMesh(int index, MeshData& mesh, unsigned int offset, int threads);
+  uint64_t meshHash(int index, MeshData& mesh, int threads);
+  void calcCentroids(int index, unsigned int offset, int threads);
   void calcTriangleNormalsWithIndices(int index);
   void calcGridNormals(int i, std::vector<Vec3d> &normals);
-  void calcGridIndices(int i, std::vector<GLuint> &indices);
-  void depthSort();
+  void calcGridIndices(int i, std::vector<GLuint> &indices, unsigned int offset);
+  bool depthSort();
   virtual void render();
   virtual void draw();
   virtual void jsonWrite(DrawingObject* draw, json& obj);
 };
 
+//Vertices of all objects are uploaded unfiltered, filtering and connectivity are
+//applied by each object's range of the index buffer
 class Lines : public Geometry
 {
   GLuint vbo;
+  GLuint indexvbo;
   unsigned int linetotal;
-  std::vector<unsigned int> counts;
+  std::vector<unsigned int> counts;   //Indices drawn per object
+  std::vector<unsigned int> capacity; //Index buffer range reserved per object
+  std::vector<bool> linked;           //Link setting of each object when indexed
+  std::vector<DrawingObject*> reindexed;
 public:
   Lines(DrawState& drawstate);
   ~Lines();
   virtual void close();
+  virtual size_t gpuMemory();
   virtual void update();
+  unsigned int packVertices(unsigned int i, unsigned char* ptr);
+  unsigned int packIndices(unsigned int i, GLuint* ptr, unsigned int offset);
+  unsigned int indexCapacity(unsigned int i);
+  bool updateVertices();
+  void reindex(DrawingObject* draw);
   virtual void draw();
   virtual void jsonWrite(DrawingObject* draw, json& obj);
 };
 
+#define RADIUS_DEFAULT_RATIO 0.02   // Default radius as a ratio of length
+
+//Glyph template meshes
+#define GLYPH_SPHERE 0
+#define GLYPH_CUBE 1
+#define GLYPH_ARROW 2
+
+//Per-instance attributes of a glyph template mesh
+typedef struct
+{
+  float pos[3];
+  float rot[4];   //Orientation quaternion x,y,z,w
+  float scale[4]; //Template scaling, arrows: shaft radius, head radius, length, head length
+  Colour colour;
+} GlyphInstance;
+
+//Glyphs drawn by instancing a template mesh per shape type and quality,
+//memory and update time depend on element count only
+class Instances : public Geometry
+{
+  typedef struct
+  {
+    GLuint vbo, ibo;
+    unsigned int count;
+    bool normals;
+  } InstanceMesh;
+  std::map<int, InstanceMesh> meshes; //Template meshes by shape and quality
+  std::vector<int> templates;         //Template mesh of each object
+  std::vector<unsigned int> offsets;  //First instance of each object
+  std::vector<GlyphInstance> instances;
+  DepthSort sorter;
+  GLuint vbo;
+  bool uploaded;
+  bool opaque;
+  InstanceMesh& mesh(int key);
+public:
+  Instances(DrawState& drawstate);
+  ~Instances();
+  static bool supported(DrawState& drawstate);
+  virtual void close();
+  virtual size_t gpuMemory();
+  void reset();
+  void add(DrawingObject* draw, int shape, int quality);
+  void push(const Vec3d& pos, const Quaternion& rot, const float scale[4], const Colour& colour)
+  {
+    GlyphInstance in = {{pos.x, pos.y, pos.z}, {rot.x, rot.y, rot.z, rot.w}, {scale[0], scale[1], scale[2], scale[3]}, colour};
+    instances.push_back(in);
+  }
+  void append(Instances* other);
+  virtual void update();
+  void render();
+  virtual void draw();
+};
+
 class Glyphs : public Geometry
 {
 protected:
   Lines* lines;
   TriSurfaces* tris;
+  Instances* instances;
+  bool tessellate; //Output triangles even when instancing is available (for export)
+
+  //Generates glyphs for elements [start,end) of an object into the triangle, line and instance containers
+  typedef std::function<void(Geometry* tris, Geometry* lines, Instances* instances, DrawingObject* draw, unsigned int start, unsigned int end)> GlyphGenerator;
+  void generate(DrawingObject* draw, unsigned int count, int segments, const GlyphGenerator& func);
 public:
   Glyphs(DrawState& drawstate);
   ~Glyphs();
   virtual void close();
+  virtual size_t gpuMemory();
   virtual void setup(View* vp, float* min=NULL, float* max=NULL);
   virtual void display();
   virtual void update();
@@ -385,6 +461,10 @@ public:
 class Links : public Glyphs
 {
   bool all2d, any3d;
+  bool flat(unsigned int i);
+  unsigned int linkIndices(unsigned int i, std::vector<GLuint>& indices);
+  void linkColours(unsigned int i, std::vector<unsigned int>& colours);
+  bool updateObjects();
 public:
   Links(DrawState& drawstate, bool all2Dflag=false);
   virtual void update();
@@ -398,11 +478,39 @@ public:
   virtual void update();
 };
 
+//Vertex of a tracer trail ring buffer, slot is the ring position of the step
+typedef struct
+{
+  float pos[3];
+  Colour colour;
+  float slot;
+} TrailVertex;
+
 class Tracers : public Glyphs
 {
+  //Ring buffer of per-step particle positions for an object's trails,
+  //advancing a step uploads only the newest positions and joining segments
+  typedef struct
+  {
+    GLuint vbo, ibo;
+    unsigned int particles, slots;
+    unsigned int head, filled, shown;
+    int step, datasteps;
+    bool active;
+  } TracerTrail;
+  std::map<DrawingObject*, TracerTrail> trails; //Kept when geometry cleared for next step
+  void updateTrail(unsigned int i, int start, int end, bool timecolour);
+  void trailStep(unsigned int i, int step, std::vector<TrailVertex>& verts, std::vector<bool>& hidden, bool timecolour);
+  void writeTrail(TracerTrail& trail, std::vector<TrailVertex>& verts, std::vector<bool>& hidden,
+                  std::vector<TrailVertex>& prev, std::vector<bool>& prevhidden, float limit);
 public:
   Tracers(DrawState& drawstate);
+  ~Tracers();
+  virtual void close();
+  virtual void remove(DrawingObject* draw);
+  virtual size_t gpuMemory();
   virtual void update();
+  virtual void draw();
 };
 
 class Shapes : public Glyphs
@@ -425,18 +533,41 @@ public:
 
 class Points : public Geometry
 {
-  PIndex *pidx;
-  PIndex *swap;
+  std::vector<GLuint> pidx; //Global vertex index of each sort item
+  DepthSort sorter;
+  //Spatial bricks, sort items grouped by brick, sorted by brick centre
+  std::vector<GLuint> brickidx;
+  std::vector<GLuint> brickstart;
+  std::vector<float> brickbox;   //Bounding box of items in each brick, min[3],max[3]
+  std::vector<float> brickview;  //View direction each brick was last sorted for
+  std::vector<bool> brickculled;
+  DepthSort bricksorter;
+  //Level of detail, coarsest level 0, items of each brick drawn up to level chosen by screen size
+  std::vector<unsigned char> pointlevel;
+  std::vector<unsigned char> bricklevels; //Finest level in each brick
+  float lodscale;     //Spacing factor adjusted to meet frame time budget
+  float lodspacing;   //Spacing used for last selection
+  float lodview[16];  //View used for last selection
+  bool lodreduced;    //Last selection drew reduced detail
   unsigned int idxcount;
-  GLuint indexvbo, vbo;
+  GLuint indexvbo, backvbo, vbo; //backvbo: previous index buffer when sorting in background
 public:
   Points(DrawState& drawstate);
   ~Points();
   virtual void close();
+  virtual size_t gpuMemory();
   virtual void update();
   void loadVertices();
+  void packVertices(const std::vector<unsigned int>& objects, const std::vector<unsigned char*>& ptrs);
+  bool updateVertices();
   void loadList();
-  void depthSort();
+  void loadBricks(int res);
+  bool sortBricks(const float* modelView, float resort, int threads);
+  bool cullBricks();
+  void loadLevels();
+  bool lodActive();
+  bool lodChanged();
+  bool depthSort();
   void render();
   int getPointType(int index=-1);
   virtual void draw();
@@ -445,9 +576,103 @@ public:
   void dumpJSON();
 };
 
+//Value range of a scalar volume summarised over bricks of size^3 voxels,
+//each range includes a one voxel apron so it bounds any value interpolated within the brick
+class VolumeBricks
+{
+public:
+  unsigned int size;
+  unsigned int dims[3];
+  std::vector<float> minimum;
+  std::vector<float> maximum;
+
+  VolumeBricks() : size(0) {dims[0] = dims[1] = dims[2] = 0;}
+
+  unsigned int count() {return minimum.size();}
+  unsigned int index(unsigned int x, unsigned int y, unsigned int z) {return (z * dims[1] + y) * dims[0] + x;}
+  //Can a surface at this value pass through the brick?
+  bool straddles(unsigned int b, float value) {return minimum[b] <= value && maximum[b] >= value;}
+
+  //Build from voxel lookup value(x,y,z) over a volume of resolution res
+  template <typename F>
+  void build(const unsigned int res[3], unsigned int bricksize, F value, int threads=0)
+  {
+    size = bricksize;
+    for (int d=0; d<3; d++)
+      dims[d] = (res[d] + size - 1) / size;
+    minimum.assign(dims[0] * dims[1] * dims[2], HUGE_VALF);
+    maximum.assign(dims[0] * dims[1] * dims[2], -HUGE_VALF);
+    parallel_for(dims[2], [&](unsigned int bz)
+    {
+      unsigned int lo[3], hi[3];
+      for (unsigned int by=0; by<dims[1]; by++)
+      {
+        for (unsigned int bx=0; bx<dims[0]; bx++)
+        {
+          unsigned int b[3] = {bx, by, bz};
+          for (int d=0; d<3; d++)
+          {
+            lo[d] = b[d] > 0 ? b[d] * size - 1 : 0;
+            hi[d] = (b[d] + 1) * size < res[d] ? (b[d] + 1) * size : res[d] - 1;
+          }
+          float vmin = HUGE_VALF, vmax = -HUGE_VALF;
+          for (unsigned int z=lo[2]; z<=hi[2]; z++)
+          {
+            for (unsigned int y=lo[1]; y<=hi[1]; y++)
+            {
+              for (unsigned int x=lo[0]; x<=hi[0]; x++)
+              {
+                float v = value(x, y, z);
+                if (v < vmin) vmin = v;
+                if (v > vmax) vmax = v;
+              }
+            }
+          }
+          unsigned int idx = index(bx, by, bz);
+          minimum[idx] = vmin;
+          maximum[idx] = vmax;
+        }
+      }
+    }, threads);
+  }
+};
+
 class Volumes : public Geometry
 {
   TriSurfaces* twoTriangles;
+
+  //Part of a volume too large for a single 3D texture, offset and size of the voxel region
+  //it renders and start of the texture data, which includes an apron of neighbouring voxels
+  typedef struct
+  {
+    ImageLoader* texture;
+    unsigned int offset[3];
+    unsigned int size[3];
+    unsigned int start[3];
+  } VolumeBlock;
+
+  //Brick value ranges and empty space map of each volume, plus its blocks if split
+  //and reduced resolution levels, NULL where a level exceeds the texture limit
+  typedef struct
+  {
+    VolumeBricks bricks;
+    TextureData* brickmap;
+    std::vector<GLubyte> occupied;
+    std::vector<VolumeBlock> blocks;
+    std::vector<ImageLoader*> levels;
+    unsigned int level; //Level drawn, 0 = full resolution
+    float view[16];     //Modelview when the level was selected
+    unsigned int res[3];
+    int type;
+  } VolumeTextures;
+  std::map<DrawingObject*, VolumeTextures> textures;
+
+  void loadBlocks(unsigned int i, unsigned int limit, bool texcompress);
+  void loadBricks(unsigned int i, bool texcompress);
+  void loadLevels(unsigned int i, unsigned int limit, bool texcompress);
+  unsigned int selectLevel(VolumeTextures& vt, const float* modelView);
+  void freeTextures(VolumeTextures& vt);
+  bool brickMap(unsigned int i, float isovalue, bool iso, float density, const float range[2], ColourMap* cmap);
 public:
   GLuint colourTexture;
   std::map<DrawingObject*, unsigned int> slices;
@@ -455,6 +680,7 @@ public:
   Volumes(DrawState& drawstate);
   ~Volumes();
   virtual void close();
+  virtual size_t gpuMemory();
   virtual void update();
   virtual void draw();
   void render(int i);
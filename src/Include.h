@@ -25,6 +25,9 @@
 #include <typeinfo>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <functional>
+#include <memory>
 
 //C headers
 #include <assert.h>
@@ -62,8 +65,12 @@ using json = nlohmann::json;
 #include <tiffio.h>
 #endif
 
+#include <sys/stat.h>
+
 #ifndef _WIN32
 #include <sys/poll.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #define PAUSE(msecs) usleep(msecs * 1000);
@@ -0,0 +1,372 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+** Copyright (c) 2010, Monash University
+** All rights reserved.
+** Redistribution and use in source and binary forms, with or without modification,
+** are permitted provided that the following conditions are met:
+**
+**       * Redistributions of source code must retain the above copyright notice,
+**          this list of conditions and the following disclaimer.
+**       * Redistributions in binary form must reproduce the above copyright
+**         notice, this list of conditions and the following disclaimer in the
+**         documentation and/or other materials provided with the distribution.
+**       * Neither the name of the Monash University nor the names of its contributors
+**         may be used to endorse or promote products derived from this software
+**         without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+** THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+** PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+** HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+** OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**
+** Contact:
+*%  Owen Kaluza - Owen.Kaluza(at)monash.edu
+*%
+*% Development Team :
+*%  http://www.underworldproject.org/aboutus.html
+**
+**~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+#include "Geometry.h"
+
+Instances::Instances(DrawState& drawstate) : Geometry(drawstate), vbo(0), uploaded(false), opaque(true)
+{
+  type = lucTriangleType;
+}
+
+Instances::~Instances()
+{
+  close();
+}
+
+bool Instances::supported(DrawState& drawstate)
+{
+  //Requires instanced arrays and draw calls (ARB extensions, core in GL 3.3)
+  //and the instance shader, otherwise glyphs are tessellated
+  static int available = -1;
+  if (available < 0)
+  {
+    const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+    available = ext && strstr(ext, "GL_ARB_instanced_arrays") && strstr(ext, "GL_ARB_draw_instanced");
+#ifdef EXTENSION_POINTERS
+    if (!glVertexAttribDivisorARB || !glDrawElementsInstancedARB) available = 0;
+#endif
+    debug_print("Instanced glyph rendering %s\n", available ? "available" : "not supported");
+  }
+  Shader* prog = drawstate.prog[lucShapeType];
+  return available && prog && prog->program && drawstate.global("glyphinstancing");
+}
+
+void Instances::close()
+{
+  if (vbo)
+    glDeleteBuffers(1, &vbo);
+  vbo = 0;
+  for (auto it = meshes.begin(); it != meshes.end(); ++it)
+  {
+    glDeleteBuffers(1, &it->second.vbo);
+    glDeleteBuffers(1, &it->second.ibo);
+  }
+  meshes.clear();
+  sorter.clear();
+  uploaded = false;
+
+  reload = true;
+}
+
+size_t Instances::gpuMemory()
+{
+  size_t bytes = bufferSize(vbo);
+  for (auto it = meshes.begin(); it != meshes.end(); ++it)
+    bytes += bufferSize(it->second.vbo) + bufferSize(it->second.ibo);
+  return bytes;
+}
+
+void Instances::reset()
+{
+  //Clear objects and instances, template meshes are kept
+  clear();
+  templates.clear();
+  offsets.clear();
+  instances.clear();
+  uploaded = false;
+}
+
+void Instances::add(DrawingObject* draw, int shape, int quality)
+{
+  //New object, following instances use the template for shape and quality
+  Geometry::add(draw);
+  templates.push_back(shape * 1024 + quality);
+  offsets.push_back(instances.size());
+}
+
+void Instances::append(Instances* other)
+{
+  //Instances generated separately for the current object
+  instances.insert(instances.end(), other->instances.begin(), other->instances.end());
+}
+
+Instances::InstanceMesh& Instances::mesh(int key)
+{
+  auto it = meshes.find(key);
+  if (it != meshes.end()) return it->second;
+
+  //Tessellate the template once, vertices: position(3), normal(3), texcoord(2)
+  int shape = key / 1024;
+  int quality = key % 1024;
+  std::vector<float> verts;
+  std::vector<GLuint> indices;
+  InstanceMesh m;
+  m.normals = true;
+  if (shape == GLYPH_ARROW)
+  {
+    //Arrow along z axis with unit length, centred on origin
+    //x,y are multiples of the shaft (texcoord y=0) or head radius (texcoord y=1),
+    //texcoord x is the z offset in head lengths, applied in the shader
+    drawstate.cacheCircleCoords(quality);
+    float* x = drawstate.x_coords;
+    float* y = drawstate.y_coords;
+    for (int v=0; v <= quality; v++)
+    {
+      //Shaft base and top
+      float base[8] = {x[v], y[v], -0.5, x[v], y[v], 0, 0, 0};
+      float top[8] = {x[v], y[v], 0.5, x[v], y[v], 0, -1, 0};
+      verts.insert(verts.end(), base, base+8);
+      verts.insert(verts.end(), top, top+8);
+      if (v > 0)
+      {
+        GLuint i = v*2;
+        GLuint tri[6] = {i-2, i-1, i, i-1, i+1, i};
+        indices.insert(indices.end(), tri, tri+6);
+      }
+    }
+    //Head cone, pinnacle duplicated as each facet needs a different normal
+    //Normals are for the slope of a cone of unit radius and height,
+    //the shader scales them to the head radius and length of each instance
+    GLuint start = verts.size() / 8;
+    for (int v=quality; v >= 0; v--)
+    {
+      Vec3d normal = Vec3d(x[v], y[v], 1.0);
+      normal.normalise();
+      float tip[8] = {0, 0, 0.5, normal.x, normal.y, normal.z, 0, 1};
+      float rim[8] = {x[v], y[v], 0.5, normal.x, normal.y, normal.z, -1, 1};
+      verts.insert(verts.end(), tip, tip+8);
+      verts.insert(verts.end(), rim, rim+8);
+      if (v < quality)
+      {
+        GLuint i = start + (quality - v) * 2;
+        GLuint tri[3] = {i, i-1, i+1};
+        indices.insert(indices.end(), tri, tri+3);
+      }
+    }
+    //Head base
+    GLuint centre = verts.size() / 8;
+    float mid[8] = {0, 0, 0.5, 0, 0, -1, -1, 1};
+    verts.insert(verts.end(), mid, mid+8);
+    for (int v=0; v <= quality; v++)
+    {
+      float rim[8] = {x[v], y[v], 0.5, 0, 0, -1, -1, 1};
+      verts.insert(verts.end(), rim, rim+8);
+      if (v > 0)
+      {
+        GLuint i = centre + 1 + v;
+        GLuint tri[3] = {centre, i-1, i};
+        indices.insert(indices.end(), tri, tri+3);
+      }
+    }
+  }
+  else
+  {
+    //Unit sphere or cube from the same tessellation used for individual shapes
+    DrawingObject obj(drawstate);
+    Geometry shapes(drawstate);
+    Vec3d pos;
+    Vec3d dims(1.0, 1.0, 1.0);
+    Quaternion rot;
+    if (shape == GLYPH_CUBE)
+      shapes.drawCuboidAt(&obj, pos, dims, rot);
+    else
+      shapes.drawEllipsoid(&obj, pos, dims, rot, quality);
+    GeomData* g = shapes.getObjectStore(&obj);
+    m.normals = g && g->normals.size() > 0;
+    for (unsigned int v=0; g && v < g->count; v++)
+    {
+      float vert[8] = {0};
+      memcpy(vert, g->vertices[v], sizeof(float)*3);
+      if (m.normals) memcpy(vert+3, g->normals[v], sizeof(float)*3);
+      if (g->texCoords.size() > 0) memcpy(vert+6, g->texCoords[v], sizeof(float)*2);
+      verts.insert(verts.end(), vert, vert+8);
+    }
+    if (g && g->indices.size())
+    {
+      indices.resize(g->indices.size());
+      memcpy(indices.data(), g->indices.ref(), sizeof(GLuint) * indices.size());
+    }
+  }
+
+  glGenBuffers(1, &m.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+  glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(float), verts.data(), GL_STATIC_DRAW);
+  glGenBuffers(1, &m.ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  GL_Error_Check;
+  m.count = indices.size();
+  debug_print("Glyph template %d quality %d, %d vertices %d triangles\n", shape, quality, (int)verts.size()/8, m.count/3);
+  meshes[key] = m;
+  return meshes[key];
+}
+
+void Instances::update()
+{
+  total = instances.size();
+  if (total == 0) return;
+
+  //Transparent objects need instances sorted back to front
+  opaque = true;
+  for (unsigned int i=0; i<geom.size(); i++)
+  {
+    Properties& props = geom[i]->draw->properties;
+    if (props["wireframe"] || props["opaque"]) continue;
+    unsigned int end = i+1 < geom.size() ? offsets[i+1] : instances.size();
+    bool alpha = (float)props["opacity"] < 1.0 || (float)props["alpha"] < 1.0;
+    for (unsigned int j=offsets[i]; j<end && !alpha; j++)
+      alpha = instances[j].colour.a < 255;
+    if (alpha) opaque = false;
+  }
+
+  if (!opaque)
+  {
+    sorter.resize(total);
+    for (unsigned int j=0; j<total; j++)
+      sorter.set(j, instances[j].pos);
+  }
+  else
+    sorter.clear();
+
+  uploaded = false;
+  view->sort = true;
+}
+
+void Instances::render()
+{
+  //Upload instances, sorted back to front within each object if any are transparent
+  if (total == 0) return;
+  clock_t t1 = clock();
+  bool sorted = false;
+  if (!opaque)
+  {
+    float maxdist, mindist;
+    view->getMinMaxDistance(&mindist, &maxdist);
+    int threads = drawstate.global("threads");
+    sorted = sorter.update(view->modelView, mindist, maxdist, drawstate.global("sortskip"), threads);
+  }
+  if (uploaded && !sorted) return;
+
+  if (!vbo) glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  if (opaque)
+    glBufferData(GL_ARRAY_BUFFER, total * sizeof(GlyphInstance), instances.data(), GL_STATIC_DRAW);
+  else
+  {
+    //Keys are nearest first, each instance placed in its own object's range
+    std::vector<GlyphInstance> staging(total);
+    std::vector<unsigned int> fill(offsets);
+    std::vector<SortKey>& keys = sorter.order();
+    unsigned int obj = 0;
+    for (int k=keys.size()-1; k>=0; k--)
+    {
+      unsigned int j = keys[k].index;
+      //Object owning instance j, offsets ascending
+      obj = std::upper_bound(offsets.begin(), offsets.end(), j) - offsets.begin() - 1;
+      staging[fill[obj]++] = instances[j];
+    }
+    glBufferData(GL_ARRAY_BUFFER, total * sizeof(GlyphInstance), staging.data(), GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  GL_Error_Check;
+  uploaded = true;
+  debug_print("  %.4lf seconds to upload %d glyph instances\n", (clock()-t1)/(double)CLOCKS_PER_SEC, total);
+}
+
+void Instances::draw()
+{
+  if (total == 0) return;
+  Shader* prog = drawstate.prog[lucShapeType];
+  if (!prog || !prog->program) return;
+  if (view->sort || !uploaded) render();
+  GL_Error_Check;
+
+  //Clear cached object, state set for each
+  cached = NULL;
+
+  GLint attribs[4] = {prog->attribs["aInstancePosition"], prog->attribs["aInstanceRotation"],
+                      prog->attribs["aInstanceScale"], prog->attribs["aInstanceColour"]};
+  int stride = 8 * sizeof(float); //3+3+2 vertices, normals, texCoord
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_COLOR_ARRAY);
+  for (int a=0; a<4; a++)
+  {
+    if (attribs[a] < 0) continue;
+    glEnableVertexAttribArray(attribs[a]);
+    glVertexAttribDivisorARB(attribs[a], 1);
+  }
+
+  for (unsigned int i=0; i<geom.size(); i++)
+  {
+    unsigned int end = i+1 < geom.size() ? offsets[i+1] : instances.size();
+    unsigned int count = end - offsets[i];
+    //Instance stores hold no vertices so drawable() can't be used
+    if (count == 0 || hidden[i] || !geom[i]->draw->properties["visible"]) continue;
+    if (view->filtered && !view->hasObject(geom[i]->draw)) continue;
+
+    InstanceMesh& m = mesh(templates[i]);
+    if (m.count == 0) continue;
+    setState(i, prog); //Set draw state settings for this object
+    prog->setUniform("uCalcNormal", !m.normals);
+    prog->setUniform("uArrow", templates[i] / 1024 == GLYPH_ARROW);
+
+    //Template mesh
+    glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+    glVertexPointer(3, GL_FLOAT, stride, (GLvoid*)0);
+    glNormalPointer(GL_FLOAT, stride, (GLvoid*)(3*sizeof(float)));
+    glTexCoordPointer(2, GL_FLOAT, stride, (GLvoid*)(6*sizeof(float)));
+
+    //Per-instance attributes for this object's range
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    size_t offset = offsets[i] * sizeof(GlyphInstance);
+    if (attribs[0] >= 0) glVertexAttribPointer(attribs[0], 3, GL_FLOAT, GL_FALSE, sizeof(GlyphInstance), (GLvoid*)(offset));
+    if (attribs[1] >= 0) glVertexAttribPointer(attribs[1], 4, GL_FLOAT, GL_FALSE, sizeof(GlyphInstance), (GLvoid*)(offset + 3*sizeof(float)));
+    if (attribs[2] >= 0) glVertexAttribPointer(attribs[2], 4, GL_FLOAT, GL_FALSE, sizeof(GlyphInstance), (GLvoid*)(offset + 7*sizeof(float)));
+    if (attribs[3] >= 0) glVertexAttribPointer(attribs[3], 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GlyphInstance), (GLvoid*)(offset + 11*sizeof(float)));
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.ibo);
+    glDrawElementsInstancedARB(GL_TRIANGLES, m.count, GL_UNSIGNED_INT, (GLvoid*)0, count);
+    GL_Error_Check;
+  }
+
+  for (int a=0; a<4; a++)
+  {
+    if (attribs[a] < 0) continue;
+    glVertexAttribDivisorARB(attribs[a], 0);
+    glDisableVertexAttribArray(attribs[a]);
+  }
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  GL_Error_Check;
+}
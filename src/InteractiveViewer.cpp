@@ -1893,7 +1893,8 @@ bool LavaVu::parseCommand(std::string cmd, bool gethelp)
     {
       help += "Export object data\n\n"
               "**Usage:** export [format] [object]\n\n"
-              "format (string) : json/csv/db/dbz (default: dbz = compressed db)\n"
+              "format (string) : json/csv/db/dbz/lvcache (default: dbz = compressed db)\n"
+              "                  lvcache converts all timesteps of the loaded database into binary cache files\n"
               "object (integer/string) : the index or name of the object to export (see: \"list objects\")\n"
               "object_name (string) : the name of the object to export (see: \"list objects\")\n"
               "If object ommitted all will be exported\n";
@@ -1902,6 +1903,7 @@ bool LavaVu::parseCommand(std::string cmd, bool gethelp)
 
     std::string what = parsed["export"];
     lucExportType type = what == "json" ? lucExportJSON : (what == "csv" ? lucExportCSV : (what == "db" ? lucExportGLDB : lucExportGLDBZ));
+    if (what == "lvcache") type = lucExportLVCACHE;
     //Export drawing object by name/ID match
     std::vector<DrawingObject*> list = lookupObjects(parsed, "export");
     if (list.size() == 0)
@@ -1924,12 +1926,14 @@ bool LavaVu::parseCommand(std::string cmd, bool gethelp)
     if (gethelp)
     {
       help += "List available data\n\n"
-              "**Usage:** list objects/colourmaps/elements\n\n"
+              "**Usage:** list objects/colourmaps/elements/data/prefetch/cache\n\n"
               "objects : enable object list (stays on screen until disabled)\n"
               "          (dimmed objects are hidden or not in selected viewport)\n"
               "colourmaps : show colourmap list\n"
               "elements : show geometry elements by id in terminal\n"
-              "data : show available data sets in selected object or all\n";
+              "data : show available data sets in selected object or all\n"
+              "prefetch : show background timestep loading statistics\n"
+              "cache : show timestep cache statistics\n";
       return false;
     }
 
@@ -1963,6 +1967,7 @@ bool LavaVu::parseCommand(std::string cmd, bool gethelp)
     {
       int offset = 0;
       std::vector<std::string> list;
+      amodel->loadDeferred(true, aobject);
       if (aobject)
       {
         displayText("Data sets for: " + aobject->name(), ++offset);
@@ -1989,6 +1994,30 @@ bool LavaVu::parseCommand(std::string cmd, bool gethelp)
       viewer->display(false);  //Immediate display
       return false;
     }
+    else if (parsed["list"] == "prefetch")
+    {
+      //Hits: ready when requested, waits: still loading when requested, misses: not prefetched
+      std::stringstream ss;
+      ss << "Prefetch: hits " << amodel->prefetchHits << " waits " << amodel->prefetchWaits
+         << " misses " << amodel->prefetchMisses;
+      displayText(ss.str(), 1);
+      std::cerr << ss.str() << std::endl;
+      viewer->display(false);  //Immediate display
+      return false;
+    }
+    else if (parsed["list"] == "cache")
+    {
+      std::stringstream ss;
+      ss << "Cache: " << amodel->cachedSteps() << " / " << amodel->timesteps.size() << " steps, "
+         << std::fixed << std::setprecision(3) << membytes__/1000000.0f << " mb, hits " << amodel->cacheHits
+         << " misses " << amodel->cacheMisses << " evictions " << amodel->cacheEvictions;
+      if (drawstate.global("gpucache"))
+        ss << ", gpu " << amodel->gpuCachedSteps() << " steps, " << amodel->gpuCacheBytes()/1000000.0f << " mb, releases " << amodel->gpuEvictions;
+      displayText(ss.str(), 1);
+      std::cerr << ss.str() << std::endl;
+      viewer->display(false);  //Immediate display
+      return false;
+    }
     else //if (parsed["list"] == "objects")
     {
       objectlist = !objectlist;
@@ -2914,6 +2943,15 @@ bool LavaVu::parseCommand(std::string cmd, bool gethelp)
       aview->rotated = false;
     }
 
+    //Refine reduced level of detail
+    if (drawstate.refinetimer || (drawstate.reduced && (int)drawstate.global("sort") > 0))
+    {
+      drawstate.fulldetail = true;
+      if (drawstate.refinetimer)
+        viewer->idleTimer(0); //Stop idle redisplay timer
+      drawstate.refinetimer = false;
+    }
+
     //Command playback
     if (repeat != 0)
     {
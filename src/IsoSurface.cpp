@@ -179,6 +179,16 @@ Isosurface::Isosurface(std::vector<GeomData*>& geom, TriSurfaces* tris, DrawingO
     debug_print(" %s width %d height %d depth %d, sampled %d %d %d\n", current->name().c_str(), geom[i]->width, geom[i]->height, depth, nx, ny, nz);
     t2 = clock(); debug_print("  Vertex load took %.4lf seconds.\n", (t2-t1)/(double)CLOCKS_PER_SEC); t1 = clock();
 
+    //Summarise the value ranges once for all isovalues
+    bricks = VolumeBricks();
+    unsigned int bricksize = current->properties["bricksize"];
+    if (bricksize > 0)
+    {
+      unsigned int res[3] = {nx, ny, nz};
+      bricks.build(res, bricksize, [&](unsigned int x, unsigned int y, unsigned int z) {return vertex->at(x,y,z).value;}, surfaces->drawstate.global("threads"));
+      t2 = clock(); debug_print("  Value range bricks took %.4lf seconds.\n", (t2-t1)/(double)CLOCKS_PER_SEC); t1 = clock();
+    }
+
     for (auto isoval : isovalues)
     {
       isovalue = isoval;
@@ -520,6 +530,13 @@ void Isosurface::MarchingCubes()
       {
          for (unsigned int k = 0 ; k < nz - 1 ; k++ )
          {
+            /* Skip to the next brick if the surface does not pass through this one */
+            if (bricks.count() && !bricks.straddles(bricks.index(i / bricks.size, j / bricks.size, k / bricks.size), isovalue))
+            {
+               k += bricks.size - 1 - k % bricks.size;
+               continue;
+            }
+
             /* Determine the index into the edge table which tells us which vertices are inside of the surface */
             cubeindex = 0;
             if (vertex->at(i,j,k).value       < isovalue) cubeindex |= 1;
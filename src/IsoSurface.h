@@ -86,6 +86,7 @@ public:
   DrawingObject* target;
   FloatValues* colourVals;
   vertices* vertex;
+  VolumeBricks bricks; //Value ranges of bricks of cells, skipped where the isovalue is not crossed
 
   Isosurface(std::vector<GeomData*>& geom, TriSurfaces* tris, DrawingObject* target, unsigned int subsample=1);
 
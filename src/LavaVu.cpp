@@ -98,6 +98,8 @@ LavaVu::LavaVu(std::string binpath, bool omegalib) : binpath(binpath)
   if (!viewer) viewer = new OpenGLViewer();
 
   viewer->app = (ApplicationInterface*)this;
+  //Redisplay when background depth sorts complete
+  drawstate.redisplay = [this]() {viewer->postdisplay = true;};
 
   //Shader path (default to program path if not set)
   if (binpath.back() != '/') binpath += "/";
@@ -573,6 +575,12 @@ std::string LavaVu::exportData(lucExportType type, DrawingObject* obj)
     dumpCSV(obj);
     return "CSV files";
   }
+  else if (type == lucExportLVCACHE)
+  {
+    //Converts all timesteps of database, objects not selectable
+    int count = amodel->writeCache();
+    return std::to_string(count) + " lvcache files";
+  }
   return "";
 }
 
@@ -1541,6 +1549,15 @@ void LavaVu::reloadShaders()
                              "uBrightness", "uContrast", "uSaturation"};
   drawstate.prog[lucLineType]->loadUniforms(lUniforms, sizeof(lUniforms)/sizeof(char*));
 
+  //Tracer trail shaders
+  if (drawstate.prog[lucTracerType]) delete drawstate.prog[lucTracerType];
+  drawstate.prog[lucTracerType] = new Shader("trailShader.vert", "trailShader.frag");
+  drawstate.prog[lucTracerType]->loadUniforms(lUniforms, sizeof(lUniforms)/sizeof(char*));
+  const char* trUniforms[] = {"uHead", "uSlots", "uFilled", "uFade", "uTimeColour", "uColourMap"};
+  drawstate.prog[lucTracerType]->loadUniforms(trUniforms, sizeof(trUniforms)/sizeof(char*));
+  const char* trAttribs[] = {"aSlot"};
+  drawstate.prog[lucTracerType]->loadAttribs(trAttribs, sizeof(trAttribs)/sizeof(char*));
+
   //Triangle shaders
   if (drawstate.prog[lucTriangleType]) delete drawstate.prog[lucTriangleType];
   drawstate.prog[lucTriangleType] = new Shader("triShader.vert", "triShader.frag");
@@ -1551,6 +1568,16 @@ void LavaVu::reloadShaders()
   drawstate.prog[lucTriangleType]->loadUniforms(tUniforms, sizeof(tUniforms)/sizeof(char*));
   drawstate.prog[lucGridType] = drawstate.prog[lucTriangleType];
 
+  //Instanced glyph shaders (shapes and vectors)
+  if (drawstate.prog[lucShapeType]) delete drawstate.prog[lucShapeType];
+  drawstate.prog[lucShapeType] = new Shader("instanceShader.vert", "triShader.frag");
+  drawstate.prog[lucShapeType]->loadUniforms(tUniforms, sizeof(tUniforms)/sizeof(char*));
+  const char* iUniforms[] = {"uArrow"};
+  drawstate.prog[lucShapeType]->loadUniforms(iUniforms, sizeof(iUniforms)/sizeof(char*));
+  const char* iAttribs[] = {"aInstancePosition", "aInstanceRotation", "aInstanceScale", "aInstanceColour"};
+  drawstate.prog[lucShapeType]->loadAttribs(iAttribs, sizeof(iAttribs)/sizeof(char*));
+  drawstate.prog[lucVectorType] = drawstate.prog[lucShapeType];
+
   //Volume ray marching shaders
   if (drawstate.prog[lucVolumeType]) delete drawstate.prog[lucVolumeType];
   drawstate.prog[lucVolumeType] = new Shader("volumeShader.vert", "volumeShader.frag");
@@ -1560,7 +1587,9 @@ void LavaVu::reloadShaders()
                              "uBrightness", "uContrast", "uSaturation", 
                              "uPower", "uViewport", "uSamples", "uDensityFactor",
                              "uIsoValue", "uIsoColour", "uIsoSmooth", "uIsoWalls",
-                             "uFilter", "uRange", "uDenMinMax"};
+                             "uFilter", "uRange", "uDenMinMax",
+                             "uBrickMap", "uBricks", "uBrickDims",
+                             "uBlockMin", "uBlockMax", "uTexScale", "uTexOffset"};
   drawstate.prog[lucVolumeType]->loadUniforms(vUniforms, sizeof(vUniforms)/sizeof(char*));
   const char* vAttribs[] = {"aVertexPosition"};
   drawstate.prog[lucVolumeType]->loadAttribs(vAttribs, sizeof(vAttribs)/sizeof(char*));
@@ -2443,6 +2472,10 @@ void LavaVu::drawScene()
   glShadeModel(GL_SMOOTH);
   glPushAttrib(GL_ENABLE_BIT);
 
+  //Load any value data now referenced by properties
+  amodel->loadDeferred();
+  drawstate.reduced = false;
+
   //TODO: replace this hard coded rendering order
   // provide user defined renderer list on model
   amodel->volumes->display();
@@ -2459,6 +2492,13 @@ void LavaVu::drawScene()
     drawBorder();
   drawRulers();
 
+  //Refine reduced level of detail once the view is idle, unless timer already in use
+  if (drawstate.reduced && !drawstate.refinetimer && viewer->getIdleDisplay() == 0)
+  {
+    viewer->idleTimer(TIMER_IDLE);
+    drawstate.refinetimer = true;
+  }
+
   //Restore default state
   glPopAttrib();
   glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -2714,6 +2754,7 @@ void LavaVu::writeSteps(bool images, int start, int end)
 
 void LavaVu::dumpCSV(DrawingObject* obj)
 {
+  amodel->loadDeferred(true, obj);
   for (unsigned int i=0; i < amodel->objects.size(); i++)
   {
     if (!amodel->objects[i]->skip && (!obj || amodel->objects[i] == obj))
@@ -3064,6 +3105,8 @@ std::vector<GeomData*> LavaVu::getAllGeometry(DrawingObject* target)
 {
   std::vector<GeomData*> list;
   if (!amodel || !target) return list;
+  //Values accessed through the returned stores must all be loaded
+  amodel->loadDeferred(true, target);
   for (int type=lucMinType; type<lucMaxType; type++)
   {
     std::vector<GeomData*> geomlist = amodel->geometry[type]->getAllObjects(target);
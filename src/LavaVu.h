@@ -60,6 +60,7 @@ typedef enum
   lucExportJSONP,
   lucExportGLDB,
   lucExportGLDBZ,
+  lucExportLVCACHE,
   lucExportIMAGE
 } lucExportType;
 
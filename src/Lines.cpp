@@ -38,23 +38,31 @@
 Lines::Lines(DrawState& drawstate) : Geometry(drawstate)
 {
   type = lucLineType;
+  partial = true;
   vbo = 0;
+  indexvbo = 0;
   linetotal = 0;
 }
 
 Lines::~Lines()
 {
+  close();
 }
 
 void Lines::close()
 {
-  if (!drawstate.global("gpucache"))
-  {
-    if (vbo)
-      glDeleteBuffers(1, &vbo);
+  if (vbo)
+    glDeleteBuffers(1, &vbo);
+  if (indexvbo)
+    glDeleteBuffers(1, &indexvbo);
+  vbo = indexvbo = 0;
 
-    reload = true;
-  }
+  reload = true;
+}
+
+size_t Lines::gpuMemory()
+{
+  return bufferSize(vbo) + bufferSize(indexvbo);
 }
 
 void Lines::update()
@@ -62,7 +70,12 @@ void Lines::update()
   //Skip update if count hasn't changed
   //To force update, set geometry->reload = true
   if (reload) elements = 0;
-  if (elements > 0 && (linetotal == (unsigned int)elements || total == 0)) return;
+  if (elements > 0 && (linetotal == (unsigned int)elements || total == 0))
+  {
+    //Upload changed object ranges only, full reload if their vertex counts differ
+    if (updateVertices()) return;
+    elements = 0;
+  }
 
   //Count lines
   linetotal = 0;
@@ -90,64 +103,234 @@ void Lines::update()
 
   clock_t t1,t2,tt;
   tt=clock();
-  counts.clear();
-  counts.resize(geom.size());
   for (unsigned int i=0; i<geom.size(); i++)
   {
     t1=tt=clock();
+    unsigned int count = packVertices(i, ptr);
+    assert((int)(ptr-p) + count * datasize <= bsize);
+    ptr += count * datasize;
+    t2 = clock();
+    debug_print("  %.4lf seconds to reload %d vertices\n", (t2-t1)/(double)CLOCKS_PER_SEC, count);
+    t1 = clock();
+    elements += count;
+  }
 
-    //Calibrate colour maps on range for this object
-    geom[i]->colourCalibrate();
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  GL_Error_Check;
 
-    unsigned int hasColours = geom[i]->colourCount();
-    unsigned int colrange = hasColours ? geom[i]->count / hasColours : 1;
-    if (colrange < 1) colrange = 1;
-    debug_print("Using 1 colour per %d vertices (%d : %d)\n", colrange, geom[i]->count, hasColours);
+  //Index buffer, each object has a fixed range so filtering and link changes rewrite only its indices
+  counts.resize(geom.size());
+  capacity.resize(geom.size());
+  linked.resize(geom.size());
+  unsigned int itotal = 0;
+  for (unsigned int i=0; i<geom.size(); i++)
+    itotal += capacity[i] = indexCapacity(i);
+  std::vector<GLuint> indices(itotal);
+  unsigned int offset = 0, voffset = 0;
+  for (unsigned int i=0; i<geom.size(); i++)
+  {
+    counts[i] = packIndices(i, &indices[offset], voffset);
+    linked[i] = (bool)geom[i]->draw->properties["link"];
+    offset += capacity[i];
+    voffset += geom[i]->count;
+  }
+  reindexed.clear();
 
-    Colour colour;
-    bool fastCol = hasColours == geom[i]->colours.size() && hasColours > 0 && !geom[i]->draw->opacityMap;
-    for (unsigned int v=0; v < geom[i]->count; v++)
+  if (!indexvbo) glGenBuffers(1, &indexvbo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexvbo);
+  if (glIsBuffer(indexvbo))
+  {
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, itotal * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    debug_print("  %d byte IBO created for LINES, holds %d indices\n", itotal * sizeof(GLuint), itotal);
+  }
+  else
+    abort_program("IBO setup failed");
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  GL_Error_Check;
+  uploaded();
+
+  t1 = clock();
+  debug_print("Plotted %d lines in %.4lf seconds\n", linetotal, (t1-tt)/(double)CLOCKS_PER_SEC);
+}
+
+unsigned int Lines::packVertices(unsigned int i, unsigned char* ptr)
+{
+  //Copy all vertices of an object into vbo data, returns count copied
+
+  //Calibrate colour maps on range for this object
+  geom[i]->colourCalibrate();
+
+  unsigned int hasColours = geom[i]->colourCount();
+  unsigned int colrange = hasColours ? geom[i]->count / hasColours : 1;
+  if (colrange < 1) colrange = 1;
+  debug_print("Using 1 colour per %d vertices (%d : %d)\n", colrange, geom[i]->count, hasColours);
+
+  Colour colour;
+  bool fastCol = hasColours == geom[i]->colours.size() && hasColours > 0 && !geom[i]->draw->opacityMap;
+  unsigned int count = 0;
+  for (unsigned int v=0; v < geom[i]->count; v++)
+  {
+    //Have colour values but not enough for per-vertex, spread over range (eg: per segment)
+    unsigned int cidx = v / colrange;
+    if (cidx >= hasColours) cidx = hasColours - 1;
+    //Fast lookup for prepared colour data
+    //TODO: Replace this (see Geometry::colourCalibrate) with colour lookup function ptr
+    if (fastCol)
     {
-      if (!internal && geom[i]->filter(v)) continue;
-
-      //Have colour values but not enough for per-vertex, spread over range (eg: per segment)
-      unsigned int cidx = v / colrange;
-      if (cidx >= hasColours) cidx = hasColours - 1;
-      //Fast lookup for prepared colour data
-      //TODO: Replace this (see Geometry::colourCalibrate) with colour lookup function ptr
-      if (fastCol)
+      colour.value = geom[i]->colours[cidx];
+      colour.a *= geom[i]->draw->opacity;
+    }
+    else
+      geom[i]->getColour(colour, cidx);
+    //if (cidx%100 ==0) printf("COLOUR %d => %d,%d,%d\n", cidx, colour.r, colour.g, colour.b);
+
+    //Write vertex data to vbo
+    //Copies vertex bytes
+    memcpy(ptr, &geom[i]->vertices[v][0], sizeof(float) * 3);
+    ptr += sizeof(float) * 3;
+    //Copies colour bytes
+    memcpy(ptr, &colour, sizeof(Colour));
+    ptr += sizeof(Colour);
+
+    //Count of vertices actually plotted
+    count++;
+  }
+  return count;
+}
+
+unsigned int Lines::indexCapacity(unsigned int i)
+{
+  //Index range reserved for an object, enough for any filtering or link setting
+  //so these can change without moving the ranges of other objects
+  //(internal lines of glyphs are never linked, only their vertex pairs are reserved)
+  unsigned int count = geom[i]->count;
+  unsigned int size = count;
+  if (geom[i]->indices.size() > 0 || !internal || geom[i]->draw->properties["link"])
+    size = count > 0 ? 2 * (count - 1) : 0;
+  if (geom[i]->indices.size() > size)
+    size = geom[i]->indices.size();
+  return size;
+}
+
+unsigned int Lines::packIndices(unsigned int i, GLuint* ptr, unsigned int offset)
+{
+  //Write segment index pairs of an object with vertices starting at offset, returns count written
+  //Connectivity is from provided index data, otherwise consecutive vertex pairs or a linked polyline,
+  //segments with a filtered vertex are skipped
+  unsigned int count = geom[i]->count;
+  bool filter = !internal;
+  unsigned int n = 0;
+  if (geom[i]->indices.size() > 0)
+  {
+    for (unsigned int j=0; j+1 < geom[i]->indices.size(); j += 2)
+    {
+      GLuint a = geom[i]->indices[j];
+      GLuint b = geom[i]->indices[j+1];
+      if (a >= count || b >= count) continue;
+      if (filter && (geom[i]->filter(a) || geom[i]->filter(b))) continue;
+      ptr[n++] = offset + a;
+      ptr[n++] = offset + b;
+    }
+  }
+  else if (geom[i]->draw->properties["link"])
+  {
+    //Join each unfiltered vertex to the previous one
+    int last = -1;
+    for (unsigned int v=0; v < count; v++)
+    {
+      if (filter && geom[i]->filter(v)) continue;
+      if (last >= 0)
       {
-        colour.value = geom[i]->colours[cidx];
-        colour.a *= geom[i]->draw->opacity;
+        ptr[n++] = offset + last;
+        ptr[n++] = offset + v;
       }
-      else
-        geom[i]->getColour(colour, cidx);
-      //if (cidx%100 ==0) printf("COLOUR %d => %d,%d,%d\n", cidx, colour.r, colour.g, colour.b);
-
-      //Write vertex data to vbo
-      assert((int)(ptr-p) < bsize);
-      //Copies vertex bytes
-      memcpy(ptr, &geom[i]->vertices[v][0], sizeof(float) * 3);
-      ptr += sizeof(float) * 3;
-      //Copies colour bytes
-      memcpy(ptr, &colour, sizeof(Colour));
-      ptr += sizeof(Colour);
-
-      //Count of vertices actually plotted
-      counts[i]++;
+      last = v;
     }
-    t2 = clock();
-    debug_print("  %.4lf seconds to reload %d vertices\n", (t2-t1)/(double)CLOCKS_PER_SEC, counts[i]);
-    t1 = clock();
-    elements += counts[i];
   }
+  else
+  {
+    for (unsigned int v=0; v+1 < count; v += 2)
+    {
+      if (filter && (geom[i]->filter(v) || geom[i]->filter(v+1))) continue;
+      ptr[n++] = offset + v;
+      ptr[n++] = offset + v + 1;
+    }
+  }
+  assert(n <= capacity[i]);
+  return n;
+}
 
-  glUnmapBuffer(GL_ARRAY_BUFFER);
+void Lines::reindex(DrawingObject* draw)
+{
+  //Flag the indices of an object for upload without its vertices
+  reindexed.push_back(draw);
+}
+
+bool Lines::updateVertices()
+{
+  //Upload vbo ranges of changed objects only, returns false if object
+  //vertex counts have changed and a full reload is required
+  //Objects with changed link setting or flagged by reindex() upload their indices only
+  std::vector<unsigned int> objects;
+  if (!vbo || !indexvbo || counts.size() != geom.size() || !dirtyObjects(objects)) return false;
+  std::vector<unsigned int> indexed;
+  for (unsigned int i = 0; i < geom.size(); i++)
+  {
+    bool relink = linked[i] != (bool)geom[i]->draw->properties["link"];
+    if (geom[i]->dirty || relink || std::find(reindexed.begin(), reindexed.end(), geom[i]->draw) != reindexed.end())
+      indexed.push_back(i);
+  }
+  reindexed.clear();
+  if (indexed.size() == 0) return true;
+
+  int datasize = sizeof(float) * 3 + sizeof(Colour);   //Vertex(3), and 32-bit colour
+  std::vector<unsigned int> offsets(geom.size());
+  std::vector<unsigned int> ioffsets(geom.size());
+  for (unsigned int i = 1; i < geom.size(); i++)
+  {
+    offsets[i] = offsets[i-1] + geom[i-1]->count;
+    ioffsets[i] = ioffsets[i-1] + capacity[i-1];
+  }
+
+  //Pack each object into its own staging buffer, in parallel
+  std::vector<std::vector<unsigned char> > staging(objects.size());
+  parallel_for(objects.size(), [&](unsigned int o)
+  {
+    staging[o].resize(geom[objects[o]]->count * datasize);
+    packVertices(objects[o], staging[o].data());
+  }, drawstate.global("threads"));
+
+  //Indices after vertices as filters are cached when packed, full reload if range too small
+  std::vector<std::vector<GLuint> > istaging(indexed.size());
+  for (unsigned int o = 0; o < indexed.size(); o++)
+  {
+    unsigned int i = indexed[o];
+    if (indexCapacity(i) > capacity[i]) return false;
+    istaging[o].resize(capacity[i]);
+    counts[i] = packIndices(i, istaging[o].data(), offsets[i]);
+    linked[i] = (bool)geom[i]->draw->properties["link"];
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  for (unsigned int o = 0; o < objects.size(); o++)
+  {
+    unsigned int i = objects[o];
+    glBufferSubData(GL_ARRAY_BUFFER, offsets[i] * datasize, geom[i]->count * datasize, staging[o].data());
+    geom[i]->dirty = false;
+  }
   glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexvbo);
+  for (unsigned int o = 0; o < indexed.size(); o++)
+  {
+    unsigned int i = indexed[o];
+    if (counts[i] > 0)
+      glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, ioffsets[i] * sizeof(GLuint), counts[i] * sizeof(GLuint), istaging[o].data());
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   GL_Error_Check;
-
-  t1 = clock();
-  debug_print("Plotted %d lines in %.4lf seconds\n", linetotal, (t1-tt)/(double)CLOCKS_PER_SEC);
+  debug_print("Updated lines of %d objects, indices of %d\n", objects.size(), indexed.size());
+  return true;
 }
 
 void Lines::draw()
@@ -157,10 +340,11 @@ void Lines::draw()
   clock_t t0 = clock();
   double time;
   int stride = 3 * sizeof(float) + sizeof(Colour);   //3+3+2 vertices, normals, texCoord + 32-bit colour
-  int offset = 0;
-  if (geom.size() > 0 && elements > 0 && glIsBuffer(vbo))
+  unsigned int offset = 0, drawn = 0;
+  if (geom.size() > 0 && elements > 0 && glIsBuffer(vbo) && glIsBuffer(indexvbo) && counts.size() == geom.size())
   {
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexvbo);
     glVertexPointer(3, GL_FLOAT, stride, (GLvoid*)0); // Load vertex x,y,z only
     glColorPointer(4, GL_UNSIGNED_BYTE, stride, (GLvoid*)(3*sizeof(float)));   // Load rgba, offset 3 float
     glEnableClientState(GL_VERTEX_ARRAY);
@@ -175,7 +359,7 @@ void Lines::draw()
     for (unsigned int i=0; i<geom.size(); i++)
     {
       Properties& props = geom[i]->draw->properties;
-      if (drawable(i))
+      if (drawable(i) && counts[i] > 0)
       {
         //Set draw state
         setState(i, drawstate.prog[lucLineType]);
@@ -188,19 +372,18 @@ void Lines::draw()
         if (lineWidth <= 0) lineWidth = scaling;
         glLineWidth(lineWidth);
 
-        if (props["link"])
-          glDrawArrays(GL_LINE_STRIP, offset, counts[i]);
-        else
-          glDrawArrays(GL_LINES, offset, counts[i]);
+        glDrawElements(GL_LINES, counts[i], GL_UNSIGNED_INT, (GLvoid*)(offset * sizeof(GLuint)));
+        drawn += counts[i];
       }
 
-      offset += counts[i];
+      offset += capacity[i];
     }
 
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_COLOR_ARRAY);
   }
   glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   GL_Error_Check;
 
   //Restore state
@@ -209,7 +392,7 @@ void Lines::draw()
 
   time = ((clock()-t0)/(double)CLOCKS_PER_SEC);
   if (time > 0.05)
-    debug_print("  %.4lf seconds to draw %d lines\n", time, offset);
+    debug_print("  %.4lf seconds to draw %d lines\n", time, drawn / 2);
   GL_Error_Check;
 }
 
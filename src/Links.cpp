@@ -40,6 +40,120 @@ Links::Links(DrawState& drawstate, bool all2Dflag) : Glyphs(drawstate)
   type = lucLineType;
   all2d = all2Dflag;
   any3d = false;
+  //Objects flagged by redrawObject() update their line indices and colours only
+  partial = true;
+}
+
+bool Links::flat(unsigned int i)
+{
+  //Drawn as lines, otherwise 3d tubes
+  Properties& props = geom[i]->draw->properties;
+  return all2d || (props.getBool("flat", true) && !props["tubes"]);
+}
+
+unsigned int Links::linkIndices(unsigned int i, std::vector<GLuint>& indices)
+{
+  //Segment index pairs of unfiltered vertices, polyline if linked, returns segment count
+  Properties& props = geom[i]->draw->properties;
+  float limit = props["limit"];
+  bool linked = props["link"];
+  unsigned int count = geom[i]->count;
+  indices.clear();
+  int last = -1;
+  for (unsigned int v=0; v < count; v++)
+  {
+    if (geom[i]->filter(v)) continue;
+
+    int from = last;
+    if (linked)
+      last = v;
+    else if (v%2 == 0)
+    {
+      //Segment start vertex, joined to the next if unfiltered
+      last = v;
+      continue;
+    }
+    else
+      last = -1;
+    if (from < 0 || (!linked && from != (int)v-1)) continue;
+
+    //Check length limit if applied (used for periodic boundary conditions)
+    if (limit > 0.f)
+    {
+      Vec3d line;
+      vectorSubtract(line, geom[i]->vertices[v], geom[i]->vertices[from]);
+      if (line.magnitude() > limit) continue;
+    }
+
+    indices.push_back(from);
+    indices.push_back(v);
+  }
+  return indices.size() / 2;
+}
+
+void Links::linkColours(unsigned int i, std::vector<unsigned int>& colours)
+{
+  //Colour of every vertex of an object
+  unsigned int hasColours = geom[i]->colourCount();
+  unsigned int colrange = hasColours ? geom[i]->count / hasColours : 1;
+  if (colrange < 1) colrange = 1;
+  debug_print("Using 1 colour per %d vertices (%d : %d)\n", colrange, geom[i]->count, hasColours);
+
+  Colour colour;
+  colours.resize(geom[i]->count);
+  for (unsigned int v=0; v < geom[i]->count; v++)
+  {
+    //Have colour values but not enough for per-vertex, spread over range (eg: per segment)
+    unsigned int cidx = v / colrange;
+    if (cidx >= hasColours) cidx = hasColours - 1;
+    geom[i]->getColour(colour, cidx);
+    colours[v] = colour.value;
+  }
+}
+
+bool Links::updateObjects()
+{
+  //Update the line indices and colours of objects flagged by redrawObject() in place,
+  //returns false if a full update is required (none flagged, tubes or vertex counts changed)
+  std::vector<unsigned int> objects;
+  for (unsigned int i=0; i<geom.size(); i++)
+  {
+    if (!geom[i]->dirty) continue;
+    GeomData* out = lines->getObjectStore(geom[i]->draw);
+    if (!flat(i) || !out || out->count != geom[i]->count || out->indices.size() == 0) return false;
+    objects.push_back(i);
+  }
+  if (objects.size() == 0) return false;
+
+  std::vector<std::vector<GLuint> > indices(objects.size());
+  std::vector<std::vector<unsigned int> > colours(objects.size());
+  for (unsigned int o=0; o<objects.size(); o++)
+  {
+    unsigned int i = objects[o];
+    //Calibrate colour maps and filters on range for this object
+    geom[i]->colourCalibrate();
+    if (!linkIndices(i, indices[o])) return false;
+    linkColours(i, colours[o]);
+  }
+
+  for (unsigned int o=0; o<objects.size(); o++)
+  {
+    unsigned int i = objects[o];
+    GeomData* out = lines->getObjectStore(geom[i]->draw);
+    elements += (int)(indices[o].size() - out->indices.size()) / 2;
+    out->indices.clear();
+    out->indices.adopt(indices[o]);
+    lines->reindex(geom[i]->draw);
+    //Vertex range only uploaded again if colours changed
+    if (memcmp(out->colours.ref(), colours[o].data(), colours[o].size() * sizeof(unsigned int)) != 0)
+    {
+      memcpy(out->colours.ref(), colours[o].data(), colours[o].size() * sizeof(unsigned int));
+      out->dirty = true;
+    }
+    geom[i]->dirty = false;
+  }
+  debug_print("Updated lines of %d objects\n", objects.size());
+  return true;
 }
 
 void Links::update()
@@ -50,6 +164,13 @@ void Links::update()
   //To force update, set geometry->reload = true
   //if (elements > 0 && (linetotal == (unsigned int)elements || total == 0)) return;
 
+  //Only indices and colours of flagged flat line objects changed?
+  if (!reload && updateObjects())
+  {
+    lines->update();
+    return;
+  }
+
   tris->clear();
   lines->clear();
 
@@ -67,58 +188,23 @@ void Links::update()
     float limit = props["limit"];
     bool linked = props["link"];
 
-    if (all2d || (props.getBool("flat", true) && !props["tubes"]))
+    if (flat(i))
     {
-      unsigned int hasColours = geom[i]->colourCount();
-      unsigned int colrange = hasColours ? geom[i]->count / hasColours : 1;
-      if (colrange < 1) colrange = 1;
-      debug_print("Using 1 colour per %d vertices (%d : %d)\n", colrange, geom[i]->count, hasColours);
-
-      //Create a new segment
-      if (linked) lines->add(geom[i]->draw);
-
-      Colour colour;
-      int count = 0;
-      for (unsigned int v=0; v < geom[i]->count; v++)
+      //All vertices copied once, filtering and limits applied by segment indices
+      std::vector<GLuint> indices;
+      unsigned int count = linkIndices(i, indices);
+      lines->add(geom[i]->draw);
+      if (count > 0)
       {
-        if (geom[i]->filter(v)) continue;
-
-        //Check length limit if applied (used for periodic boundary conditions)
-        //NOTE: will not work with linked lines, require separated segments
-        if (limit > 0.f && v%2 == 0 && v < geom[i]->count-1)
-        {
-          Vec3d line;
-          vectorSubtract(line, geom[i]->vertices[v+1], geom[i]->vertices[v]);
-          if (line.magnitude() > limit) 
-          {
-            if (linked)
-            {
-              //End the linked segment and start a new one
-              lines->add(geom[i]->draw);
-            }
-            else
-            {
-              //Skip next segment (two vertices)
-              v++;
-              continue;
-            }
-          }
-        }
-
-        //Have colour values but not enough for per-vertex, spread over range (eg: per segment)
-        unsigned int cidx = v / colrange;
-        if (cidx >= hasColours) cidx = hasColours - 1;
-        geom[i]->getColour(colour, cidx);
-
-        lines->read(geom[i]->draw, 1, lucVertexData, &geom[i]->vertices[v][0]);
-        lines->read(geom[i]->draw, 1, lucRGBAData, &colour.value);
-
-        //Count of vertices actually plotted
-        count++;
+        std::vector<unsigned int> colours;
+        linkColours(i, colours);
+        lines->read(geom[i]->draw, geom[i]->count, lucVertexData, geom[i]->vertices.ref());
+        lines->read(geom[i]->draw, geom[i]->count, lucRGBAData, colours.data());
+        lines->read(geom[i]->draw, indices.size(), lucIndexData, indices.data());
       }
-      elements += linked ? count - 1 : count * 0.5;
+      elements += count;
       t2 = clock();
-      debug_print("  %.4lf seconds to reload %d vertices\n", (t2-t1)/(double)CLOCKS_PER_SEC, count);
+      debug_print("  %.4lf seconds to reload %d vertices\n", (t2-t1)/(double)CLOCKS_PER_SEC, geom[i]->count);
       t1 = clock();
     }
     else
@@ -165,6 +251,9 @@ void Links::update()
     }
   }
 
+  for (unsigned int i=0; i<geom.size(); i++)
+    geom[i]->dirty = false;
+
   t1 = clock();
   debug_print("Plotted %d lines in %.4lf seconds\n", elements, (t1-tt)/(double)CLOCKS_PER_SEC);
 
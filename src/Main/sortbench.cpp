@@ -0,0 +1,114 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+** Copyright (c) 2016, Monash University
+** All rights reserved.
+** Redistribution and use in source and binary forms, with or without modification,
+** are permitted provided that the following conditions are met:
+**
+**       * Redistributions of source code must retain the above copyright notice,
+**          this list of conditions and the following disclaimer.
+**       * Redistributions in binary form must reproduce the above copyright
+**         notice, this list of conditions and the following disclaimer in the
+**         documentation and/or other materials provided with the distribution.
+**       * Neither the name of the Monash University nor the names of its contributors
+**         may be used to endorse or promote products derived from this software
+**         without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+** "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+** THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+** PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+** BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+** HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+** LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+** OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**
+**
+** Contact:
+*%  Owen Kaluza - Owen.Kaluza(at)monash.edu
+*%
+*% Development Team :
+*%  http://www.underworldproject.org/aboutus.html
+**
+**~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+//Depth sort benchmark, compares the DepthSort engine used by Points/TriSurfaces
+//with the previous single threaded path (PIndex array with vertex pointers, 2 byte radix_sort)
+//Usage: sortbench [points=10000000] [threads=0] [repeats=5]
+#include "../Geometry.h"
+#include <chrono>
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned int count = argc > 1 ? atoi(argv[1]) : 10000000;
+  int threads = argc > 2 ? atoi(argv[2]) : 0;
+  int repeats = argc > 3 ? atoi(argv[3]) : 5;
+
+  //Random points in a unit cube
+  std::vector<float> vertices(count * 3);
+  uint32_t SEED = 123456789;
+  for (unsigned int i=0; i<count*3; i++)
+    vertices[i] = SHR3(SEED) / (float)UINT_MAX;
+
+  PIndex* pidx = new PIndex[count];
+  PIndex* swap = new PIndex[count];
+  DepthSort sorter;
+  sorter.resize(count);
+  for (unsigned int i=0; i<count; i++)
+  {
+    pidx[i].index = i;
+    pidx[i].vertex = &vertices[i*3];
+    pidx[i].distance = 0;
+    sorter.set(i, &vertices[i*3]);
+  }
+
+  double told = 0, tnew = 0;
+  unsigned int mismatch = 0;
+  for (int r=0; r<repeats; r++)
+  {
+    //Rotate about y axis then translate away from the eye
+    float angle = r * 0.7;
+    float M[16] = {cosf(angle), 0, -sinf(angle), 0,  0, 1, 0, 0,  sinf(angle), 0, cosf(angle), 0,  0, 0, -3, 1};
+    float mindist = 3 - sqrt(3.0), maxdist = 3 + sqrt(3.0);
+
+    //Previous path
+    auto start = std::chrono::steady_clock::now();
+    float multiplier = (float)USHRT_MAX / (maxdist - mindist);
+    for (unsigned int i = 0; i < count; i++)
+    {
+      float fdistance = eyeDistance(M, pidx[i].vertex);
+      pidx[i].distance = (unsigned short)(multiplier * (fdistance - mindist));
+    }
+    radix_sort<PIndex>(pidx, swap, count, 2);
+    told += seconds(start);
+
+    //Sort engine
+    start = std::chrono::steady_clock::now();
+    sorter.distances(M, mindist, maxdist, threads);
+    sorter.sort(threads);
+    tnew += seconds(start);
+
+    //Both are stable sorts of the same quantised keys from the same initial order
+    //only on the first pass, after that the previous path starts from its last sorted order
+    for (unsigned int i = 1; i < count; i++)
+    {
+      if (sorter.keys[i].key < sorter.keys[i-1].key) mismatch++;
+      if (r == 0 && pidx[i].index != sorter.keys[i].index) mismatch++;
+    }
+  }
+
+  printf("%u points, %d repeats, threads %d\n", count, repeats, threads);
+  printf("  previous:  %.4f seconds per sort (%lu bytes)\n", told / repeats, (unsigned long)(2 * sizeof(PIndex) * count));
+  printf("  DepthSort: %.4f seconds per sort (%lu bytes)\n", tnew / repeats, sorter.bytes());
+  printf("  speedup %.2fx, %u mismatches\n", told / tnew, mismatch);
+  delete[] pidx;
+  delete[] swap;
+  return mismatch > 0;
+}
@@ -36,21 +36,47 @@
 //Model class
 #include "Model.h"
 
-Database::Database() : readonly(true), silent(true), attached(NULL), db(NULL), memory(false)
+Database::Database() : readonly(true), silent(true), attached(NULL), db(NULL), memory(false), insertgeom(NULL)
 {
   prefix[0] = '\0';
 }
 
-Database::Database(const FilePath& fn) : readonly(true), silent(true), attached(NULL), db(NULL), file(fn), memory(false)
+Database::Database(const FilePath& fn) : readonly(true), silent(true), attached(NULL), db(NULL), file(fn), memory(false), insertgeom(NULL)
 {
   prefix[0] = '\0';
 }
 
 Database::~Database()
 {
+  if (insertgeom) sqlite3_finalize(insertgeom);
   if (db) sqlite3_close(db);
 }
 
+Database::Database(Database&& other) : db(NULL), insertgeom(NULL)
+{
+  *this = std::move(other);
+}
+
+Database& Database::operator=(Database&& other)
+{
+  if (this == &other) return *this;
+  //Release the current connection before taking over the other
+  if (insertgeom) sqlite3_finalize(insertgeom);
+  if (db) sqlite3_close(db);
+  readonly = other.readonly;
+  silent = other.silent;
+  attached = other.attached;
+  strcpy(prefix, other.prefix);
+  db = other.db;
+  file = other.file;
+  memory = other.memory;
+  insertgeom = other.insertgeom;
+  other.db = NULL;
+  other.insertgeom = NULL;
+  other.attached = NULL;
+  return *this;
+}
+
 bool Database::open(bool write)
 {
   //Single file database
@@ -92,6 +118,8 @@ bool Database::open(bool write)
 void Database::reopen(bool write)
 {
   if (!readonly || !db) return;
+  if (insertgeom) sqlite3_finalize(insertgeom);
+  insertgeom = NULL;
   if (db) sqlite3_close(db);
   open(write);
 
@@ -180,7 +208,281 @@ bool Database::issue(const char* fmt, ...)
   return true;
 }
 
-Model::Model(DrawState& drawstate) : now(-1), drawstate(drawstate), figure(-1)
+sqlite3_stmt* Database::selectGeometry(int obj_id, int time_start, int time_stop, int& datacol, const std::string& where)
+{
+  std::stringstream ss;
+  std::string op = "WHERE";
+
+  //Setup filters, object...
+  if (obj_id > 0)
+  {
+    ss << op << " object_id=" << obj_id;
+    op = " AND";
+  }
+
+  //...timestep...(if ts db attached, assume all geometry is at current step)
+  if (time_start >= 0 && time_stop >= 0 && !attached)
+  {
+    ss << op << " timestep BETWEEN " << time_start << " AND " << time_stop;
+    op = " AND";
+  }
+
+  //...and any additional condition
+  if (where.length() > 0)
+    ss << op << " " << where;
+
+  std::string fs = ss.str();
+  const char* filter = fs.c_str();
+
+  datacol = 22;
+  //object (id, name, colourmap_id, colour, opacity, wireframe, cullface, scaling, lineWidth, arrowHead, flat, steps, time)
+  //geometry (id, object_id, timestep, rank, idx, type, data_type, size, count, width, minimum, maximum, dim_factor, units, labels,
+  //minX, minY, minZ, maxX, maxY, maxZ, codec, data)
+  sqlite3_stmt* statement = select("SELECT id,object_id,timestep,rank,idx,type,data_type,size,count,width,minimum,maximum,dim_factor,units,labels,minX,minY,minZ,maxX,maxY,maxZ,codec,data FROM %sgeometry %s ORDER BY timestep,object_id", prefix, filter);
+
+  //Database without codec compatibility
+  if (statement == NULL)
+  {
+    statement = select("SELECT id,object_id,timestep,rank,idx,type,data_type,size,count,width,minimum,maximum,dim_factor,units,labels,minX,minY,minZ,maxX,maxY,maxZ,data FROM %sgeometry %s ORDER BY timestep,object_id", prefix, filter);
+    datacol = 21;
+  }
+
+  //Old database compatibility
+  if (statement == NULL)
+  {
+    //object (id, name, colourmap_id, colour, opacity, wireframe, cullface, scaling, lineWidth, arrowHead, flat, steps, time)
+    //geometry (id, object_id, timestep, rank, idx, type, data_type, size, count, width, minimum, maximum, dim_factor, units, data)
+    statement = select("SELECT id,object_id,timestep,rank,idx,type,data_type,size,count,width,minimum,maximum,dim_factor,units,labels,data FROM %sgeometry %s ORDER BY timestep,object_id", prefix, filter);
+    datacol = 15;
+
+    //Fix
+#ifdef ALTER_DB
+    reopen(true);  //Open writable
+    issue("ALTER TABLE %sgeometry ADD COLUMN minX REAL; ALTER TABLE %sgeometry ADD COLUMN minY REAL; ALTER TABLE %sgeometry ADD COLUMN minZ REAL; "
+          "ALTER TABLE %sgeometry ADD COLUMN maxX REAL; ALTER TABLE %sgeometry ADD COLUMN maxY REAL; ALTER TABLE %sgeometry ADD COLUMN maxZ REAL; ",
+          prefix, prefix, prefix, prefix, prefix, prefix, prefix);
+#endif
+  }
+
+  //Very old database compatibility
+  if (statement == NULL)
+  {
+    statement = select("SELECT id,object_id,timestep,rank,idx,type,data_type,size,count,width,minimum,maximum,dim_factor,units,data FROM %sgeometry %s ORDER BY timestep,object_id", prefix, filter);
+    datacol = 14;
+  }
+
+  return statement;
+}
+
+sqlite3_stmt* Database::insertGeometry()
+{
+  //Prepared once and reused for all geometry records written
+  if (insertgeom)
+  {
+    sqlite3_reset(insertgeom);
+    sqlite3_clear_bindings(insertgeom);
+    return insertgeom;
+  }
+
+  //Add codec column to geometry tables created before it existed
+  sqlite3_stmt* check = select("SELECT codec FROM geometry LIMIT 1");
+  if (check)
+    sqlite3_finalize(check);
+  else
+    issue("ALTER TABLE geometry ADD COLUMN codec INTEGER");
+
+  const char* SQL = "insert into geometry (object_id, timestep, rank, idx, type, data_type, size, count, width, minimum, maximum, dim_factor, units, minX, minY, minZ, maxX, maxY, maxZ, labels, codec, data) values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+  if (sqlite3_prepare_v2(db, SQL, -1, &insertgeom, NULL) != SQLITE_OK)
+    abort_program("SQL prepare error: (%s) %s\n", SQL, sqlite3_errmsg(db));
+  return insertgeom;
+}
+
+void GeomRecord::read(sqlite3_stmt* statement, int datacol)
+{
+  object_id = sqlite3_column_int(statement, 1);
+  timestep = sqlite3_column_int(statement, 2);
+  height = sqlite3_column_int(statement, 3);  //unused - was rank, now height
+  depth = sqlite3_column_int(statement, 4); //unused - was idx, now depth
+  type = (lucGeometryType)sqlite3_column_int(statement, 5);
+  data_type = (lucGeometryDataType)sqlite3_column_int(statement, 6);
+  int size = sqlite3_column_int(statement, 7);
+  count = sqlite3_column_int(statement, 8);
+  items = count / size;
+  width = sqlite3_column_int(statement, 9);
+  if (height == 0) height = width > 0 ? items / width : 0;
+  //TODO: these should be used for value data if set!
+  //float minimum = (float)sqlite3_column_double(statement, 10);
+  //float maximum = (float)sqlite3_column_double(statement, 11);
+  //Units field repurposed for data label
+  const char *data_label = (const char*)sqlite3_column_text(statement, 13);
+  label = data_label ? data_label : "";
+  id = sqlite3_column_int(statement, 0);
+  const char *vlabels = datacol < 15 ? "" : (const char*)sqlite3_column_text(statement, 14);
+  labels = vlabels ? vlabels : "";
+
+  if (type == lucTracerType)
+  {
+    height = 0;
+    //Default particle count:
+    if (width == 0) width = items;
+  }
+
+  //Where min/max vertex provided, load
+  bounds = false;
+  if (datacol > 15 && data_type == lucVertexData && sqlite3_column_type(statement, 15) != SQLITE_NULL)
+  {
+    for (int i=0; i<3; i++)
+    {
+      min[i] = (float)sqlite3_column_double(statement, 15+i);
+      max[i] = (float)sqlite3_column_double(statement, 18+i);
+    }
+    bounds = (min[0] != max[0] || min[1] != max[1] || min[2] != max[2]);
+  }
+
+  //Compression codec, if stored
+  codec = lucCodecAuto;
+  if (datacol > 21 && sqlite3_column_type(statement, 21) != SQLITE_NULL)
+  {
+    int c = sqlite3_column_int(statement, 21);
+    if (c < lucCodecNone || c >= lucMaxCodec)
+      abort_program("Unknown geometry data codec %d\n", c);
+    codec = (lucBlobCodec)c;
+  }
+
+  //printf("OBJ %d STEP %d TYPE %d DTYPE %d DIMS (%d x %d x %d) COUNT %d ITEMS %d LABELS %s\n",
+  //       object_id, timestep, type, data_type, width, height, depth, count, items, labels.c_str());
+}
+
+DataContainer* GeomRecord::newBlock()
+{
+  //Create a store of the record's data type holding count elements
+  DataContainer* store;
+  if (data_type == lucIndexData || data_type == lucRGBAData)
+    store = new UIntValues();
+  else if (data_type == lucLuminanceData || data_type == lucRGBData)
+    store = new UCharValues();
+  else
+    store = new FloatValues();
+  store->read(count, NULL);
+  return store;
+}
+
+//Byte shuffle filter, groups the bytes of each element by significance
+//(ie: all float exponent bytes together) which compresses much better
+static void shuffleBytes(const unsigned char* src, unsigned char* dst, unsigned long bytes, unsigned int width)
+{
+  unsigned long count = bytes / width;
+  for (unsigned int b=0; b<width; b++)
+    for (unsigned long i=0; i<count; i++)
+      dst[b*count + i] = src[i*width + b];
+  //Trailing partial element copied as is
+  memcpy(dst + count*width, src + count*width, bytes - count*width);
+}
+
+static void unshuffleBytes(const unsigned char* src, unsigned char* dst, unsigned long bytes, unsigned int width)
+{
+  unsigned long count = bytes / width;
+  for (unsigned int b=0; b<width; b++)
+    for (unsigned long i=0; i<count; i++)
+      dst[i*width + b] = src[b*count + i];
+  memcpy(dst + count*width, src + count*width, bytes - count*width);
+}
+
+std::string GeomRecord::valueLabel()
+{
+  //Label of value data, empty if not a value type
+  switch (data_type)
+  {
+    case lucColourValueData:
+    case lucOpacityValueData:
+    case lucRedValueData:
+    case lucGreenValueData:
+    case lucBlueValueData:
+    case lucXWidthData:
+    case lucYHeightData:
+    case lucZLengthData:
+    case lucSizeData:
+    case lucMaxDataType:
+      //Convert legacy value types to use data labels
+      return label.length() > 0 ? label //Use provided label from units field
+                                : GeomData::datalabels[data_type]; //Use default/legacy label
+    default:
+      return "";
+  }
+}
+
+bool GeomRecord::compressed(unsigned long bytes)
+{
+  //Without a stored codec, data is compressed if blob is not the full data size
+  if (codec == lucCodecAuto)
+    return bytes != (unsigned long)(count * GeomData::byteSize(data_type));
+  return codec != lucCodecNone;
+}
+
+void GeomRecord::decompress(const void* src, unsigned long src_len, unsigned char* dst)
+{
+  //Inflate compressed blob into dst, must be allocated to hold count items
+  unsigned long dst_len = (unsigned long)(count * GeomData::byteSize(data_type));
+  unsigned long uncomp_len = dst_len;
+  std::vector<unsigned char> shuffled;
+  unsigned char* out = dst;
+  if (codec == lucCodecShuffleDeflate)
+  {
+    shuffled.resize(dst_len);
+    out = shuffled.data();
+  }
+#ifdef USE_ZLIB
+  int res = uncompress(out, &uncomp_len, (const unsigned char *)src, src_len);
+  if (res != Z_OK || dst_len != uncomp_len)
+#else
+  int res = tinfl_decompress_mem_to_mem(out, uncomp_len, (const unsigned char *)src, src_len, TINFL_FLAG_PARSE_ZLIB_HEADER);
+  if (!res)
+#endif
+  {
+    abort_program("uncompress() failed! error code %d\n", res);
+    //abort_program("uncompress() failed! error code %d expected size %d actual size %d\n", res, dst_len, uncomp_len);
+  }
+
+  if (codec == lucCodecShuffleDeflate)
+    unshuffleBytes(out, dst, dst_len, GeomData::byteSize(data_type));
+}
+
+void GeomBlock::pack(lucBlobCodec with)
+{
+  //Compress block data with given codec, left uncompressed if not > 1kb or no smaller
+  codec = lucCodecNone;
+  compressed.clear();
+  unsigned long src_len = block->bytes();
+  if (with == lucCodecNone || src_len <= 1000) return;
+
+  const unsigned char* src = (const unsigned char*)block->ref(0);
+  std::vector<unsigned char> shuffled;
+  unsigned int width = GeomData::byteSize(dtype);
+  //Shuffle has no effect on single byte elements
+  if (with == lucCodecShuffleDeflate && width == 1) with = lucCodecDeflate;
+  if (with == lucCodecShuffleDeflate)
+  {
+    shuffled.resize(src_len);
+    shuffleBytes(src, shuffled.data(), src_len, width);
+    src = shuffled.data();
+  }
+
+  unsigned long cmp_len = compressBound(src_len);
+  compressed.resize(cmp_len);
+  if (compress(compressed.data(), &cmp_len, src, src_len) != Z_OK)
+    abort_program("Compress database buffer failed!\n");
+  if (cmp_len >= src_len)
+  {
+    compressed.clear();
+    return;
+  }
+  compressed.resize(cmp_len);
+  codec = with;
+}
+
+Model::Model(DrawState& drawstate) : now(-1), drawstate(drawstate), figure(-1), reloads(0), deferred(false),
+                                     cacheHits(0), cacheMisses(0), cacheEvictions(0), gpuEvictions(0),
+                                     prefetchHits(0), prefetchWaits(0), prefetchMisses(0)
 {
   //Create new geometry containers
   init();
@@ -355,6 +657,10 @@ DrawingObject* Model::findObject(unsigned int id)
 
 void Model::close()
 {
+  //Cached steps can't keep graphics memory beyond the context
+  while (gpucached.size())
+    releaseStep(gpucached.front().idx);
+
   for (unsigned int i=0; i < geometry.size(); i++)
     delete geometry[i];
   geometry.clear();
@@ -401,6 +707,7 @@ void Model::reload(DrawingObject* obj)
   //Full data reload on selected object only
   for (unsigned int i=0; i < geometry.size(); i++)
     geometry[i]->redrawObject(obj);
+  reloads++;
 
   for (unsigned int i = 0; i < colourMaps.size(); i++)
     colourMaps[i]->calibrated = false;
@@ -409,6 +716,7 @@ void Model::reload(DrawingObject* obj)
 void Model::redraw(bool reload)
 {
   //Flag redraw on all objects...
+  if (reload) reloads++;
   for (unsigned int i=0; i < geometry.size(); i++)
   {
     if (reload) 
@@ -727,6 +1035,9 @@ void Model::loadLinks(DrawingObject* obj)
 
 void Model::clearTimeSteps()
 {
+  //Prefetched and cached steps are indexed by timestep
+  clearPrefetch();
+  cached.clear();
   for (unsigned int idx=0; idx < timesteps.size(); idx++)
   {
     //Clear the store first to avoid deleting active (double free)
@@ -994,50 +1305,63 @@ void Model::cacheStep()
 {
   //Don't cache if we already loaded from cache or out of range!
   if (!useCache() || drawstate.now < 0 || (int)timesteps.size() <= drawstate.now) return;
-  if (timesteps[drawstate.now]->cache.size() > 0) return; //Already cached this step
+  if (timesteps[drawstate.now]->cache.size() > 0)
+  {
+    //Already cached this step, active containers are owned by the cache
+    if (geometry == timesteps[drawstate.now]->cache)
+    {
+      clearStep(drawstate.now);
+      geometry.clear();
+    }
+    return;
+  }
 
   debug_print("~~~ Caching geometry @ %d (step %d : %s), geom memory usage: %.3f mb\n", step(), drawstate.now, database.file.base.c_str(), membytes__/1000000.0f);
 
   //Copy all elements
   if (membytes__ > 0)
   {
-    clearStep();
     timesteps[drawstate.now]->write(geometry);
+    clearStep(drawstate.now);
     debug_print("~~~ Cached step, at: %d\n", step());
     printf(".");
     fflush(stdout);
     //Objects have been moved into cache, clear from active list
     geometry.clear();
+    touchCache(drawstate.now);
   }
   else
     debug_print("~~~ Nothing to cache\n");
 
-  //TODO: fix support for partial caching?
-  /*/Remove if over limit
-  if (cache.size() > GeomCache::size)
-  {
-     GeomCache* cached = cache.front();
-     cache.pop_front();
-     //Clear containers...
-     for (unsigned int i=0; i < cached->store.size(); i++)
-     {
-        cached->store[i]->clear(true);
-        delete cached->store[i];
-     }
-     debug_print("~~~ Deleted oldest cached step (%d)\n", cached->step);
-     delete cached;
-  }*/
+  //Remove least recently used steps if over limit
+  trimCache();
 }
 
 bool Model::restoreStep()
 {
   if (drawstate.now < 0 || !useCache()) return false;
   if (timesteps[drawstate.now]->cache.size() == 0)
+  {
+    cacheMisses++;
     return false; //Nothing cached this step
+  }
 
   //Load the cache and save loaded timestep
   clearStep();
   timesteps[drawstate.now]->read(geometry);
+  cacheHits++;
+  touchCache(drawstate.now);
+
+  //Graphics memory still held? Active containers are no longer counted against gpucachesize
+  //(buffers released by close() are flagged for reload already)
+  bool stale = false;
+  for (auto it = gpucached.begin(); it != gpucached.end(); ++it)
+  {
+    if (it->idx != drawstate.now) continue;
+    stale = (it->reloads != reloads);
+    gpucached.erase(it);
+    break;
+  }
   debug_print("~~~ Cache hit at ts %d (idx %d), loading! %s\n", step(), drawstate.now, database.file.base.c_str());
 
   //Switch geometry containers
@@ -1052,13 +1376,86 @@ bool Model::restoreStep()
   shapes = (Shapes*)geometry[lucShapeType];
 
   debug_print("~~~ Geom memory usage after load: %.3f mb\n", membytes__/1000000.0f);
+  //Retained buffers need a full reload if data was reloaded while cached
+  if (stale)
+  {
+    for (unsigned int i=0; i < geometry.size(); i++)
+      geometry[i]->reload = true;
+  }
+
   //Redraw display
   redraw();
   return true;
 }
 
-void Model::clearStep()
+void Model::touchCache(int idx)
+{
+  //Move step to most recently used position
+  auto it = std::find(cached.begin(), cached.end(), idx);
+  if (it != cached.end()) cached.erase(it);
+  cached.push_back(idx);
+}
+
+void Model::trimCache()
+{
+  //Evict least recently used steps until geometry memory is within the limit
+  float cachesize = drawstate.global("cachesize");
+  if (cachesize <= 0) return;
+  long limit = cachesize * 1000000.0;
+  bool pin = drawstate.global("cachepin");
+  unsigned int i = 0;
+  while (membytes__ > limit && i < cached.size())
+  {
+    int idx = cached[i];
+    //Keep the active step and optionally the first and last steps
+    if (idx == drawstate.now || (pin && (idx == 0 || idx == (int)timesteps.size()-1)))
+    {
+      i++;
+      continue;
+    }
+    evictStep(idx);
+  }
+}
+
+void Model::evictStep(int idx)
 {
+  auto it = std::find(cached.begin(), cached.end(), idx);
+  if (it != cached.end()) cached.erase(it);
+  if (idx < 0 || idx >= (int)timesteps.size()) return;
+  for (auto g = gpucached.begin(); g != gpucached.end(); ++g)
+  {
+    if (g->idx != idx) continue;
+    gpucached.erase(g);
+    break;
+  }
+
+  //Free the cached geometry, including any graphics memory retained by gpucache
+  std::vector<Geometry*>& cache = timesteps[idx]->cache;
+  for (unsigned int i=0; i < cache.size(); i++)
+  {
+    cache[i]->close();
+    delete cache[i];
+  }
+  cache.clear();
+  cacheEvictions++;
+  debug_print("~~~ Evicted cached step %d (idx %d), geom memory usage: %.3f mb\n", timesteps[idx]->step, idx, membytes__/1000000.0f);
+}
+
+void Model::clearStep(int idx)
+{
+  //Containers moving into the cache for step idx keep their graphics memory when gpucache enabled,
+  //least recently used steps are released when over the gpucachesize limit
+  if (idx >= 0 && drawstate.global("gpucache"))
+  {
+    GPUStep gs = {idx, 0, reloads};
+    for (unsigned int i=0; i < geometry.size(); i++)
+      gs.bytes += geometry[i]->gpuMemory();
+    gpucached.push_back(gs);
+    debug_print("~~~ Retained %.3f mb of graphics memory for step %d (idx %d)\n", gs.bytes/1000000.0f, timesteps[idx]->step, idx);
+    trimGPUCache();
+    return;
+  }
+
   //Clear and tell all geometry objects they need to reload data
   for (unsigned int i=0; i < geometry.size(); i++)
   {
@@ -1067,11 +1464,47 @@ void Model::clearStep()
   }
 }
 
+size_t Model::gpuCacheBytes()
+{
+  size_t bytes = 0;
+  for (unsigned int i=0; i < gpucached.size(); i++)
+    bytes += gpucached[i].bytes;
+  return bytes;
+}
+
+void Model::trimGPUCache()
+{
+  //Release graphics memory of least recently used steps until within the limit
+  float gpucachesize = drawstate.global("gpucachesize");
+  if (gpucachesize <= 0) return;
+  size_t limit = gpucachesize * 1000000.0;
+  while (gpucached.size() && gpuCacheBytes() > limit)
+    releaseStep(gpucached.front().idx);
+}
+
+void Model::releaseStep(int idx)
+{
+  //Free graphics memory of a cached step, data stays in the cache to be uploaded again when restored
+  for (auto it = gpucached.begin(); it != gpucached.end(); ++it)
+  {
+    if (it->idx != idx) continue;
+    gpucached.erase(it);
+    break;
+  }
+  if (idx < 0 || idx >= (int)timesteps.size()) return;
+  std::vector<Geometry*>& cache = timesteps[idx]->cache;
+  for (unsigned int i=0; i < cache.size(); i++)
+    cache[i]->close();
+  gpuEvictions++;
+  debug_print("~~~ Released graphics memory of cached step %d (idx %d), retained: %.3f mb\n", timesteps[idx]->step, idx, gpuCacheBytes()/1000000.0f);
+}
+
 void Model::printCache()
 {
-  debug_print("-----------CACHE %d steps\n", timesteps.size());
-  for (unsigned int idx=0; idx < timesteps.size(); idx++)
-    debug_print(" %d: has %d records\n", idx, timesteps[idx]->cache.size());
+  debug_print("-----------CACHE %d steps, %d cached, hits %d misses %d evictions %d\n", timesteps.size(), cached.size(), cacheHits, cacheMisses, cacheEvictions);
+  debug_print("-----------GPU CACHE %d steps, %.3f mb, releases %d\n", gpucached.size(), gpuCacheBytes()/1000000.0f, gpuEvictions);
+  for (unsigned int i=0; i < cached.size(); i++)
+    debug_print(" %d: has %d records\n", cached[i], timesteps[cached[i]]->cache.size());
 }
 
 //Set time step if available, otherwise return false and leave unchanged
@@ -1159,16 +1592,27 @@ int Model::setTimeStep(int stepidx)
       //Detach any attached db file and attach n'th timestep database if available
       database.attach(timesteps[drawstate.now]);
 
-      if (useCache())
-        //Attempt caching all geometry from database at start
-        rows += loadGeometry(0, 0, timesteps[timesteps.size()-1]->step, true);
+      if (restorePrefetch())
+        //Swapped in from background load
+        debug_print("%.4lf seconds to load prefetched geometry\n", (clock()-t1)/(double)CLOCKS_PER_SEC);
+      else if (loadCacheFile())
+        debug_print("%.4lf seconds to load geometry from cache file\n", (clock()-t1)/(double)CLOCKS_PER_SEC);
       else
-        rows += loadGeometry();
+      {
+        if (useCache() && cached.size() == 0)
+          //Attempt caching all geometry from database at start
+          rows += loadGeometry(0, 0, timesteps[timesteps.size()-1]->step, true);
+        else
+          rows += loadGeometry();
 
-      debug_print("%.4lf seconds to load %d geometry records from database\n", (clock()-t1)/(double)CLOCKS_PER_SEC, rows);
+        debug_print("%.4lf seconds to load %d geometry records from database\n", (clock()-t1)/(double)CLOCKS_PER_SEC, rows);
+      }
     }
   }
 
+  //Start loading the following steps in the background
+  prefetch();
+
   return rows;
 }
 
@@ -1186,96 +1630,38 @@ int Model::loadGeometry(int obj_id, int time_start, int time_stop, bool recurseT
   if (time_stop < 0) time_stop = step();
 
   //Load geometry
-  char filter[256] = {'\0'};
-  char objfilter[32] = {'\0'};
-
-  //Setup filters, object...
   if (obj_id > 0)
   {
-    sprintf(objfilter, "WHERE object_id=%d", obj_id);
     //Remove the skip flag now we have explicitly loaded object
     DrawingObject* obj = findObject(obj_id);
 
     if (obj) obj->skip = false;
   }
 
-  //...timestep...(if ts db attached, assume all geometry is at current step)
-  if (time_start >= 0 && time_stop >= 0 && !database.attached)
-  {
-    if (strlen(objfilter) > 0)
-      sprintf(filter, "%s AND timestep BETWEEN %d AND %d", objfilter, time_start, time_stop);
-    else
-      sprintf(filter, " WHERE timestep BETWEEN %d AND %d", time_start, time_stop);
-  }
-  else
-    strcpy(filter, objfilter);
-
-  int datacol = 21;
-  //object (id, name, colourmap_id, colour, opacity, wireframe, cullface, scaling, lineWidth, arrowHead, flat, steps, time)
-  //geometry (id, object_id, timestep, rank, idx, type, data_type, size, count, width, minimum, maximum, dim_factor, units, labels,
-  //minX, minY, minZ, maxX, maxY, maxZ, data)
-  sqlite3_stmt* statement = database.select("SELECT id,object_id,timestep,rank,idx,type,data_type,size,count,width,minimum,maximum,dim_factor,units,labels,minX,minY,minZ,maxX,maxY,maxZ,data FROM %sgeometry %s ORDER BY timestep,object_id", database.prefix, filter);
-
-  //Old database compatibility
-  if (statement == NULL)
-  {
-    //object (id, name, colourmap_id, colour, opacity, wireframe, cullface, scaling, lineWidth, arrowHead, flat, steps, time)
-    //geometry (id, object_id, timestep, rank, idx, type, data_type, size, count, width, minimum, maximum, dim_factor, units, data)
-    statement = database.select("SELECT id,object_id,timestep,rank,idx,type,data_type,size,count,width,minimum,maximum,dim_factor,units,labels,data FROM %sgeometry %s ORDER BY timestep,object_id", database.prefix, filter);
-    datacol = 15;
-
-    //Fix
-#ifdef ALTER_DB
-    database.reopen(true);  //Open writable
-    database.issue("ALTER TABLE %sgeometry ADD COLUMN minX REAL; ALTER TABLE %sgeometry ADD COLUMN minY REAL; ALTER TABLE %sgeometry ADD COLUMN minZ REAL; "
-            "ALTER TABLE %sgeometry ADD COLUMN maxX REAL; ALTER TABLE %sgeometry ADD COLUMN maxY REAL; ALTER TABLE %sgeometry ADD COLUMN maxZ REAL; ",
-            database.prefix, database.prefix, database.prefix, database.prefix, database.prefix, database.prefix, database.prefix);
-#endif
-  }
-
-  //Very old database compatibility
-  if (statement == NULL)
-  {
-    statement = database.select("SELECT id,object_id,timestep,rank,idx,type,data_type,size,count,width,minimum,maximum,dim_factor,units,data FROM %sgeometry %s ORDER BY timestep,object_id", database.prefix, filter);
-    datacol = 14;
-  }
+  //Skipped objects are excluded in the query
+  int datacol;
+  sqlite3_stmt* statement = database.selectGeometry(obj_id, time_start, time_stop, datacol, obj_id > 0 ? "" : objectFilter());
 
   if (!statement) return 0;
   int rows = 0;
-  int tbytes = 0;
+  unsigned long tbytes = 0;
   int ret;
   Geometry* active = NULL;
+  //Value data can be loaded later by row id, unless from attached timestep databases
+  bool lazy = recurseTracers && !database.attached && drawstate.global("lazyvalues");
+  //Compressed records, read in order then decompressed in parallel
+  std::vector<std::unique_ptr<GeomRecord> > pending; //Freed if loading is aborted by an error
+  unsigned long pendingbytes = 0;
   do
   {
     ret = sqlite3_step(statement);
     if (ret == SQLITE_ROW)
     {
       rows++;
-      int object_id = sqlite3_column_int(statement, 1);
-      int timestep = sqlite3_column_int(statement, 2);
-      int height = sqlite3_column_int(statement, 3);  //unused - was rank, now height
-      int depth = sqlite3_column_int(statement, 4); //unused - was idx, now depth
-      lucGeometryType type = (lucGeometryType)sqlite3_column_int(statement, 5);
-      lucGeometryDataType data_type = (lucGeometryDataType)sqlite3_column_int(statement, 6);
-      int size = sqlite3_column_int(statement, 7);
-      int count = sqlite3_column_int(statement, 8);
-      int items = count / size;
-      int width = sqlite3_column_int(statement, 9);
-      if (height == 0) height = width > 0 ? items / width : 0;
-      //TODO: these should be used for value data if set!
-      //float minimum = (float)sqlite3_column_double(statement, 10);
-      //float maximum = (float)sqlite3_column_double(statement, 11);
-      //Units field repurposed for data label
-      const char *data_label = (const char*)sqlite3_column_text(statement, 13);
-      const char *labels = datacol < 15 ? "" : (const char*)sqlite3_column_text(statement, 14);
-
-      //printf("%d] OBJ %d STEP %d TYPE %d DTYPE %d DIMS (%d x %d x %d) COUNT %d ITEMS %d LABELS %s\n", 
-      //       rows, object_id, timestep, type, data_type, width, height, depth, count, items, labels);
-
-      const void *data = sqlite3_column_blob(statement, datacol);
-      unsigned int bytes = sqlite3_column_bytes(statement, datacol);
-
-      DrawingObject* obj = findObject(object_id);
+      GeomRecord rec;
+      rec.read(statement, datacol);
+
+      DrawingObject* obj = findObject(rec.object_id);
 
       //Deleted or Skip object? (When noload enabled)
       if (!obj || obj->skip) continue;
@@ -1283,33 +1669,29 @@ int Model::loadGeometry(int obj_id, int time_start, int time_stop, bool recurseT
       //Bulk load: switch timestep and cache if timestep changes!
       // - disabled when loading multiple tracer steps (recursive load)
       // - disabled when using attached databases (cached in loop via cacheLoad())
-      if (recurseTracers && step() != timestep && !database.attached)
+      if (recurseTracers && step() != rec.timestep && !database.attached)
       {
+        //Finish loading the previous step before caching
+        tbytes += decompressRecords(pending);
+        pendingbytes = 0;
         cacheStep();
-        drawstate.now = now = nearestTimeStep(timestep);
+        drawstate.now = now = nearestTimeStep(rec.timestep);
         debug_print("TimeStep set to: %d, rows %d\n", step(), rows);
       }
 
       //Create new geometry containers if required
       if (geometry.size() == 0) init();
 
-      if (type == lucTracerType)
-      {
-        height = 0;
-        //Default particle count:
-        if (width == 0) width = items;
-      }
-
       //Create object and set parameters
-      if (type == lucPointType && drawstate.global("pointspheres")) type = lucShapeType;
-      //if (type == lucGridType) type = lucTriangleType;
-      active = geometry[type];
+      if (rec.type == lucPointType && drawstate.global("pointspheres")) rec.type = lucShapeType;
+      //if (rec.type == lucGridType) rec.type = lucTriangleType;
+      active = geometry[rec.type];
 
-      if (recurseTracers && type == lucTracerType)
+      if (recurseTracers && rec.type == lucTracerType)
       {
         //if (datacol == 13) continue;  //Don't bother supporting tracers from old dbs
         //Only load tracer timesteps when on the vertex data object or will repeat for every type found
-        if (data_type != lucVertexData) continue;
+        if (rec.data_type != lucVertexData) continue;
 
         //Tracers are loaded with a new select statement across multiple timesteps...
         //objects[object_id]->steps = timestep+1;
@@ -1317,93 +1699,55 @@ int Model::loadGeometry(int obj_id, int time_start, int time_stop, bool recurseT
         int stepstart = 0; //timestep - objects[object_id]->steps;
         //int stepstart = timestep - tracers->steps;
 
-        loadGeometry(object_id, stepstart, timestep, false);
+        loadGeometry(rec.object_id, stepstart, rec.timestep, false);
       }
       else
       {
-        unsigned char* buffer = NULL;
-        if (bytes != (unsigned int)(count * GeomData::byteSize(data_type)))
-        {
-          //Decompress!
-          unsigned long dst_len = (unsigned long)(count * GeomData::byteSize(data_type));
-          unsigned long uncomp_len = dst_len;
-          unsigned long cmp_len = bytes;
-          buffer = new unsigned char[dst_len];
-          if (!buffer)
-            abort_program("Out of memory!\n");
-
-#ifdef USE_ZLIB
-          int res = uncompress(buffer, &uncomp_len, (const unsigned char *)data, cmp_len);
-          if (res != Z_OK || dst_len != uncomp_len)
-#else
-          int res = tinfl_decompress_mem_to_mem(buffer, uncomp_len, (const unsigned char *)data, cmp_len, TINFL_FLAG_PARSE_ZLIB_HEADER);
-          if (!res)
-#endif
-          {
-            abort_program("uncompress() failed! error code %d\n", res);
-            //abort_program("uncompress() failed! error code %d expected size %d actual size %d\n", res, dst_len, uncomp_len);
-          }
-          data = buffer; //Replace data pointer
-          bytes = uncomp_len;
-        }
-
-        tbytes += bytes;   //Byte counter
-
         //Always add a new element for each new vertex geometry record, not suitable if writing db on multiple procs!
-        if (data_type == lucVertexData && recurseTracers) active->add(obj);
-
-        //Read data block
-        GeomData* g;
-        //Convert legacy value types to use data labels
-        switch (data_type)
-        {
-          case lucColourValueData:
-          case lucOpacityValueData:
-          case lucRedValueData:
-          case lucGreenValueData:
-          case lucBlueValueData:
-          case lucXWidthData:
-          case lucYHeightData:
-          case lucZLengthData:
-          case lucSizeData:
-          case lucMaxDataType:
-            if (data_label && strlen(data_label) > 0)
-              //Use provided label from units field
-              g = active->read(obj, items, data, data_label);
-            else //Use default/legacy label
-              g = active->read(obj, items, data, GeomData::datalabels[data_type]);
-            break;
-
-          default:
-            //Non-value data
-            g = active->read(obj, items, data_type, data, width, height, depth);
-        }
+        if (rec.data_type == lucVertexData && recurseTracers) active->add(obj);
 
-        //Set geom labels if any
-        if (labels) active->label(obj, labels);
+        //Unreferenced value data is left in the database, blob is not read
+        if (lazy && deferValues(active, obj, rec)) continue;
 
-        //Where min/max vertex provided, load
-        if (data_type == lucVertexData && type != lucLabelType)
+        const void *data = sqlite3_column_blob(statement, datacol);
+        unsigned int bytes = sqlite3_column_bytes(statement, datacol);
+        if (rec.compressed(bytes))
         {
-          float min[3] = {0,0,0}, max[3] = {0,0,0};
-          if (datacol > 15 && sqlite3_column_type(statement, 15) != SQLITE_NULL)
+          //Compressed: reserve space in the data store, decompressed into place later
+          DataContainer* target = loadRecord(active, obj, rec, NULL);
+          unsigned int reserved = rec.items * (target ? target->unitsize() : 0);
+          if (reserved == 0) continue;
+          if (reserved != (unsigned int)rec.count)
           {
-            for (int i=0; i<3; i++)
-            {
-              min[i] = (float)sqlite3_column_double(statement, 15+i);
-              max[i] = (float)sqlite3_column_double(statement, 18+i);
-            }
+            //Record count not a multiple of store units, decompress now and copy the part read
+            std::vector<unsigned char> buffer(rec.count * GeomData::byteSize(rec.data_type));
+            rec.decompress(data, bytes, buffer.data());
+            memcpy(target->ref(target->size() - reserved), buffer.data(), reserved * GeomData::byteSize(rec.data_type));
+            tbytes += buffer.size();
+            continue;
           }
 
-          //Apply dims if provided
-          if (min[0] != max[0] || min[1] != max[1] || min[2] != max[2])
+          GeomRecord* prec = new GeomRecord(rec);
+          prec->target = target;
+          prec->offset = target->size() - rec.count;
+          prec->data.assign((const unsigned char*)data, (const unsigned char*)data + bytes);
+          pending.push_back(std::unique_ptr<GeomRecord>(prec));
+
+          //Limit memory held by compressed copies
+          pendingbytes += bytes;
+          if (pendingbytes > 256000000)
           {
-            g->checkPointMinMax(min);
-            g->checkPointMinMax(max);
+            tbytes += decompressRecords(pending);
+            pendingbytes = 0;
           }
         }
+        else
+        {
+          tbytes += bytes;   //Byte counter
 
-        if (buffer) delete[] buffer;
+          //Read data block
+          loadRecord(active, obj, rec, data);
+        }
       }
     }
     else if (ret != SQLITE_DONE)
@@ -1412,11 +1756,639 @@ int Model::loadGeometry(int obj_id, int time_start, int time_stop, bool recurseT
   while (ret == SQLITE_ROW);
 
   sqlite3_finalize(statement);
-  debug_print("... loaded %d rows, %d bytes, %.4lf seconds\n", rows, tbytes, (clock()-t1)/(double)CLOCKS_PER_SEC);
+  tbytes += decompressRecords(pending);
+  debug_print("... loaded %d rows, %lu bytes, %.4lf seconds\n", rows, tbytes, (clock()-t1)/(double)CLOCKS_PER_SEC);
 
   return rows;
 }
 
+unsigned long Model::decompressRecords(std::vector<std::unique_ptr<GeomRecord> >& pending)
+{
+  //Decompress pending records directly into their reserved data store space,
+  //an error in any worker is rethrown by parallel_for after all have finished
+  if (pending.size() == 0) return 0;
+  clock_t t1 = clock();
+  unsigned long bytes = 0;
+  parallel_for(pending.size(), [&](unsigned int i)
+  {
+    GeomRecord* rec = pending[i].get();
+    rec->decompress(rec->data.data(), rec->data.size(), (unsigned char*)rec->target->ref(rec->offset));
+  }, drawstate.global("threads"));
+
+  for (unsigned int i=0; i < pending.size(); i++)
+    bytes += pending[i]->count * GeomData::byteSize(pending[i]->data_type);
+  debug_print("... decompressed %d records, %lu bytes, %.4lf seconds\n", pending.size(), bytes, (clock()-t1)/(double)CLOCKS_PER_SEC);
+  pending.clear();
+  return bytes;
+}
+
+std::string Model::objectFilter()
+{
+  //Query condition excluding objects flagged to skip (noload)
+  std::stringstream ss;
+  for (unsigned int i=0; i<objects.size(); i++)
+  {
+    if (!objects[i]->skip) continue;
+    ss << (ss.tellp() > 0 ? "," : "") << objects[i]->dbid;
+  }
+  //Very long lists are left to be skipped as rows are read
+  if (ss.tellp() <= 0 || ss.tellp() > SQL_QUERY_MAX/2) return "";
+  return "object_id NOT IN (" + ss.str() + ")";
+}
+
+bool Model::valuesRequired(GeomData* g, const std::string& label)
+{
+  //Check if labelled value data is referenced by any property of its object
+  unsigned int idx = 0;
+  while (idx < g->values.size() && g->values[idx]->label != label)
+    idx++;
+  //First value data is always required, used as default colour and iso values
+  if (idx == 0) return true;
+
+  DrawingObject* draw = g->draw;
+  std::vector<json> refs;
+  refs.push_back(draw->properties["colourby"]);
+  if (draw->properties.has("opacitymap"))
+    refs.push_back(draw->properties["opacityby"]);
+  if (g->type == lucPointType)
+    refs.push_back(draw->properties["sizeby"]);
+  if (g->type == lucShapeType)
+  {
+    refs.push_back(draw->properties["widthby"]);
+    refs.push_back(draw->properties["heightby"]);
+    refs.push_back(draw->properties["lengthby"]);
+  }
+  json filters = draw->properties["filters"];
+  for (unsigned int i=0; i < filters.size(); i++)
+    refs.push_back(filters[i]["by"]);
+
+  for (auto& by : refs)
+  {
+    if (by.is_string() && by.get<std::string>() == label) return true;
+    if (by.is_number() && (unsigned int)by == idx) return true;
+  }
+  return false;
+}
+
+bool Model::deferValues(Geometry* active, DrawingObject* obj, GeomRecord& rec)
+{
+  //Leave a value data record unloaded if not currently referenced,
+  //an empty store is created to keep the order of value data indices
+  std::string label = rec.valueLabel();
+  if (label.length() == 0) return false;
+  GeomData* g = active->read(obj, 0, NULL, label);
+  if (!g->deferred.count(label) && valuesRequired(g, label)) return false;
+  g->deferred[label].push_back(rec.id);
+  deferred = true;
+  return true;
+}
+
+bool Model::loadValues(Geometry* active, GeomData* g, bool all)
+{
+  //Load deferred value data now referenced (or all)
+  if (g->deferred.size() == 0) return false;
+  std::map<int, std::string> rows;
+  std::vector<std::string> labels;
+  std::stringstream ss;
+  for (auto it = g->deferred.begin(); it != g->deferred.end(); ++it)
+  {
+    if (all || valuesRequired(g, it->first))
+    {
+      for (auto id : it->second)
+      {
+        ss << (rows.size() ? "," : "") << id;
+        rows[id] = it->first;
+      }
+      labels.push_back(it->first);
+    }
+  }
+  if (rows.size() == 0) return false;
+
+  clock_t t1 = clock();
+  int datacol;
+  sqlite3_stmt* statement = database.selectGeometry(0, -1, -1, datacol, "id IN (" + ss.str() + ")");
+  //Keep the records deferred if they can't be read so a later load can retry
+  if (!statement) return false;
+  for (unsigned int l=0; l<labels.size(); l++)
+    g->deferred.erase(labels[l]);
+  while (sqlite3_step(statement) == SQLITE_ROW)
+  {
+    GeomRecord rec;
+    rec.read(statement, datacol);
+    const void *data = sqlite3_column_blob(statement, datacol);
+    unsigned int bytes = sqlite3_column_bytes(statement, datacol);
+    std::vector<unsigned char> buffer;
+    if (rec.compressed(bytes))
+    {
+      buffer.resize(rec.count * GeomData::byteSize(rec.data_type));
+      rec.decompress(data, bytes, buffer.data());
+      data = buffer.data();
+    }
+    active->read(g, rec.items, data, rows[rec.id]);
+  }
+  sqlite3_finalize(statement);
+  debug_print("... loaded %d deferred value records, %.4lf seconds\n", rows.size(), (clock()-t1)/(double)CLOCKS_PER_SEC);
+  return true;
+}
+
+void Model::loadDeferred(bool all, DrawingObject* target)
+{
+  //Load value data left in database when now referenced by object properties (or all),
+  //for every object or only the target
+  if (!deferred || !database) return;
+  for (unsigned int i=0; i < objects.size(); i++)
+  {
+    if (target && objects[i] != target) continue;
+    bool loaded = false;
+    for (unsigned int t=0; t < geometry.size(); t++)
+    {
+      std::vector<GeomData*> list = geometry[t]->getAllObjects(objects[i]);
+      for (unsigned int g=0; g < list.size(); g++)
+        if (loadValues(geometry[t], list[g], all)) loaded = true;
+    }
+    if (loaded) reload(objects[i]);
+  }
+}
+
+DataContainer* Model::loadRecord(Geometry* active, DrawingObject* obj, GeomRecord& rec, const void* data)
+{
+  //Read data block, returns the store it was read into
+  //(NULL data reserves space in the store without copying, unless record has a loaded block to adopt)
+  GeomData* g;
+  DataContainer* store = NULL;
+  std::string label = rec.valueLabel();
+  if (label.length() > 0)
+  {
+    if (rec.block)
+      g = active->adopt(obj, rec.items, rec.block, label);
+    else
+      g = active->read(obj, rec.items, data, label);
+    for (auto vals : g->values)
+      if (vals->label == label)
+        store = vals;
+  }
+  else
+  {
+    //Non-value data
+    if (rec.block)
+      g = active->adopt(obj, rec.items, rec.data_type, rec.block, rec.width, rec.height, rec.depth);
+    else
+      g = active->read(obj, rec.items, rec.data_type, data, rec.width, rec.height, rec.depth);
+    store = g->data[rec.data_type];
+  }
+
+  //Set geom labels if any
+  if (rec.labels.length() > 0) active->label(obj, rec.labels.c_str());
+
+  //Where min/max vertex provided, apply dims
+  if (rec.bounds && rec.type != lucLabelType)
+  {
+    g->checkPointMinMax(rec.min);
+    g->checkPointMinMax(rec.max);
+  }
+
+  return store;
+}
+
+void Model::prefetch()
+{
+  //Queue background loading of the next timesteps while the current one is displayed
+  int depth = drawstate.global("prefetch");
+  if (depth <= 0 || now < 0 || !database || database.memory)
+  {
+    clearPrefetch();
+    return;
+  }
+
+  //Discard any steps no longer ahead of the current step
+  int last = min(now + depth, (int)timesteps.size()-1);
+  clearPrefetch(now+1, last);
+
+  for (int idx = now+1; idx <= last; idx++)
+  {
+    //Already queued or cached?
+    if (prefetched.count(idx) || timesteps[idx]->cache.size() > 0) continue;
+    if (drawstate.global("lvcache") && cacheFile(idx).length() > 0) continue;
+    PrefetchStep* pf = new PrefetchStep(idx);
+    pf->objects = objectFilter();
+    prefetched[idx] = pf;
+    pf->thread = std::thread(prefetchStep, pf, database.file, timesteps[idx]->step, timesteps[idx]->path);
+    debug_print("~~~ Prefetching step %d (idx %d)\n", timesteps[idx]->step, idx);
+  }
+}
+
+void Model::clearPrefetch(int keep_start, int keep_end)
+{
+  //Cancel and free any prefetched steps outside the range to keep
+  for (auto it = prefetched.begin(); it != prefetched.end(); )
+  {
+    if (it->first >= keep_start && it->first <= keep_end)
+    {
+      ++it;
+      continue;
+    }
+    it->second->cancel = true;
+    delete it->second; //Joins the worker thread
+    it = prefetched.erase(it);
+  }
+}
+
+void Model::prefetchStep(PrefetchStep* pf, FilePath file, int step, std::string path)
+{
+  //Worker thread: uses its own database connection, reads and decompresses all geometry
+  //records for the step so the viewer thread only has to copy them into containers
+  try
+  {
+    Database db(file);
+    if (db.open())
+    {
+      TimeStep ts(step, 0, path);
+      db.attach(&ts);
+      readRecords(db, pf, 0, step, step, true);
+    }
+    else
+      pf->failed = true;
+  }
+  catch (std::exception& e)
+  {
+    //Fall back to loading on the viewer thread
+    pf->failed = true;
+  }
+  pf->done = true;
+}
+
+void Model::readRecords(Database& db, PrefetchStep* pf, int obj_id, int time_start, int time_stop, bool recurseTracers)
+{
+  int datacol;
+  sqlite3_stmt* statement = db.selectGeometry(obj_id, time_start, time_stop, datacol, obj_id > 0 ? "" : pf->objects);
+  if (!statement)
+  {
+    pf->failed = true;
+    return;
+  }
+
+  while (!pf->cancel && sqlite3_step(statement) == SQLITE_ROW)
+  {
+    GeomRecord* rec = new GeomRecord();
+    rec->read(statement, datacol);
+
+    if (recurseTracers && rec->type == lucTracerType)
+    {
+      //Tracers are loaded with a new select statement across multiple timesteps
+      if (rec->data_type == lucVertexData)
+        readRecords(db, pf, rec->object_id, 0, rec->timestep, false);
+      delete rec;
+      continue;
+    }
+
+    //Load into a store sized from the record count, adopted by the geometry container when applied
+    const void *data = sqlite3_column_blob(statement, datacol);
+    unsigned int bytes = sqlite3_column_bytes(statement, datacol);
+    unsigned int size = rec->count * GeomData::byteSize(rec->data_type);
+    rec->block = rec->newBlock();
+    if (rec->compressed(bytes))
+      rec->decompress(data, bytes, (unsigned char*)rec->block->ref());
+    else if (size > 0)
+      memcpy(rec->block->ref(), data, size);
+
+    rec->element = (rec->data_type == lucVertexData && recurseTracers);
+    pf->records.push_back(rec);
+  }
+
+  sqlite3_finalize(statement);
+}
+
+bool Model::restorePrefetch()
+{
+  //Load the current step from prefetched records if available
+  int depth = drawstate.global("prefetch");
+  if (depth <= 0) return false;
+  auto it = prefetched.find(now);
+  if (it == prefetched.end())
+  {
+    prefetchMisses++;
+    return false;
+  }
+
+  PrefetchStep* pf = it->second;
+  prefetched.erase(it);
+  if (pf->done)
+    prefetchHits++;
+  else
+    prefetchWaits++;
+  pf->thread.join();
+
+  if (pf->failed)
+  {
+    debug_print("~~~ Prefetch failed for step %d, reloading\n", step());
+    delete pf;
+    return false;
+  }
+
+  //Create new geometry containers if required
+  if (geometry.size() == 0) init();
+
+  for (unsigned int r=0; r < pf->records.size(); r++)
+  {
+    GeomRecord& rec = *pf->records[r];
+    DrawingObject* obj = findObject(rec.object_id);
+
+    //Deleted or Skip object? (When noload enabled)
+    if (!obj || obj->skip) continue;
+
+    if (rec.type == lucPointType && drawstate.global("pointspheres")) rec.type = lucShapeType;
+    Geometry* active = geometry[rec.type];
+
+    if (rec.element) active->add(obj);
+    loadRecord(active, obj, rec, NULL);
+    delete rec.block;
+    rec.block = NULL;
+  }
+
+  debug_print("~~~ Prefetch hit at ts %d (idx %d), %d records, hits %d waits %d misses %d\n", step(), now,
+              pf->records.size(), prefetchHits, prefetchWaits, prefetchMisses);
+  delete pf;
+  return true;
+}
+
+//Binary geometry cache file layout (.lvcache, one file per timestep, native little-endian)
+//  LVCacheHeader, LVCacheRecord[records], label strings, data arrays (each 16 byte aligned)
+#define LVCACHE_MAGIC "LVCACHE"
+#define LVCACHE_VERSION 1
+#define LVCACHE_ALIGN(x) (((x) + 15) & ~(uint64_t)15)
+
+struct LVCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t endian;    //0x01020304 as written
+  int32_t step;
+  uint32_t records;
+  uint64_t bytes;     //Total file size
+};
+
+struct LVCacheRecord
+{
+  int32_t object_id;
+  int32_t type;
+  int32_t data_type;
+  int32_t count;
+  int32_t items;
+  int32_t width;
+  int32_t height;
+  int32_t depth;
+  float min[3];
+  float max[3];
+  uint32_t bounds;
+  uint32_t element;
+  uint32_t label_len;
+  uint32_t labels_len;
+  uint64_t label_offset;
+  uint64_t labels_offset;
+  uint64_t offset;    //Data array
+  uint64_t size;      //Data bytes
+};
+
+std::string Model::cacheFile(int idx, bool check)
+{
+  //Binary cache file path for step, if check set, only returns path if it exists and is up to date
+  if (idx < 0 || idx >= (int)timesteps.size() || !database || database.memory) return "";
+  std::stringstream ss;
+  ss << database.file.path << database.file.base << "." << std::setw(5) << std::setfill('0') << timesteps[idx]->step << ".lvcache";
+  std::string path = ss.str();
+  if (!check) return path;
+
+  struct stat cs, ds;
+  if (stat(path.c_str(), &cs) != 0) return "";
+  //Ignore if older than the database it was created from
+  std::string dbpath = timesteps[idx]->path.length() > 0 ? timesteps[idx]->path : database.file.full;
+  if (stat(dbpath.c_str(), &ds) == 0 && ds.st_mtime > cs.st_mtime) return "";
+  if (stat(database.file.full.c_str(), &ds) == 0 && ds.st_mtime > cs.st_mtime) return "";
+  return path;
+}
+
+bool Model::writeCacheFile(const std::string& path, int step, std::vector<GeomRecord*>& records)
+{
+  LVCacheHeader header;
+  memset(&header, 0, sizeof(LVCacheHeader));
+  strcpy(header.magic, LVCACHE_MAGIC);
+  header.version = LVCACHE_VERSION;
+  header.endian = 0x01020304;
+  header.step = step;
+  header.records = records.size();
+
+  //Layout strings then data arrays after the record table
+  std::vector<LVCacheRecord> table(records.size());
+  uint64_t pos = sizeof(LVCacheHeader) + sizeof(LVCacheRecord) * records.size();
+  for (unsigned int i=0; i < records.size(); i++)
+  {
+    GeomRecord& rec = *records[i];
+    LVCacheRecord& r = table[i];
+    memset(&r, 0, sizeof(LVCacheRecord));
+    r.object_id = rec.object_id;
+    r.type = rec.type;
+    r.data_type = rec.data_type;
+    r.count = rec.count;
+    r.items = rec.items;
+    r.width = rec.width;
+    r.height = rec.height;
+    r.depth = rec.depth;
+    memcpy(r.min, rec.min, sizeof(float)*3);
+    memcpy(r.max, rec.max, sizeof(float)*3);
+    r.bounds = rec.bounds;
+    r.element = rec.element;
+    r.label_len = rec.label.length();
+    r.label_offset = pos;
+    pos += r.label_len;
+    r.labels_len = rec.labels.length();
+    r.labels_offset = pos;
+    pos += r.labels_len;
+  }
+  for (unsigned int i=0; i < records.size(); i++)
+  {
+    pos = LVCACHE_ALIGN(pos);
+    table[i].offset = pos;
+    table[i].size = records[i]->block ? records[i]->block->bytes() : 0;
+    pos += table[i].size;
+  }
+  header.bytes = pos;
+
+  std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) return false;
+  file.write((const char*)&header, sizeof(LVCacheHeader));
+  file.write((const char*)table.data(), sizeof(LVCacheRecord) * table.size());
+  for (unsigned int i=0; i < records.size(); i++)
+  {
+    file.write(records[i]->label.c_str(), table[i].label_len);
+    file.write(records[i]->labels.c_str(), table[i].labels_len);
+  }
+  char zeros[16] = {0};
+  for (unsigned int i=0; i < records.size(); i++)
+  {
+    file.write(zeros, table[i].offset - file.tellp());
+    if (table[i].size)
+      file.write((const char*)records[i]->block->ref(), table[i].size);
+  }
+  file.close();
+  return !file.fail();
+}
+
+int Model::writeCache()
+{
+  //Convert every timestep of the database into binary cache files, one step per worker thread
+  if (!database || database.memory) return 0;
+  clock_t t1 = clock();
+  std::atomic<int> written(0);
+  std::vector<std::string> paths(timesteps.size());
+  for (unsigned int i=0; i < timesteps.size(); i++)
+    paths[i] = cacheFile(i, false);
+
+  parallel_for(timesteps.size(), [&](unsigned int i)
+  {
+    PrefetchStep pf(i);
+    Database db(database.file);
+    if (!db.open()) return;
+    TimeStep ts(timesteps[i]->step, 0, timesteps[i]->path);
+    db.attach(&ts);
+    readRecords(db, &pf, 0, ts.step, ts.step, true);
+    if (!pf.failed && writeCacheFile(paths[i], ts.step, pf.records))
+      written++;
+    else
+      std::cerr << "Failed to write cache file: " << paths[i] << std::endl;
+  }, drawstate.global("threads"));
+
+  debug_print("%.4lf seconds to write %d cache files\n", (clock()-t1)/(double)CLOCKS_PER_SEC, (int)written);
+  return written;
+}
+
+bool Model::loadCacheFile()
+{
+  //Load current step from binary cache file if available
+  if (!drawstate.global("lvcache")) return false;
+  std::string path = cacheFile(now);
+  if (path.length() == 0) return false;
+  clock_t t1 = clock();
+
+  //Map the file
+  char* buffer = NULL;
+  uint64_t size = 0;
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(LVCacheHeader))
+  {
+    size = st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) buffer = (char*)map;
+  }
+  ::close(fd);
+  if (!buffer) return false;
+#else
+  std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+  if (!file.is_open()) return false;
+  size = file.tellg();
+  std::vector<char> contents(size);
+  file.seekg(0, std::ios::beg);
+  file.read(contents.data(), size);
+  buffer = contents.data();
+#endif
+
+  //Validate the header and the whole record table before anything is loaded,
+  //a damaged file is treated as a cache miss and the step read from the database
+  LVCacheHeader* header = (LVCacheHeader*)buffer;
+  bool valid = size >= sizeof(LVCacheHeader) && strncmp(header->magic, LVCACHE_MAGIC, 8) == 0 &&
+               header->version == LVCACHE_VERSION && header->endian == 0x01020304 && header->bytes == size &&
+               header->step == step() && sizeof(LVCacheHeader) + (uint64_t)header->records * sizeof(LVCacheRecord) <= size;
+  LVCacheRecord* table = (LVCacheRecord*)(buffer + sizeof(LVCacheHeader));
+  for (unsigned int i=0; valid && i < header->records; i++)
+  {
+    LVCacheRecord& r = table[i];
+    if (r.type < lucMinType || r.type >= lucMaxType || r.data_type < lucMinDataType || r.data_type >= lucMaxDataType ||
+        r.count < 0 || r.items < 0 || r.offset > size || r.size > size - r.offset ||
+        r.label_offset > size || r.label_len > size - r.label_offset ||
+        r.labels_offset > size || r.labels_len > size - r.labels_offset)
+    {
+      valid = false;
+      break;
+    }
+    //Space reserved for the items must be covered by the stored array
+    lucGeometryDataType type = (lucGeometryDataType)r.data_type;
+    uint64_t unit = 1;
+    if (r.label_len == 0 && (type == lucVertexData || type == lucVectorData || type == lucNormalData)) unit = 3;
+    if (r.label_len == 0 && type == lucTexCoordData) unit = 2;
+    if ((uint64_t)r.items * unit * GeomData::byteSize(type) > r.size)
+      valid = false;
+  }
+
+  std::vector<GeomRecord> pending;
+  std::vector<const char*> sources;
+  try
+  {
+    if (valid)
+    {
+      //Create records and reserve their space in order, then copy the arrays in parallel
+      if (geometry.size() == 0) init();
+      for (unsigned int i=0; i < header->records; i++)
+      {
+        LVCacheRecord& r = table[i];
+        DrawingObject* obj = findObject(r.object_id);
+        //Deleted or Skip object? (When noload enabled)
+        if (!obj || obj->skip) continue;
+
+        GeomRecord rec;
+        rec.object_id = r.object_id;
+        rec.timestep = header->step;
+        rec.type = (lucGeometryType)r.type;
+        rec.data_type = (lucGeometryDataType)r.data_type;
+        rec.count = r.count;
+        rec.items = r.items;
+        rec.width = r.width;
+        rec.height = r.height;
+        rec.depth = r.depth;
+        memcpy(rec.min, r.min, sizeof(float)*3);
+        memcpy(rec.max, r.max, sizeof(float)*3);
+        rec.bounds = r.bounds;
+        rec.label = std::string(buffer + r.label_offset, r.label_len);
+        rec.labels = std::string(buffer + r.labels_offset, r.labels_len);
+
+        if (rec.type == lucPointType && drawstate.global("pointspheres")) rec.type = lucShapeType;
+        Geometry* active = geometry[rec.type];
+        if (r.element) active->add(obj);
+
+        rec.target = loadRecord(active, obj, rec, NULL);
+        if (!rec.target || rec.items == 0) continue;
+        //Reserved store elements (may be less than count if not a multiple of store units)
+        rec.count = rec.items * rec.target->unitsize();
+        rec.offset = rec.target->size() - rec.count;
+        pending.push_back(rec);
+        sources.push_back(buffer + r.offset);
+      }
+
+      parallel_for(pending.size(), [&](unsigned int i)
+      {
+        GeomRecord& rec = pending[i];
+        memcpy(rec.target->ref(rec.offset), sources[i], rec.count * GeomData::byteSize(rec.data_type));
+      }, drawstate.global("threads"));
+      debug_print("~~~ Loaded %d records from cache file %s, %.4lf seconds\n", pending.size(), path.c_str(), (clock()-t1)/(double)CLOCKS_PER_SEC);
+    }
+    else
+      debug_print("~~~ Cache file %s invalid, ignored\n", path.c_str());
+  }
+  catch (...)
+  {
+#ifndef _WIN32
+    munmap(buffer, size);
+#endif
+    throw;
+  }
+
+#ifndef _WIN32
+  munmap(buffer, size);
+#endif
+  return valid;
+}
+
 void Model::mergeDatabases()
 {
   if (!database) return;
@@ -1427,7 +2399,16 @@ void Model::mergeDatabases()
     setTimeStep(i);
     if (database.attached->step == step())
     {
-      database.issue("insert into geometry select null, object_id, timestep, rank, idx, type, data_type, size, count, width, minimum, maximum, dim_factor, units, labels, properties, data, minX, minY, minZ, maxX, maxY, maxZ from %sgeometry", database.prefix);
+      std::string cols = "object_id, timestep, rank, idx, type, data_type, size, count, width, minimum, maximum, dim_factor, units, labels, properties, minX, minY, minZ, maxX, maxY, maxZ, data";
+      //Blob codec must be copied where stored
+      sqlite3_stmt* check = database.select("SELECT codec FROM %sgeometry LIMIT 1", database.prefix);
+      if (check)
+      {
+        sqlite3_finalize(check);
+        database.insertGeometry(); //Adds codec column if missing
+        cols += ", codec";
+      }
+      database.issue("insert into geometry (%s) select %s from %sgeometry", cols.c_str(), cols.c_str(), database.prefix);
     }
   }
 }
@@ -1450,28 +2431,29 @@ void Model::updateObject(DrawingObject* target, lucGeometryType type, bool compr
 void Model::writeDatabase(const char* path, DrawingObject* obj, bool compress)
 {
   //Write objects to a new database?
-  Database outdb;
+  //(outdb refers to the active database when no path given, copying it would share the handle)
+  Database newdb;
   if (path)
   {
-    outdb = Database(FilePath(path));
-    if (!outdb.open(true))
+    newdb = Database(FilePath(path));
+    if (!newdb.open(true))
     {
-      printf("Database write failed '%s': %s\n", path, sqlite3_errmsg(outdb.db));
+      printf("Database write failed '%s': %s\n", path, sqlite3_errmsg(newdb.db));
       return;
     }
   }
   else
   {
-    outdb = database;
     database.reopen(true);  //Open writable
   }
+  Database& outdb = path ? newdb : database;
 
   // Remove existing static data
   outdb.issue("drop table IF EXISTS object");
   outdb.issue("drop table IF EXISTS state");
 
   // Create new tables when not present
-  outdb.issue("create table IF NOT EXISTS geometry (id INTEGER PRIMARY KEY ASC, object_id INTEGER, timestep INTEGER, rank INTEGER, idx INTEGER, type INTEGER, data_type INTEGER, size INTEGER, count INTEGER, width INTEGER, minimum REAL, maximum REAL, dim_factor REAL, units VARCHAR(32), minX REAL, minY REAL, minZ REAL, maxX REAL, maxY REAL, maxZ REAL, labels VARCHAR(2048), properties VARCHAR(2048), data BLOB, FOREIGN KEY (object_id) REFERENCES object (id) ON DELETE CASCADE ON UPDATE CASCADE, FOREIGN KEY (timestep) REFERENCES timestep (id) ON DELETE CASCADE ON UPDATE CASCADE)");
+  outdb.issue("create table IF NOT EXISTS geometry (id INTEGER PRIMARY KEY ASC, object_id INTEGER, timestep INTEGER, rank INTEGER, idx INTEGER, type INTEGER, data_type INTEGER, size INTEGER, count INTEGER, width INTEGER, minimum REAL, maximum REAL, dim_factor REAL, units VARCHAR(32), minX REAL, minY REAL, minZ REAL, maxX REAL, maxY REAL, maxZ REAL, labels VARCHAR(2048), properties VARCHAR(2048), codec INTEGER, data BLOB, FOREIGN KEY (object_id) REFERENCES object (id) ON DELETE CASCADE ON UPDATE CASCADE, FOREIGN KEY (timestep) REFERENCES timestep (id) ON DELETE CASCADE ON UPDATE CASCADE)");
 
   outdb.issue(
     "create table IF NOT EXISTS timestep (id INTEGER PRIMARY KEY ASC, time REAL, dim_factor REAL, units VARCHAR(32), properties VARCHAR(2048))");
@@ -1490,34 +2472,42 @@ void Model::writeDatabase(const char* path, DrawingObject* obj, bool compress)
     if (!obj || objects[i] == obj)
     {
       if (!outdb.issue("insert into object (name, properties) values ('%s', '%s')", objects[i]->name().c_str(), objects[i]->properties.data.dump().c_str()))
+      {
+        outdb.issue("ROLLBACK");
         return;
+      }
       //Store the id
       objects[i]->dbid = sqlite3_last_insert_rowid(outdb.db);
     }
   }
 
+  outdb.issue("COMMIT");
+
   //Write timesteps & objects...
   //(Only write timestep where doesn't exist already)
+  //Each timestep is committed in its own transaction to bound journal size
   if (timesteps.size() == 0)
   {
     //Create a default timestep
+    outdb.issue("BEGIN EXCLUSIVE TRANSACTION");
     outdb.issue("insert into timestep (id, time) values (0, 0);");
     writeObjects(outdb, obj, 0, compress);
+    outdb.issue("COMMIT");
   }
 
   for (unsigned int i = 0; i < timesteps.size(); i++)
   {
-    outdb.issue("insert into timestep (id, time, properties) values (%d, %g, '%s');", 
-                timesteps[i]->step, timesteps[i]->time, "", timesteps[i]->step);
-
     //Get data at this timestep
     setTimeStep(i);
 
+    outdb.issue("BEGIN EXCLUSIVE TRANSACTION");
+    outdb.issue("insert into timestep (id, time, properties) values (%d, %g, '%s');", 
+                timesteps[i]->step, timesteps[i]->time, "", timesteps[i]->step);
+
     //Write object data
     writeObjects(outdb, obj, step(), compress);
+    outdb.issue("COMMIT");
   }
-
-  outdb.issue("COMMIT");
 }
 
 void Model::writeState()
@@ -1564,6 +2554,9 @@ void Model::writeState(Database& outdb)
 void Model::writeObjects(Database& outdb, DrawingObject* obj, int step, bool compress)
 {
   //Write object data
+  //(deferred values must be loaded first, writing to the active database deletes their records)
+  loadDeferred(true, obj);
+  std::vector<GeomBlock> blocks;
   for (unsigned int i=0; i < objects.size(); i++)
   {
     if (!obj || obj == objects[i])
@@ -1571,10 +2564,14 @@ void Model::writeObjects(Database& outdb, DrawingObject* obj, int step, bool com
       //Loop through all geometry classes (points/vectors etc)
       for (int type=lucMinType; type<lucMaxType; type++)
       {
-        writeGeometry(outdb, (lucGeometryType)type, objects[i], step, compress);
+        //Clear existing data of this type before writing, allows object data updates to db
+        deleteGeometry(outdb, (lucGeometryType)type, objects[i], step);
+        queueGeometry((lucGeometryType)type, objects[i], blocks);
       }
     }
   }
+
+  writeGeometryRecords(outdb, blocks, step, compress);
 }
 
 void Model::deleteGeometry(Database& outdb, lucGeometryType type, DrawingObject* obj, int step)
@@ -1585,14 +2582,26 @@ void Model::deleteGeometry(Database& outdb, lucGeometryType type, DrawingObject*
 
 void Model::writeGeometry(Database& outdb, lucGeometryType type, DrawingObject* obj, int step, bool compressdata)
 {
+  //Load deferred values before their records can be deleted from the active database
+  loadDeferred(true, obj);
+
   //Clear existing data of this type before writing, allows object data updates to db
   deleteGeometry(outdb, type, obj, step);
 
+  std::vector<GeomBlock> blocks;
+  queueGeometry(type, obj, blocks);
+  writeGeometryRecords(outdb, blocks, step, compressdata);
+}
+
+void Model::queueGeometry(lucGeometryType type, DrawingObject* obj, std::vector<GeomBlock>& blocks)
+{
   std::vector<GeomData*> data = geometry[type]->getAllObjects(obj);
-  //Loop through and write out all object data
+  //Loop through and queue all object data
   unsigned int data_type;
   for (unsigned int i=0; i<data.size(); i++)
   {
+    //Value data not yet loaded must be written too
+    loadValues(geometry[type], data[i], true);
     for (data_type=0; data_type < data[i]->data.size(); data_type++)
     {
       //Write the data entry
@@ -1600,8 +2609,8 @@ void Model::writeGeometry(Database& outdb, lucGeometryType type, DrawingObject*
       if (!block || block->size() == 0) continue;
       if (infostream)
         std::cerr << "Writing geometry (type[" << data_type << "] * " << block->size()
-                  << ") for object : " << obj->dbid << " => " << obj->name() << ", compress: " << compressdata << std::endl;
-      writeGeometryRecord(outdb, type, (lucGeometryDataType)data_type, obj->dbid, data[i], block, step, compressdata);
+                  << ") for object : " << obj->dbid << " => " << obj->name() << std::endl;
+      blocks.push_back(GeomBlock(type, (lucGeometryDataType)data_type, obj->dbid, data[i], block));
     }
     for (unsigned int j=0; j<data[i]->values.size(); j++)
     {
@@ -1610,41 +2619,50 @@ void Model::writeGeometry(Database& outdb, lucGeometryType type, DrawingObject*
       if (!block || block->size() == 0) continue;
       if (infostream)
         std::cerr << "Writing geometry (values[" << j << "] * " << block->size()
-                  << ") for object : " << obj->dbid << " => " << obj->name() << ", compress: " << compressdata << std::endl;
+                  << ") for object : " << obj->dbid << " => " << obj->name() << std::endl;
       //TODO: fix to write/read labels for data values from database, preferably in a separate table?
       //This hack will work for up to 7 value data sets for now
       //Filters and colourby properties will need modification though
       data_type = lucColourValueData+j;
       if (data_type == lucIndexData) data_type++;
-      writeGeometryRecord(outdb, type, (lucGeometryDataType)data_type, obj->dbid, data[i], block, step, compressdata);
+      blocks.push_back(GeomBlock(type, (lucGeometryDataType)data_type, obj->dbid, data[i], block));
     }
   }
 }
 
-void Model::writeGeometryRecord(Database& outdb, lucGeometryType type, lucGeometryDataType dtype, unsigned int objid, GeomData* data, DataContainer* block, int step, bool compressdata)
+void Model::writeGeometryRecords(Database& outdb, std::vector<GeomBlock>& blocks, int step, bool compressdata)
 {
-  char SQL[SQL_QUERY_MAX];
-  sqlite3_stmt* statement;
-  unsigned char* buffer = (unsigned char*)block->ref(0);
-  unsigned long src_len = block->bytes();
-  // Compress the data if enabled and > 1kb
-  unsigned long cmp_len = 0;
-  if (compressdata &&  src_len > 1000)
-  {
-    cmp_len = compressBound(src_len);
-    buffer = (unsigned char*)malloc((size_t)cmp_len);
-    if (buffer == NULL)
-      abort_program("Compress database: out of memory!\n");
-    if (compress(buffer, &cmp_len, (const unsigned char *)block->ref(0), src_len) != Z_OK)
-      abort_program("Compress database buffer failed!\n");
-    if (cmp_len >= src_len)
+  // Compress the data if enabled and > 1kb, on worker threads before inserting
+  if (compressdata)
+  {
+    lucBlobCodec codec = lucCodecDeflate;
+    std::string name = drawstate.global("codec");
+    if (name == "none")
+      codec = lucCodecNone;
+    else if (name == "shuffle")
+      codec = lucCodecShuffleDeflate;
+    clock_t t1 = clock();
+    parallel_for(blocks.size(), [&](unsigned int i)
     {
-      free(buffer);
-      buffer = (unsigned char*)block->ref(0);
-      cmp_len = 0;
-    }
-    else
-      src_len = cmp_len;
+      blocks[i].pack(codec);
+    }, drawstate.global("threads"));
+    debug_print("%.4lf seconds to compress %d records\n", (clock()-t1)/(double)CLOCKS_PER_SEC, blocks.size());
+  }
+
+  for (unsigned int i=0; i < blocks.size(); i++)
+    writeGeometryRecord(outdb, blocks[i], step);
+}
+
+void Model::writeGeometryRecord(Database& outdb, GeomBlock& geom, int step)
+{
+  DataContainer* block = geom.block;
+  GeomData* data = geom.data;
+  const void* buffer = block->ref(0);
+  unsigned long src_len = block->bytes();
+  if (geom.compressed.size() > 0)
+  {
+    buffer = geom.compressed.data();
+    src_len = geom.compressed.size();
   }
 
   if (block->minimum == HUGE_VAL) block->minimum = 0;
@@ -1660,40 +2678,51 @@ void Model::writeGeometryRecord(Database& outdb, lucGeometryType type, lucGeomet
 
   }
 
-  snprintf(SQL, SQL_QUERY_MAX, "insert into geometry (object_id, timestep, rank, idx, type, data_type, size, count, width, minimum, maximum, dim_factor, units, minX, minY, minZ, maxX, maxY, maxZ, labels, data) values (%d, %d, %d, %d, %d, %d, %d, %d, %d, %g, %g, %g, '%s', %g, %g, %g, %g, %g, %g, ?, ?)", objid, step, data->height, data->depth, type, dtype, block->unitsize(), block->size(), data->width, block->minimum, block->maximum, 0.0, block->label.c_str(), min[0], min[1], min[2], max[0], max[1], max[2]);
-
-  /* Prepare statement... */
-  if (sqlite3_prepare_v2(outdb.db, SQL, -1, &statement, NULL) != SQLITE_OK)
-  {
-    abort_program("SQL prepare error: (%s) %s\n", SQL, sqlite3_errmsg(outdb.db));
-  }
+  //Bind values to cached insert statement
+  sqlite3_stmt* statement = outdb.insertGeometry();
+  int rc = SQLITE_OK;
+  int col = 1;
+  rc |= sqlite3_bind_int(statement, col++, geom.objid);
+  rc |= sqlite3_bind_int(statement, col++, step);
+  rc |= sqlite3_bind_int(statement, col++, data->height);
+  rc |= sqlite3_bind_int(statement, col++, data->depth);
+  rc |= sqlite3_bind_int(statement, col++, geom.type);
+  rc |= sqlite3_bind_int(statement, col++, geom.dtype);
+  rc |= sqlite3_bind_int(statement, col++, block->unitsize());
+  rc |= sqlite3_bind_int(statement, col++, block->size());
+  rc |= sqlite3_bind_int(statement, col++, data->width);
+  rc |= sqlite3_bind_double(statement, col++, block->minimum);
+  rc |= sqlite3_bind_double(statement, col++, block->maximum);
+  rc |= sqlite3_bind_double(statement, col++, 0.0);
+  rc |= sqlite3_bind_text(statement, col++, block->label.c_str(), block->label.length(), SQLITE_STATIC);
+  for (int c=0; c<3; c++)
+    rc |= sqlite3_bind_double(statement, col++, min[c]);
+  for (int c=0; c<3; c++)
+    rc |= sqlite3_bind_double(statement, col++, max[c]);
 
   /* Setup text data for insert (on vertex block only) */
-  std::string labels = data->getLabels().c_str();
-  if (dtype == lucVertexData && labels.length() > 0)
-  {
-    if (sqlite3_bind_text(statement, 1, labels.c_str(), labels.length(), SQLITE_STATIC) != SQLITE_OK)
-    //const char* clabels = labels.c_str();
-    //if (sqlite3_bind_text(statement, 1, clabels, strlen(clabels), SQLITE_STATIC) != SQLITE_OK)
-      abort_program("SQL bind error: %s\n", sqlite3_errmsg(outdb.db));
-  }
+  std::string labels = data->getLabels();
+  if (geom.dtype == lucVertexData && labels.length() > 0)
+    rc |= sqlite3_bind_text(statement, col, labels.c_str(), labels.length(), SQLITE_STATIC);
+  col++;
+  rc |= sqlite3_bind_int(statement, col++, geom.codec);
 
   /* Setup blob data for insert */
   debug_print("Writing %lu bytes\n", src_len);
-  if (sqlite3_bind_blob(statement, 2, buffer, src_len, SQLITE_STATIC) != SQLITE_OK)
+  rc |= sqlite3_bind_blob(statement, col++, buffer, src_len, SQLITE_STATIC);
+  if (rc != SQLITE_OK)
     abort_program("SQL bind error: %s\n", sqlite3_errmsg(outdb.db));
 
   /* Execute statement */
   if (sqlite3_step(statement) != SQLITE_DONE )
-    abort_program("SQL step error: (%s) %s\n", SQL, sqlite3_errmsg(outdb.db));
-
-  sqlite3_finalize(statement);
+    abort_program("SQL step error: %s\n", sqlite3_errmsg(outdb.db));
 
-  // Free compression buffer
-  if (cmp_len > 0) free(buffer);
+  //Release bound buffers
+  sqlite3_reset(statement);
+  sqlite3_clear_bindings(statement);
 
   //printf("WROTE ID %d STEP %d TYPE %d DTYPE %d DIMS (%d x %d x %d) COUNT %d LABELS %s\n", 
-  //       objid, step, type, dtype, data->width, data->height, data->depth, block->size(), labels.c_str());
+  //       geom.objid, step, geom.type, geom.dtype, data->width, data->height, data->depth, block->size(), labels.c_str());
 }
 
 void Model::deleteObject(unsigned int id)
@@ -1741,6 +2770,8 @@ void Model::jsonWrite(std::ostream& os, DrawingObject* o, bool objdata)
   //Write new JSON format objects
   // - globals are all stored on / sourced from drawstate.globals
   // - views[] list holds view properies (previously single instance in "options")
+  //Data and data labels exported must include values not yet loaded
+  loadDeferred(true);
   std::lock_guard<std::mutex> guard(drawstate.mutex);
   json exported;
   json properties = drawstate.globals;
@@ -62,6 +62,7 @@ protected:
   sqlite3 *db;
   FilePath file;
   bool memory;
+  sqlite3_stmt* insertgeom; //Cached geometry insert statement
 
 public:
 
@@ -69,16 +70,99 @@ public:
   Database(const FilePath& fn);
   ~Database();
 
+  //Owns the connection and cached statement, move only
+  Database(const Database&) = delete;
+  Database& operator=(const Database&) = delete;
+  Database(Database&& other);
+  Database& operator=(Database&& other);
+
   bool open(bool write=false);
   void reopen(bool write=false);
   void attach(TimeStep* timestep);
 
   sqlite3_stmt* select(const char* fmt, ...);
   bool issue(const char* fmt, ...);
+  sqlite3_stmt* selectGeometry(int obj_id, int time_start, int time_stop, int& datacol, const std::string& where="");
+  sqlite3_stmt* insertGeometry();
 
   operator bool() const { return db != NULL; }
 };
 
+//Geometry record read from database, detached from any connection or container
+class GeomRecord
+{
+public:
+  int object_id;
+  int timestep;
+  lucGeometryType type;
+  lucGeometryDataType data_type;
+  int width;
+  int height;
+  int depth;
+  int count;
+  int items;
+  bool bounds;
+  float min[3];
+  float max[3];
+  std::string label;  //Data label (from units field)
+  std::string labels; //Vertex labels, newline separated
+  int id;             //Database row id
+  bool element;       //Vertex data starts a new element
+  lucBlobCodec codec; //Blob compression
+  std::vector<unsigned char> data;  //Compressed data pending decompression
+  DataContainer* target;  //Pending decompression destination store
+  unsigned int offset;    //and position reserved in store
+  DataContainer* block;   //Loaded data, taken over by geometry store when applied
+
+  GeomRecord() : id(0), element(false), codec(lucCodecAuto), target(NULL), offset(0), block(NULL) {}
+  void read(sqlite3_stmt* statement, int datacol);
+  std::string valueLabel();
+  DataContainer* newBlock();
+  bool compressed(unsigned long bytes);
+  void decompress(const void* src, unsigned long src_len, unsigned char* dst);
+};
+
+//Geometry data block queued for writing to database
+class GeomBlock
+{
+public:
+  lucGeometryType type;
+  lucGeometryDataType dtype;
+  unsigned int objid;
+  GeomData* data;
+  DataContainer* block;
+  lucBlobCodec codec;
+  std::vector<unsigned char> compressed;  //Empty if not compressed
+
+  GeomBlock(lucGeometryType type, lucGeometryDataType dtype, unsigned int objid, GeomData* data, DataContainer* block)
+   : type(type), dtype(dtype), objid(objid), data(data), block(block), codec(lucCodecNone) {}
+  void pack(lucBlobCodec with);
+};
+
+//Timestep geometry loaded in the background
+class PrefetchStep
+{
+public:
+  int idx;
+  std::thread thread;
+  std::atomic<bool> cancel;
+  std::atomic<bool> done;
+  bool failed;
+  std::string objects;  //Object filter for geometry query
+  std::vector<GeomRecord*> records;
+
+  PrefetchStep(int idx) : idx(idx), cancel(false), done(false), failed(false) {}
+  ~PrefetchStep()
+  {
+    if (thread.joinable()) thread.join();
+    for (unsigned int i=0; i < records.size(); i++)
+    {
+      if (records[i]->block) delete records[i]->block;
+      delete records[i];
+    }
+  }
+};
+
 class Model
 {
 private:
@@ -154,13 +238,65 @@ public:
   //Timestep caching
   void cacheLoad();
 private:
+  std::deque<int> cached;  //Cached step indices, least recently used first
   bool useCache();
   void cacheStep();
   bool restoreStep();
-  void clearStep();
+  void clearStep(int idx=-1);
+  void touchCache(int idx);
+  void trimCache();
+  void evictStep(int idx);
   void printCache();
 
+  //Cached steps still holding graphics memory (gpucache), least recently used first
+  struct GPUStep
+  {
+    int idx;
+    size_t bytes;          //Graphics memory held by the step's containers
+    unsigned int reloads;  //Data reload count when cached, buffers reloaded on restore if changed
+  };
+  std::deque<GPUStep> gpucached;
+  unsigned int reloads;
+  void trimGPUCache();
+  void releaseStep(int idx);
+
+  //Background timestep loading
+  std::map<int, PrefetchStep*> prefetched;
+  static void prefetchStep(PrefetchStep* pf, FilePath file, int step, std::string path);
+  static void readRecords(Database& db, PrefetchStep* pf, int obj_id, int time_start, int time_stop, bool recurseTracers);
+  bool restorePrefetch();
+
+  //Binary geometry cache files
+  std::string cacheFile(int idx, bool check=true);
+  bool loadCacheFile();
+  static bool writeCacheFile(const std::string& path, int step, std::vector<GeomRecord*>& records);
+  DataContainer* loadRecord(Geometry* active, DrawingObject* obj, GeomRecord& rec, const void* data);
+  unsigned long decompressRecords(std::vector<std::unique_ptr<GeomRecord> >& pending);
+
+  //Selective loading
+  bool deferred;  //Value arrays have been left unloaded
+  std::string objectFilter();
+  bool valuesRequired(GeomData* g, const std::string& label);
+  bool deferValues(Geometry* active, DrawingObject* obj, GeomRecord& rec);
+  bool loadValues(Geometry* active, GeomData* g, bool all=false);
+
 public:
+  unsigned int cacheHits;
+  unsigned int cacheMisses;
+  unsigned int cacheEvictions;
+  unsigned int cachedSteps() {return cached.size();}
+  unsigned int gpuEvictions;
+  unsigned int gpuCachedSteps() {return gpucached.size();}
+  size_t gpuCacheBytes();
+
+  unsigned int prefetchHits;
+  unsigned int prefetchWaits;
+  unsigned int prefetchMisses;
+  void prefetch();
+  void clearPrefetch(int keep_start=-1, int keep_end=-1);
+  int writeCache();
+  void loadDeferred(bool all=false, DrawingObject* target=NULL);
+
   int step()
   {
     //Current actual step
@@ -196,7 +332,9 @@ public:
   void writeObjects(Database& outdb, DrawingObject* obj, int step, bool compress);
   void deleteGeometry(Database& outdb, lucGeometryType type, DrawingObject* obj, int step);
   void writeGeometry(Database& outdb, lucGeometryType type, DrawingObject* obj, int step, bool compress);
-  void writeGeometryRecord(Database& outdb, lucGeometryType type, lucGeometryDataType dtype, unsigned int objid, GeomData* data, DataContainer* block, int step, bool compressdata);
+  void queueGeometry(lucGeometryType type, DrawingObject* obj, std::vector<GeomBlock>& blocks);
+  void writeGeometryRecords(Database& outdb, std::vector<GeomBlock>& blocks, int step, bool compressdata);
+  void writeGeometryRecord(Database& outdb, GeomBlock& geom, int step);
   void deleteObject(unsigned int id);
   void backup(Database& fromdb, Database& todb);
   void objectBounds(DrawingObject* draw, float* min, float* max);
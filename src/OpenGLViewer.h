@@ -107,7 +107,7 @@ public:
   bool visible;
   bool stereo;
   bool fullscreen;
-  bool postdisplay; //Flag to request a frame when animating
+  std::atomic<bool> postdisplay; //Flag to request a frame when animating, may be set from other threads
   bool quitProgram;
   bool isopen;   //Set when window is first opened
 
@@ -169,6 +169,7 @@ public:
   void idleReset();
   void idleTimer(int display=TIMER_IDLE);
   unsigned int getIdleTime() {return idle;}
+  int getIdleDisplay() {return displayidle;}
 
   void addOutput(OutputInterface* output)
   {
@@ -36,13 +36,22 @@
 #include "GraphicsUtil.h"
 #include "Geometry.h"
 
+//Points packed into the vbo per parallel task
+#define POINT_BLOCK (1u << 16)
+
 Points::Points(DrawState& drawstate) : Geometry(drawstate)
 {
   type = lucPointType;
-  pidx = swap = NULL;
+  partial = true;
   idxcount = 0;
-  indexvbo = 0;
+  indexvbo = backvbo = 0;
   vbo = 0;
+  lodscale = 1.0;
+  lodspacing = 0.0;
+  lodreduced = false;
+  memset(lodview, 0, sizeof(lodview));
+  //Background sort finished, draw with the new order
+  sorter.completed = [this]() {if (this->drawstate.redisplay) this->drawstate.redisplay();};
 }
 
 Points::~Points()
@@ -52,30 +61,39 @@ Points::~Points()
 
 void Points::close()
 {
-  if (!drawstate.global("gpucache"))
-  {
-    if (vbo)
-      glDeleteBuffers(1, &vbo);
-    if (indexvbo)
-      glDeleteBuffers(1, &indexvbo);
-    vbo = 0;
-    indexvbo = 0;
-
-    reload = true;
-  }
+  if (vbo)
+    glDeleteBuffers(1, &vbo);
+  if (indexvbo)
+    glDeleteBuffers(1, &indexvbo);
+  if (backvbo)
+    glDeleteBuffers(1, &backvbo);
+  vbo = 0;
+  indexvbo = backvbo = 0;
+
+  reload = true;
+
+  pidx.clear();
+  sorter.clear();
+  brickidx.clear();
+  brickstart.clear();
+  brickbox.clear();
+  brickview.clear();
+  brickculled.clear();
+  bricksorter.clear();
+  pointlevel.clear();
+  bricklevels.clear();
+}
 
-  if (pidx)
-    delete[] pidx;
-  if (swap)
-    delete[] swap;
-  pidx = swap = NULL;
+size_t Points::gpuMemory()
+{
+  return bufferSize(vbo) + bufferSize(indexvbo) + bufferSize(backvbo);
 }
 
 void Points::update()
 {
   //Ensure vbo recreated if total changed
   //To force update, set geometry->reload = true
-  if (reload || vbo == 0)
+  if (reload || vbo == 0 || !updateVertices())
     loadVertices();
 
   //Initial depth sort & render
@@ -129,59 +147,131 @@ void Points::loadVertices()
   t1 = clock();
   //debug_print("Reloading %d particles...(size %f)\n", total);
 
-  //Get eye distances and copy all particles into sorting array
-  for (unsigned int s = 0; s < geom.size(); s++)
+  //Copy all particles into the vbo
+  if (ptr)
   {
-    debug_print("Swarm %d, points %d hidden? %s\n", s, geom[s]->count, (hidden[s] ? "yes" : "no"));
+    std::vector<unsigned int> objects(geom.size());
+    std::vector<unsigned char*> ptrs(geom.size());
+    unsigned int offset = 0;
+    for (unsigned int s = 0; s < geom.size(); offset += geom[s]->count, s++)
+    {
+      debug_print("Swarm %d, points %d hidden? %s\n", s, geom[s]->count, (hidden[s] ? "yes" : "no"));
+      objects[s] = s;
+      ptrs[s] = ptr + offset * datasize;
+    }
+    packVertices(objects, ptrs);
+    uploaded();
+  }
+
+  t2 = clock();
+  debug_print("  %.4lf seconds to update %d particles into vbo\n", total, (t2-t1)/(double)CLOCKS_PER_SEC);
+  t1 = clock();
 
+  if (ptr) glUnmapBuffer(GL_ARRAY_BUFFER);
+  GL_Error_Check;
+}
+
+void Points::packVertices(const std::vector<unsigned int>& objects, const std::vector<unsigned char*>& ptrs)
+{
+  //Copy particles of listed objects into vbo data at given pointers, in blocks packed in parallel,
+  //each block resolves its colours in one batch then interleaves attributes
+  struct Block {unsigned int s, start, count; unsigned char* ptr;};
+  std::vector<Block> blocks;
+  std::vector<float> psize0(geom.size()), ptype(geom.size());
+  std::vector<FloatValues*> sizes(geom.size());
+  bool attribs = drawstate.global("pointattribs");
+  int datasize = sizeof(float) * 3 + sizeof(Colour);
+  if (attribs) datasize += sizeof(float) * 2;
+  for (unsigned int o = 0; o < objects.size(); o++)
+  {
+    unsigned int s = objects[o];
     //Calibrate colourMap
     geom[s]->colourCalibrate();
 
     Properties& props = geom[s]->draw->properties;
-    float psize0 = props["pointsize"];
     float scaling = props["scaling"];
-    //printf("psize %f scaling %f\n", psize0, scaling);
-    psize0 *= scaling;
-    float ptype = getPointType(s); //Default (-1) is to use the global (uniform) value
-    bool attribs = drawstate.global("pointattribs");
+    psize0[s] = props["pointsize"];
+    psize0[s] *= scaling;
+    ptype[s] = getPointType(s); //Default (-1) is to use the global (uniform) value
     unsigned int sizeidx = geom[s]->valuesLookup(geom[s]->draw->properties["sizeby"]);
-    bool usesize = geom[s]->valueData(sizeidx) != NULL;
-    //std::cout << geom[s]->draw->properties["sizeby"] << " : " << sizeidx << " : " << usesize << std::endl;
-    Colour c;
+    sizes[s] = geom[s]->valueData(sizeidx);
 
-    for (unsigned int i = 0; i < geom[s]->count; i ++)
+    for (unsigned int i = 0; i < geom[s]->count; i += POINT_BLOCK)
+    {
+      Block b = {s, i, min(POINT_BLOCK, geom[s]->count - i), ptrs[o] + i * datasize};
+      blocks.push_back(b);
+    }
+  }
+
+  parallel_for(blocks.size(), [&](unsigned int n)
+  {
+    Block& b = blocks[n];
+    GeomData* g = geom[b.s];
+    std::vector<Colour> colours(b.count);
+    g->getColours(colours.data(), b.start, b.count);
+    unsigned char* out = b.ptr;
+    for (unsigned int j = 0; j < b.count; j++)
     {
-      //Copy data to VBO entry
-      if (ptr)
+      unsigned int i = b.start + j;
+      //Copies vertex bytes
+      memcpy(out, g->vertices[i], sizeof(float) * 3);
+      out += sizeof(float) * 3;
+      memcpy(out, &colours[j], sizeof(Colour));
+      out += sizeof(Colour);
+      //Optional per-object size/type
+      if (attribs)
       {
-        assert((unsigned int)(ptr-p) < total * datasize);
-        //Copies vertex bytes
-        memcpy(ptr, geom[s]->vertices[i], sizeof(float) * 3);
-        ptr += sizeof(float) * 3;
-        geom[s]->getColour(c, i);
-        memcpy(ptr, &c, sizeof(Colour));
-        ptr += sizeof(Colour);
-        //Optional per-object size/type
-        if (attribs)
-        {
-          //Copies settings (size + smooth)
-          float psize = psize0;
-          if (usesize) psize *= geom[s]->valueData(sizeidx, i);
-          memcpy(ptr, &psize, sizeof(float));
-          ptr += sizeof(float);
-          memcpy(ptr, &ptype, sizeof(float));
-          ptr += sizeof(float);
-        }
+        //Copies settings (size + smooth)
+        float psize = psize0[b.s];
+        if (sizes[b.s]) psize *= (*sizes[b.s])[i];
+        memcpy(out, &psize, sizeof(float));
+        out += sizeof(float);
+        memcpy(out, &ptype[b.s], sizeof(float));
+        out += sizeof(float);
       }
     }
+  }, drawstate.global("threads"));
 
-  }
-  t2 = clock();
-  debug_print("  %.4lf seconds to update %d particles into vbo\n", total, (t2-t1)/(double)CLOCKS_PER_SEC);
-  t1 = clock();
+}
 
-  if (ptr) glUnmapBuffer(GL_ARRAY_BUFFER);
+bool Points::updateVertices()
+{
+  //Upload vbo ranges of changed objects only,
+  //returns false if object vertex counts have changed and a full reload is required
+  std::vector<unsigned int> objects;
+  if (!vbo || !dirtyObjects(objects)) return false;
+  if (objects.size() == 0) return true;
+  clock_t t1 = clock();
+
+  int datasize = sizeof(float) * 3 + sizeof(Colour);
+  if (drawstate.global("pointattribs"))
+    datasize += sizeof(float) * 2;
+  std::vector<unsigned int> offsets(geom.size());
+  for (unsigned int s = 1; s < geom.size(); s++)
+    offsets[s] = offsets[s-1] + geom[s-1]->count;
+  unsigned int count = 0;
+  for (unsigned int o = 0; o < objects.size(); o++)
+    count += geom[objects[o]]->count;
+
+  //Pack into staging buffer then upload each object range
+  std::vector<unsigned char> staging(count * datasize);
+  std::vector<unsigned char*> ptrs(objects.size());
+  ptrs[0] = staging.data();
+  for (unsigned int o = 1; o < objects.size(); o++)
+    ptrs[o] = ptrs[o-1] + geom[objects[o-1]]->count * datasize;
+  packVertices(objects, ptrs);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  for (unsigned int o = 0; o < objects.size(); o++)
+  {
+    unsigned int s = objects[o];
+    glBufferSubData(GL_ARRAY_BUFFER, offsets[s] * datasize, geom[s]->count * datasize, ptrs[o]);
+    geom[s]->dirty = false;
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
   GL_Error_Check;
+  debug_print("  %.4lf seconds to update %d particles of %d objects into vbo\n", (clock()-t1)/(double)CLOCKS_PER_SEC, count, objects.size());
+  return true;
 }
 
 void Points::loadList()
@@ -191,23 +281,23 @@ void Points::loadList()
   t1 = clock();
 
   //Create sorting array
-  if (pidx) delete[] pidx;
-  pidx = new PIndex[total];
-  if (swap) delete[] swap;
-  swap = new PIndex[total];
-  if (pidx == NULL || swap == NULL) abort_program("Memory allocation error (failed to allocate %d bytes)", sizeof(PIndex) * total);
+  pidx.resize(total);
+  sorter.resize(total);
   if (geom.size() == 0) return;
   int offset = 0;
   unsigned int maxCount = drawstate.global("pointmaxcount");
   unsigned int subSample = drawstate.global("pointsubsample");
-  //Auto-sub-sample if maxcount set
+  //Auto-sub-sample if maxcount set, based on count of objects in view
+  elements = 0;
+  for (unsigned int s = 0; s < geom.size(); s++)
+    if (drawable(s) && !isCulled(s)) elements += geom[s]->count;
   if (maxCount > 0 && elements > maxCount)
     subSample = elements / maxCount + 0.5; //Rounded up
   elements = 0;
   uint32_t SEED;
   for (unsigned int s = 0; s < geom.size(); offset += geom[s]->count, s++)
   {
-    if (!drawable(s)) continue;
+    if (!drawable(s) || isCulled(s)) continue;
 
     //Calibrate colourMap - required to re-cache filter settings (TODO: split filter reload into another function?)
     geom[s]->colourCalibrate();
@@ -220,47 +310,318 @@ void Points::loadList()
       SEED = i; //Reset the seed for determinism based on index
       if (subSample > 1 && SHR3(SEED) % subSample > 0) continue;
 
-      pidx[elements].index = offset + i;
-      pidx[elements].vertex = geom[s]->vertices[i];
-      pidx[elements].distance = 0;
+      pidx[elements] = offset + i;
+      sorter.set(elements, geom[s]->vertices[i]);
       elements++;
     }
   }
+  pidx.resize(elements);
+  sorter.resize(elements);
   t2 = clock();
   debug_print("  %.4lf seconds to update %d/%d particles into sort array\n", (t2-t1)/(double)CLOCKS_PER_SEC, elements, total);
   t1 = clock();
+
+  //Spatial bricks for approximate sorting of large point sets
+  int res = drawstate.global("pointbricks");
+  brickidx.clear();
+  brickstart.clear();
+  brickbox.clear();
+  brickview.clear();
+  brickculled.clear();
+  bricksorter.clear();
+  pointlevel.clear();
+  bricklevels.clear();
+  if (res > 1 && elements > (unsigned int)res*res*res)
+  {
+    loadBricks(res);
+    t2 = clock();
+    debug_print("  %.4lf seconds to bin particles into %d bricks\n", (t2-t1)/(double)CLOCKS_PER_SEC, bricksorter.size());
+
+    //Level of detail hierarchy within bricks
+    if ((float)drawstate.global("pointlod") > 0)
+    {
+      t1 = clock();
+      loadLevels();
+      t2 = clock();
+      debug_print("  %.4lf seconds to build point detail levels\n", (t2-t1)/(double)CLOCKS_PER_SEC);
+    }
+  }
 }
 
-//Depth sort the particles before drawing, called whenever the viewing angle has changed
-void Points::depthSort()
+void Points::loadBricks(int res)
 {
-  clock_t t1,t2;
-  t1 = clock();
-  if (elements == 0) return;
+  //Bin the sort items into a res^3 grid of bricks over their bounding box,
+  //items are grouped by brick in brickidx, empty bricks are dropped
+  float min[3] = {HUGE_VALF, HUGE_VALF, HUGE_VALF};
+  float max[3] = {-HUGE_VALF, -HUGE_VALF, -HUGE_VALF};
+  float* pos[3] = {sorter.x.data(), sorter.y.data(), sorter.z.data()};
+  for (unsigned int i = 0; i < elements; i++)
+  {
+    for (int d=0; d<3; d++)
+    {
+      if (pos[d][i] < min[d]) min[d] = pos[d][i];
+      if (pos[d][i] > max[d]) max[d] = pos[d][i];
+    }
+  }
+  float scale[3];
+  for (int d=0; d<3; d++)
+    scale[d] = max[d] > min[d] ? res / (max[d] - min[d]) : 0;
+
+  unsigned int cells = res*res*res;
+  std::vector<GLuint> cellcount(cells);
+  std::vector<GLuint> brickof(elements);
+  for (unsigned int i = 0; i < elements; i++)
+  {
+    int c[3];
+    for (int d=0; d<3; d++)
+    {
+      c[d] = (pos[d][i] - min[d]) * scale[d];
+      if (c[d] >= res) c[d] = res-1;
+    }
+    brickof[i] = (c[2] * res + c[1]) * res + c[0];
+    cellcount[brickof[i]]++;
+  }
 
-  //Calculate min/max distances from view plane
-  float maxdist, mindist;
-  view->getMinMaxDistance(&mindist, &maxdist);
+  //Number the occupied cells
+  std::vector<GLuint> brick(cells);
+  unsigned int bricks = 0;
+  brickstart.push_back(0);
+  for (unsigned int c = 0; c < cells; c++)
+  {
+    if (cellcount[c] == 0) continue;
+    brick[c] = bricks++;
+    brickstart.push_back(brickstart.back() + cellcount[c]);
+  }
 
-  //Update eye distances, clamping distance to integer between 0 and USHRT_MAX
-  float multiplier = (float)USHRT_MAX / (maxdist - mindist);
-  float fdistance;
+  //Group items by brick, find brick centres (mean item position) and bounding boxes
+  std::vector<Vec3d> centres(bricks);
+  std::vector<GLuint> next(brickstart.begin(), brickstart.end()-1);
+  brickidx.resize(elements);
+  brickbox.resize(bricks * 6);
+  for (unsigned int b = 0; b < bricks; b++)
+  {
+    for (int d=0; d<3; d++)
+    {
+      brickbox[b*6+d] = HUGE_VALF;
+      brickbox[b*6+3+d] = -HUGE_VALF;
+    }
+  }
   for (unsigned int i = 0; i < elements; i++)
   {
-    //Distance from viewing plane is -eyeZ
-    fdistance = eyeDistance(view->modelView, pidx[i].vertex);
-    pidx[i].distance = (unsigned short)(multiplier * (fdistance - mindist));
+    GLuint b = brick[brickof[i]];
+    brickidx[next[b]++] = i;
+    centres[b] += Vec3d(pos[0][i], pos[1][i], pos[2][i]);
+    for (int d=0; d<3; d++)
+    {
+      if (pos[d][i] < brickbox[b*6+d]) brickbox[b*6+d] = pos[d][i];
+      if (pos[d][i] > brickbox[b*6+3+d]) brickbox[b*6+3+d] = pos[d][i];
+    }
   }
-  t2 = clock();
-  debug_print("  %.4lf seconds to calculate distances\n", (t2-t1)/(double)CLOCKS_PER_SEC);
+  bricksorter.resize(bricks);
+  for (unsigned int b = 0; b < bricks; b++)
+  {
+    centres[b] *= 1.0 / (brickstart[b+1] - brickstart[b]);
+    bricksorter.set(b, centres[b].ref());
+  }
+  //Items within each brick are sorted on first view
+  brickview.resize(bricks * 3);
+}
+
+void Points::loadLevels()
+{
+  //Assign each sort item a level of detail, level l holds the first item found in each
+  //cell of a 2^l grid over its brick that is not already in a coarser level,
+  //so levels 0 to l give an even spread of points at spacing (brick size / 2^l)
+  pointlevel.resize(elements);
+  bricklevels.resize(bricksorter.size());
+  float* pos[3] = {sorter.x.data(), sorter.y.data(), sorter.z.data()};
+  parallel_for(bricksorter.size(), [&](unsigned int b)
+  {
+    float* bmin = &brickbox[b*6];
+    float* bmax = &brickbox[b*6+3];
+    unsigned int count = brickstart[b+1] - brickstart[b];
+    //Items placed in coarser levels first, then those remaining
+    std::vector<GLuint> placed;
+    std::vector<GLuint> remaining(brickidx.begin() + brickstart[b], brickidx.begin() + brickstart[b+1]);
+    std::vector<bool> occupied;
+    unsigned char level = 0;
+    for (; remaining.size() > 0 && level < 15; level++)
+    {
+      //Stop when cells outnumber items, nearly all remaining would be placed alone
+      unsigned int res = 1 << level;
+      if ((unsigned long)res*res*res > 8 * (unsigned long)count) break;
+      occupied.assign(res*res*res, false);
+      float scale[3];
+      for (int d=0; d<3; d++)
+        scale[d] = bmax[d] > bmin[d] ? res / (bmax[d] - bmin[d]) : 0;
+      auto cell = [&](GLuint i)
+      {
+        unsigned int c[3];
+        for (int d=0; d<3; d++)
+        {
+          c[d] = (pos[d][i] - bmin[d]) * scale[d];
+          if (c[d] >= res) c[d] = res-1;
+        }
+        return (c[2] * res + c[1]) * res + c[0];
+      };
+      for (unsigned int r = 0; r < placed.size(); r++)
+        occupied[cell(placed[r])] = true;
+      unsigned int keep = 0;
+      for (unsigned int r = 0; r < remaining.size(); r++)
+      {
+        GLuint i = remaining[r];
+        unsigned int c = cell(i);
+        if (occupied[c])
+          remaining[keep++] = i;
+        else
+        {
+          occupied[c] = true;
+          pointlevel[i] = level;
+          placed.push_back(i);
+        }
+      }
+      remaining.resize(keep);
+    }
+    for (unsigned int r = 0; r < remaining.size(); r++)
+      pointlevel[remaining[r]] = level;
+    bricklevels[b] = remaining.size() ? level : level-1;
+  }, drawstate.global("threads"));
+}
+
+bool Points::lodActive()
+{
+  //Levels built, enabled and interactive
+  return pointlevel.size() == elements && elements > 0 && (float)drawstate.global("pointlod") > 0 && !drawstate.automate;
+}
+
+bool Points::lodChanged()
+{
+  //Level selection required when view, target spacing or refinement state has changed
+  float M[16];
+  glGetFloatv(GL_MODELVIEW_MATRIX, M);
+  if (memcmp(M, lodview, sizeof(M)) != 0)
+  {
+    //View moved, back to reduced detail until idle again
+    drawstate.fulldetail = false;
+    return true;
+  }
+  if (drawstate.fulldetail) return lodreduced;
+  return lodspacing != (float)drawstate.global("pointlod") * lodscale;
+}
+
+bool Points::sortBricks(const float* modelView, float resort, int threads)
+{
+  //Sort items within each visible brick whose view direction has rotated
+  //more than the resort angle since it was last sorted, returns true if any sorted
+  Vec3d dir(-modelView[2], -modelView[6], -modelView[10]);
+  dir.normalise();
+  float threshold = cos(DEG2RAD * resort);
+  std::vector<GLuint> stale;
+  for (unsigned int b = 0; b < bricksorter.size(); b++)
+  {
+    if (brickculled.size() > b && brickculled[b]) continue;
+    float* last = &brickview[b*3];
+    if (dir[0] * last[0] + dir[1] * last[1] + dir[2] * last[2] >= threshold) continue;
+    stale.push_back(b);
+    memcpy(last, dir.ref(), sizeof(float) * 3);
+  }
+  if (stale.size() == 0) return false;
+
+  //Nearest first within each brick, as for sorter order
+  float* pos[3] = {sorter.x.data(), sorter.y.data(), sorter.z.data()};
+  parallel_for(stale.size(), [&](unsigned int s)
+  {
+    GLuint b = stale[s];
+    std::vector<std::pair<float, GLuint> > items;
+    items.reserve(brickstart[b+1] - brickstart[b]);
+    for (unsigned int j = brickstart[b]; j < brickstart[b+1]; j++)
+    {
+      GLuint i = brickidx[j];
+      items.push_back(std::make_pair(dir[0] * pos[0][i] + dir[1] * pos[1][i] + dir[2] * pos[2][i], i));
+    }
+    std::sort(items.begin(), items.end());
+    for (unsigned int j = 0; j < items.size(); j++)
+      brickidx[brickstart[b] + j] = items[j].second;
+  }, threads);
+  debug_print("  Sorted items in %d of %d bricks\n", stale.size(), bricksorter.size());
+  return true;
+}
+
+bool Points::cullBricks()
+{
+  //Flag bricks outside the view frustum (saved by cull()),
+  //returns true if any have moved in or out of view since the last call
+  bool enabled = drawstate.global("culling");
+  bool changed = brickculled.size() != bricksorter.size();
+  brickculled.resize(bricksorter.size());
+  for (unsigned int b = 0; b < bricksorter.size(); b++)
+  {
+    bool outside = enabled && !view->boxVisible(&brickbox[b*6], &brickbox[b*6+3]);
+    if (outside != brickculled[b]) changed = true;
+    brickculled[b] = outside;
+  }
+  return changed;
+}
+
+//Depth sort the particles before drawing, called whenever the viewing angle has changed
+//Returns false if the previous order was kept
+bool Points::depthSort()
+{
+  clock_t t1,t2;
   t1 = clock();
+  if (elements == 0) return true;
+
+  bool sorted = false;
+  bool background = backgroundSort();
+  if (view->sort && bricksorter.size() > 0)
+  {
+    //Sort bricks by centre, items within bricks keep their cached order,
+    //re-sorted for visible bricks after larger rotations
+    float maxdist, mindist;
+    view->getMinMaxDistance(&mindist, &maxdist);
+    int threads = drawstate.global("threads");
+    if (bricksorter.update(view->modelView, mindist, maxdist, drawstate.global("sortskip"), threads))
+      sorted = true;
+    if (sortBricks(view->modelView, drawstate.global("pointbrickresort"), threads))
+      sorted = true;
+    background = false;
+  }
+  else if (view->sort)
+  {
+    //Calculate min/max distances from view plane
+    float maxdist, mindist;
+    view->getMinMaxDistance(&mindist, &maxdist);
+
+    //Update eye distances, quantised to integer keys and sort,
+    //reusing the previous order for small changes in view direction
+    int threads = drawstate.global("threads");
+    if (background)
+      sorter.request(view->modelView, mindist, maxdist, drawstate.global("sortskip"), threads);
+    else
+    {
+      sorter.wait();
+      sorted = sorter.update(view->modelView, mindist, maxdist, drawstate.global("sortskip"), threads);
+    }
+  }
 
-  //Depth sort using 2-byte key radix sort, 10 times faster than equivalent quicksort
-  radix_sort<PIndex>(pidx, swap, elements, 2);
+  if (background)
+  {
+    //Drawing continues with the previous order until the background sort completes
+    if (idxcount == 0)
+    {
+      //No previous order to draw, wait for the first
+      sorter.wait();
+      sorted = true;
+    }
+    else
+      sorted = sorter.collect();
+  }
   t2 = clock();
+  if (!sorted) debug_print("  Sort skipped or not yet completed, previous order kept\n");
   debug_print("  %.4lf seconds to sort %d points\n", (t2-t1)/(double)CLOCKS_PER_SEC, elements);
   t1 = clock();
   GL_Error_Check;
+  return sorted;
 }
 
 //Reloads points into display list or VBO, required after data update and depth sort
@@ -268,14 +629,15 @@ void Points::render()
 {
   clock_t t1,t2,tt;
   if (total == 0 || elements == 0) return;
-  assert(pidx);
+  assert(pidx.size() == elements);
 
   //First, depth sort the particles
   //if (view->is3d && view->sort)
-  if (view->sort)
+  if (view->sort || sorter.busy())
   {
     debug_print("Depth sorting %d of %d particles...\n", elements, total);
-    depthSort();
+    //Index buffer is still valid if order unchanged
+    if (!depthSort() && idxcount > 0) return;
   }
 
   tt = t1 = clock();
@@ -284,6 +646,14 @@ void Points::render()
   if (!indexvbo)
     glGenBuffers(1, &indexvbo);
 
+  //Sorting in background, upload to the previous buffer, then draw from it
+  if (backgroundSort())
+  {
+    if (!backvbo)
+      glGenBuffers(1, &backvbo);
+    std::swap(indexvbo, backvbo);
+  }
+
   //Always set data size again in case changed
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexvbo);
   GL_Error_Check;
@@ -306,17 +676,69 @@ void Points::render()
   int distSample = drawstate.global("pointdistsample");
   uint32_t SEED;
   idxcount = 0;
-  for(int i=elements-1; i>=0; i--)
+  lodreduced = false;
+  auto emit = [&](GLuint index, float depth)
   {
     //Distance based sub-sampling
     if (distSample > 0)
     {
-      SEED = pidx[i].index; //Reset the seed for determinism based on index
-      int subSample = 1 + distSample * pidx[i].distance / USHRT_MAX; //[1,distSample]
-      if (subSample > 1 && SHR3(SEED) % subSample > 0) continue;
+      SEED = index; //Reset the seed for determinism based on index
+      int subSample = 1 + distSample * depth; //[1,distSample]
+      if (subSample > 1 && SHR3(SEED) % subSample > 0) return;
     }
-    ptr[idxcount] = pidx[i].index;
+    ptr[idxcount] = index;
     idxcount++;
+  };
+  if (bricksorter.size() > 0)
+  {
+    //Level of detail, screen size in pixels of unit length at unit distance
+    bool lod = lodActive() && !drawstate.fulldetail;
+    float pixels = 0.5 * view->height / tan(0.5 * DEG2RAD * view->fov);
+    if (lodActive())
+    {
+      glGetFloatv(GL_MODELVIEW_MATRIX, lodview);
+      lodspacing = (float)drawstate.global("pointlod") * lodscale;
+    }
+    const float* M = lodview;
+
+    //Bricks farthest to nearest, items within each brick in cached order
+    std::vector<SortKey>& order = bricksorter.order();
+    for(int b=bricksorter.size()-1; b>=0; b--)
+    {
+      GLuint brick = order[b].index;
+      if (brickculled.size() > brick && brickculled[brick]) continue;
+      float depth = order[b].key / (float)bricksorter.maxKey();
+      if (lod)
+      {
+        //Coarsest level with projected point spacing within target
+        float* bmin = &brickbox[brick*6];
+        float* bmax = &brickbox[brick*6+3];
+        float d[3] = {bmax[0] - bmin[0], bmax[1] - bmin[1], bmax[2] - bmin[2]};
+        float c[3] = {0.5f*(bmax[0] + bmin[0]), 0.5f*(bmax[1] + bmin[1]), 0.5f*(bmax[2] + bmin[2])};
+        Vec3d size(M[0]*d[0] + M[4]*d[1] + M[8]*d[2], M[1]*d[0] + M[5]*d[1] + M[9]*d[2], M[2]*d[0] + M[6]*d[1] + M[10]*d[2]);
+        float dist = -(M[2]*c[0] + M[6]*c[1] + M[10]*c[2] + M[14]) - 0.5 * size.magnitude();
+        int level = bricklevels[brick];
+        if (dist > 0)
+          level = ceil(log2(size.magnitude() / dist * pixels / lodspacing));
+        if (level < 0) level = 0;
+        if (level < bricklevels[brick])
+        {
+          lodreduced = true;
+          for (int j=brickstart[brick+1]-1; j>=(int)brickstart[brick]; j--)
+            if (pointlevel[brickidx[j]] <= level)
+              emit(pidx[brickidx[j]], depth);
+          continue;
+        }
+      }
+      for (int j=brickstart[brick+1]-1; j>=(int)brickstart[brick]; j--)
+        emit(pidx[brickidx[j]], depth);
+    }
+  }
+  else
+  {
+    std::vector<SortKey>& order = sorter.order();
+    for(int i=elements-1; i>=0; i--)
+      emit(pidx[order[i].index], order[i].key / (float)sorter.maxKey());
   }
 
   glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
@@ -366,6 +788,19 @@ int Points::getPointType(int index)
 
 void Points::draw()
 {
+  //Reload the sort list if objects have moved in or out of view,
+  //re-upload indices if bricks have
+  if (cull())
+  {
+    loadList();
+    idxcount = 0;
+  }
+  if (bricksorter.size() > 0 && cullBricks())
+    idxcount = 0;
+  //Re-select detail levels
+  if (lodActive() && lodChanged())
+    idxcount = 0;
+
   if (elements == 0) return;
   clock_t t0 = clock();
   double time;
@@ -376,7 +811,7 @@ void Points::draw()
 
   //Re-render the particles if view has rotated
   //if (view->sort || idxcount != elements) render();
-  if (view->sort || idxcount == 0) render();
+  if (view->sort || idxcount == 0 || sorter.busy()) render();
   //After render(), elements holds unfiltered count, idxcount is filtered
   //idxcount = idxcount;
 
@@ -473,6 +908,17 @@ void Points::draw()
     debug_print("%.4lf seconds to draw points\n", time);
   GL_Error_Check;
 
+  //Adjust detail level spacing towards frame time budget
+  float budget = drawstate.global("pointlodbudget");
+  if (budget > 0 && lodActive() && !drawstate.fulldetail)
+  {
+    if (time * 1000.0 > budget && lodscale < 64.0)
+      lodscale *= 1.25;
+    else if (time * 1000.0 < 0.5 * budget && lodscale > 1.0)
+      lodscale = max(1.0, lodscale / 1.25);
+  }
+  if (lodreduced) drawstate.reduced = true;
+
   labels();
 }
 
@@ -111,6 +111,8 @@ void QuadSurfaces::update()
     //Send the data to the GPU via VBO
     loadBuffers();
   }
+  else if (!updateBuffers())
+    loadBuffers();
 }
 
 void QuadSurfaces::render()
@@ -42,18 +42,19 @@ Shapes::Shapes(DrawState& drawstate) : Glyphs(drawstate)
 
 void Shapes::update()
 {
-  //Convert shapes to triangles
+  //Convert shapes to triangles, or template mesh instances when supported
   tris->clear();
+  instances->reset();
+  bool instanced = !tessellate && Instances::supported(drawstate);
   Vec3d scale(view->scale);
   tris->unscale = view->scale[0] != 1.0 || view->scale[1] != 1.0 || view->scale[2] != 1.0;
   tris->iscale = Vec3d(1.0/view->scale[0], 1.0/view->scale[1], 1.0/view->scale[2]);
+  instances->unscale = tris->unscale;
+  instances->iscale = tris->iscale;
   for (unsigned int i=0; i<geom.size(); i++)
   {
     Properties& props = geom[i]->draw->properties;
 
-    //Create a new data store for output geometry
-    tris->add(geom[i]->draw);
-
     float scaling = props["scaling"];
 
     //Load constant scaling factors from properties
@@ -71,73 +72,99 @@ void Shapes::update()
       dims[0] = dims[1] = dims[2] = (float)props["pointsize"] / 8.0;
       quality = 4 * props.getInt("glyphs", 4);
     }
+    //Segment count must be valid before generate caches the shared circle coords,
+    //drawEllipsoid on worker threads would otherwise recache them for its own count
+    quality = abs(quality);
+    if (quality < 4) quality = 4;
 
     if (scaling <= 0) scaling = 1.0;
 
-    Colour colour;
+    //Create a new data store for output geometry
+    if (instanced)
+      instances->add(geom[i]->draw, shape == 1 ? GLYPH_CUBE : GLYPH_SPHERE, quality);
+    else
+      tris->add(geom[i]->draw);
+
     geom[i]->colourCalibrate();
 
     unsigned int idxW = geom[i]->valuesLookup(geom[i]->draw->properties["widthby"]);
     unsigned int idxH = geom[i]->valuesLookup(geom[i]->draw->properties["heightby"]);
     unsigned int idxL = geom[i]->valuesLookup(geom[i]->draw->properties["lengthby"]);
+    float scaleshapes = props["scaleshapes"];
+    bool visible = drawable(i);
 
-    for (unsigned int v=0; v < geom[i]->count; v++)
+    //Shapes for a range of elements, called on worker threads
+    GlyphGenerator shapes = [&](Geometry* tris, Geometry* lines, Instances* instances, DrawingObject* draw, unsigned int start, unsigned int end)
     {
-      if (!drawable(i) || geom[i]->filter(v)) continue;
-      //Scale the dimensions by variables (dynamic range options? by setting max/min?)
-      Vec3d sdims = Vec3d(dims[0], dims[1], dims[2]);
-      if (geom[i]->valueData(idxW)) sdims[0] = geom[i]->valueData(idxW, v);
-      if (geom[i]->valueData(idxH)) sdims[1] = geom[i]->valueData(idxH, v);
-      else sdims[1] = sdims[0];
-      if (geom[i]->valueData(idxL)) sdims[2] = geom[i]->valueData(idxL, v);
-      else sdims[2] = sdims[1];
-
-      //Multiply by constant scaling factors if present
-      for (int c=0; c<3; c++)
+      Colour colour;
+      for (unsigned int v=start; v < end; v++)
       {
-        if (dims[c] != FLT_MIN) sdims[c] *= dims[c];
-        //Apply scaling, also inverse of model scaling to avoid distorting glyphs
-        sdims[c] *= scaling * (float)props["scaleshapes"] * tris->iscale[c];
-      }
+        if (!visible || geom[i]->filter(v)) continue;
+        //Scale the dimensions by variables (dynamic range options? by setting max/min?)
+        Vec3d sdims = Vec3d(dims[0], dims[1], dims[2]);
+        if (geom[i]->valueData(idxW)) sdims[0] = geom[i]->valueData(idxW, v);
+        if (geom[i]->valueData(idxH)) sdims[1] = geom[i]->valueData(idxH, v);
+        else sdims[1] = sdims[0];
+        if (geom[i]->valueData(idxL)) sdims[2] = geom[i]->valueData(idxL, v);
+        else sdims[2] = sdims[1];
+
+        //Multiply by constant scaling factors if present
+        for (int c=0; c<3; c++)
+        {
+          if (dims[c] != FLT_MIN) sdims[c] *= dims[c];
+          //Apply scaling, also inverse of model scaling to avoid distorting glyphs
+          sdims[c] *= scaling * scaleshapes * tris->iscale[c];
+        }
 
-      //Setup orientation using alignment vector
-      Quaternion rot;
-      if (geom[i]->vectors.size() > 0)
-      {
-        Vec3d vec(geom[i]->vectors[v]);
-        //vec *= Vec3d(view->scale); //Scale
-
-        // Rotate to orient the shape
-        //...Want to align our z-axis to point along arrow vector:
-        // axis of rotation = (z x vec)
-        // cosine of angle between vector and z-axis = (z . vec) / |z|.|vec| *
-        Vec3d rvector(vec);
-        rvector.normalise();
-        float rangle = RAD2DEG * rvector.angle(Vec3d(0.0, 0.0, 1.0));
-        //Axis of rotation = vec x [0,0,1] = -vec[1],vec[0],0
-        if (rangle == 180.0)
+        //Setup orientation using alignment vector
+        Quaternion rot;
+        if (geom[i]->vectors.size() > 0)
         {
-          rot.y = 1;
-          rot.w = 0.0;
+          Vec3d vec(geom[i]->vectors[v]);
+          //vec *= Vec3d(view->scale); //Scale
+
+          // Rotate to orient the shape
+          //...Want to align our z-axis to point along arrow vector:
+          // axis of rotation = (z x vec)
+          // cosine of angle between vector and z-axis = (z . vec) / |z|.|vec| *
+          Vec3d rvector(vec);
+          rvector.normalise();
+          float rangle = RAD2DEG * rvector.angle(Vec3d(0.0, 0.0, 1.0));
+          //Axis of rotation = vec x [0,0,1] = -vec[1],vec[0],0
+          if (rangle == 180.0)
+          {
+            rot.y = 1;
+            rot.w = 0.0;
+          }
+          else if (rangle > 0.0)
+          {
+            rot.fromAxisAngle(Vec3d(-rvector.y, rvector.x, 0), rangle);
+          }
+          //std::cout << vec << " ==> " << rot << std::endl;
         }
-        else if (rangle > 0.0)
+
+        //Create shape
+        Vec3d pos = Vec3d(geom[i]->vertices[v]);
+        geom[i]->getColour(colour, v);
+        if (instanced)
         {
-          rot.fromAxisAngle(Vec3d(-rvector.y, rvector.x, 0), rangle);
+          if (shape != 1)
+            sdims = Vec3d(fabs(sdims[0]), fabs(sdims[1]), fabs(sdims[2]));
+          float dims4[4] = {sdims[0], sdims[1], sdims[2], 0};
+          instances->push(pos, rot, dims4, colour);
+          continue;
         }
-        //std::cout << vec << " ==> " << rot << std::endl;
-      }
+        if (shape == 1)
+          tris->drawCuboidAt(draw, pos, sdims, rot);
+        else
+          tris->drawEllipsoid(draw, pos, sdims, rot, quality);
 
-      //Create shape
-      Vec3d pos = Vec3d(geom[i]->vertices[v]);
-      if (shape == 1)
-        tris->drawCuboidAt(geom[i]->draw, pos, sdims, rot);
-      else
-        tris->drawEllipsoid(geom[i]->draw, pos, sdims, rot, quality);
+        //Per shape colours (can do this as long as sub-renderer always outputs same tri count per shape)
+        tris->read(draw, 1, lucRGBAData, &colour.value);
+      }
+    };
 
-      //Per shape colours (can do this as long as sub-renderer always outputs same tri count per shape)
-      geom[i]->getColour(colour, v);
-      tris->read(geom[i]->draw, 1, lucRGBAData, &colour.value);
-    }
+    generate(geom[i]->draw, geom[i]->count, shape == 1 || instanced ? 0 : quality, shapes);
 
     //Adjust bounding box
     //tris->compareMinMax(geom[i]->min, geom[i]->max);
@@ -41,6 +41,43 @@ Tracers::Tracers(DrawState& drawstate) : Glyphs(drawstate)
   type = lucTracerType;
 }
 
+Tracers::~Tracers()
+{
+  close();
+}
+
+void Tracers::close()
+{
+  for (auto it = trails.begin(); it != trails.end(); ++it)
+  {
+    glDeleteBuffers(1, &it->second.vbo);
+    glDeleteBuffers(1, &it->second.ibo);
+  }
+  trails.clear();
+  Glyphs::close();
+}
+
+void Tracers::remove(DrawingObject* draw)
+{
+  //Trail buffers belong to the object, release them with it
+  auto it = trails.find(draw);
+  if (it != trails.end())
+  {
+    glDeleteBuffers(1, &it->second.vbo);
+    glDeleteBuffers(1, &it->second.ibo);
+    trails.erase(it);
+  }
+  Glyphs::remove(draw);
+}
+
+size_t Tracers::gpuMemory()
+{
+  size_t bytes = Glyphs::gpuMemory();
+  for (auto it = trails.begin(); it != trails.end(); ++it)
+    bytes += bufferSize(it->second.vbo) + bufferSize(it->second.ibo);
+  return bytes;
+}
+
 void Tracers::update()
 {
   //Convert tracers to triangles/lines
@@ -52,6 +89,9 @@ void Tracers::update()
   Vec3d scale(view->scale);
   tris->unscale = view->scale[0] != 1.0 || view->scale[1] != 1.0 || view->scale[2] != 1.0;
   tris->iscale = Vec3d(1.0/view->scale[0], 1.0/view->scale[1], 1.0/view->scale[2]);
+  Shader* trailprog = drawstate.prog[lucTracerType];
+  for (auto it = trails.begin(); it != trails.end(); ++it)
+    it->second.active = false;
   for (unsigned int i=0; i<geom.size(); i++)
   {
     Properties& props = geom[i]->draw->properties;
@@ -105,90 +145,103 @@ void Tracers::update()
     float scaling = props["scaletracers"];
     factor *= scaling * drawstate.gap * 0.0005;
     float arrowSize = props["arrowhead"];
-    //Iterate individual tracers
-    float size;
-    for (unsigned int p=0; p < particles; p++)
+    bool flat = props["flat"] || quality < 1;
+    bool visible = drawable(i);
+
+    //Trails built on the GPU from a ring buffer of positions, tubes are tessellated if no shader support
+    if (props["trails"] && trailprog && trailprog->program)
     {
-      float* oldpos = NULL;
-      Colour colour, oldColour;
-      float radius, oldRadius = 0;
-      size = size0;
-      bool flat = props["flat"] || quality < 1;
-      //Loop through time steps
-      for (int step=start; step <= end; step++)
-      {
-        // Scale up line towards head of trajectory
-        if (taper && step > start) size += factor;
+      updateTrail(i, start, end, timecolour);
+      continue;
+    }
 
-        //Lookup by provided particle index?
-        int pidx = p;
-        if (geom[i]->indices.size() > 0)
+    //Iterate individual tracers, ranges of particles are generated on worker threads
+    GlyphGenerator trajectories = [&](Geometry* tris, Geometry* lines, Instances* instances, DrawingObject* draw, unsigned int pstart, unsigned int pend)
+    {
+      for (unsigned int p=pstart; p < pend; p++)
+      {
+        float* oldpos = NULL;
+        Colour colour, oldColour;
+        float radius, oldRadius = 0;
+        float size = size0;
+        //Loop through time steps
+        for (int step=start; step <= end; step++)
         {
-          for (unsigned int x=0; x<particles; x++)
+          // Scale up line towards head of trajectory
+          if (taper && step > start) size += factor;
+
+          //Lookup by provided particle index?
+          int pidx = p;
+          if (geom[i]->indices.size() > 0)
           {
-            if (geom[i]->indices[step * particles + x] == p)
+            for (unsigned int x=0; x<particles; x++)
             {
-              pidx = x;
-              break;
+              if (geom[i]->indices[step * particles + x] == p)
+              {
+                pidx = x;
+                break;
+              }
             }
           }
-        }
 
-        //TODO: test filtering
-        int pp = step * particles + pidx;
-        if (!drawable(i) || geom[i]->filter(pp)) continue;
+          //TODO: test filtering
+          int pp = step * particles + pidx;
+          if (!visible || geom[i]->filter(pp)) continue;
 
-        float* pos = geom[i]->vertices[pp];
-        //printf("p %d step %d POS = %f,%f,%f\n", p, step, pos[0], pos[1], pos[2]);
+          float* pos = geom[i]->vertices[pp];
+          //printf("p %d step %d POS = %f,%f,%f\n", p, step, pos[0], pos[1], pos[2]);
 
-        //Get colour either from supplied colour values or time step
-        if (timecolour)
-          colour = cmap->getfast(drawstate.timesteps[step]->time);
-        else
-          geom[i]->getColour(colour, pp);
+          //Get colour either from supplied colour values or time step
+          if (timecolour)
+            colour = cmap->getfast(drawstate.timesteps[step]->time);
+          else
+            geom[i]->getColour(colour, pp);
 
-        //Fade out
-        if (fade) colour.a = 255 * (step-start) / (float)(end-start);
+          //Fade out
+          if (fade) colour.a = 255 * (step-start) / (float)(end-start);
 
-        radius = scaling * size;
+          radius = scaling * size;
 
-        // Draw section
-        if (step > start)
-        {
-          if (flat)
+          // Draw section
+          if (step > start)
           {
-            lines->read(geom[i]->draw, 1, lucVertexData, oldpos);
-            lines->read(geom[i]->draw, 1, lucVertexData, pos);
-            lines->read(geom[i]->draw, 1, lucRGBAData, &oldColour);
-            lines->read(geom[i]->draw, 1, lucRGBAData, &colour);
-          }
-          else
-          {
-            //Coord scaling passed to drawTrajectory (as global scaling disabled to avoid distorting glyphs)
-            float arrowHead = -1;
-            if (step == end) arrowHead = arrowSize; //geom[i]->draw->properties["arrowhead"].ToFloat(2.0);
-            int diff = tris->getVertexIdx(geom[i]->draw);
-            tris->drawTrajectory(geom[i]->draw, oldpos, pos, oldRadius, radius, arrowHead, view->scale, limit, quality);
-            diff = tris->getVertexIdx(geom[i]->draw) - diff;
-            //Per vertex colours
-            for (int c=0; c<diff; c++)
+            if (flat)
+            {
+              lines->read(draw, 1, lucVertexData, oldpos);
+              lines->read(draw, 1, lucVertexData, pos);
+              lines->read(draw, 1, lucRGBAData, &oldColour);
+              lines->read(draw, 1, lucRGBAData, &colour);
+            }
+            else
             {
-              //Top of shaft and arrowhead use current colour, others (base) use previous
-              //(Every second vertex is at top of shaft, first quality*2 are shaft verts)
-              Colour& col = oldColour;
-              if (c%2==1 || c > quality*2) col = colour;
-              tris->read(geom[i]->draw, 1, lucRGBAData, &col);
+              //Coord scaling passed to drawTrajectory (as global scaling disabled to avoid distorting glyphs)
+              float arrowHead = -1;
+              if (step == end) arrowHead = arrowSize; //draw->properties["arrowhead"].ToFloat(2.0);
+              int diff = tris->getVertexIdx(draw);
+              tris->drawTrajectory(draw, oldpos, pos, oldRadius, radius, arrowHead, view->scale, limit, quality);
+              diff = tris->getVertexIdx(draw) - diff;
+              //Per vertex colours
+              for (int c=0; c<diff; c++)
+              {
+                //Top of shaft and arrowhead use current colour, others (base) use previous
+                //(Every second vertex is at top of shaft, first quality*2 are shaft verts)
+                Colour& col = oldColour;
+                if (c%2==1 || c > quality*2) col = colour;
+                tris->read(draw, 1, lucRGBAData, &col);
+              }
             }
           }
-        }
 
-        //oldtime = time;
-        oldpos = pos;
-        oldRadius = radius;
-        oldColour = colour;
+          //oldtime = time;
+          oldpos = pos;
+          oldRadius = radius;
+          oldColour = colour;
+        }
       }
-    }
-    if (taper) debug_print("Tapered tracers from %f to %f (step %f)\n", size0, size, factor);
+    };
+    generate(geom[i]->draw, particles, flat ? 0 : quality, trajectories);
+
+    if (taper) debug_print("Tapered tracers from %f to %f (step %f)\n", size0, size0 + factor * (end - start), factor);
 
     //Adjust bounding box
     //tris->compareMinMax(geom[i]->min, geom[i]->max);
@@ -200,3 +253,201 @@ void Tracers::update()
 }
 
 
+void Tracers::updateTrail(unsigned int i, int start, int end, bool timecolour)
+{
+  Properties& props = geom[i]->draw->properties;
+  unsigned int particles = geom[i]->width;
+  int datasteps = end + 1;
+
+  //Ring size from the step limit, or every step when unlimited
+  int slots = props["steps"];
+  if (slots <= 0)
+    slots = drawstate.timesteps.size();
+  else if (drawstate.gap > 1)
+    slots = ceil(slots/(float)(drawstate.gap-1));
+  if (slots < end - start + 1) slots = end - start + 1;
+  if (slots < 2) slots = 2;
+
+  //Time colours are looked up in the colour map texture by the shader
+  ColourMap* cmap = geom[i]->draw->colourMap;
+  if (timecolour && !cmap->texture)
+  {
+    cmap->loadTexture();
+    cmap->calibrate(drawstate.timesteps[start]->time, drawstate.timesteps[end]->time);
+  }
+
+  float limit = props.getFloat("limit", view->model_size * 0.3);
+  std::vector<TrailVertex> verts, prev;
+  std::vector<bool> hidden, prevhidden;
+
+  TracerTrail& trail = trails[geom[i]->draw];
+  if (trail.vbo && glIsBuffer(trail.vbo) && trail.particles == particles && trail.slots == (unsigned int)slots &&
+      trail.filled > 0 && trail.step + 1 == drawstate.now && trail.datasteps + 1 == datasteps)
+  {
+    //Advanced one step, append the newest positions only
+    trailStep(i, end-1, prev, prevhidden, timecolour);
+    trailStep(i, end, verts, hidden, timecolour);
+    writeTrail(trail, verts, hidden, prev, prevhidden, limit);
+  }
+  else
+  {
+    //Fill the ring from the oldest step traced
+    if (!trail.vbo || !glIsBuffer(trail.vbo))
+    {
+      glGenBuffers(1, &trail.vbo);
+      glGenBuffers(1, &trail.ibo);
+    }
+    trail.particles = particles;
+    trail.slots = slots;
+    trail.head = slots-1;
+    trail.filled = 0;
+    glBindBuffer(GL_ARRAY_BUFFER, trail.vbo);
+    glBufferData(GL_ARRAY_BUFFER, slots * particles * sizeof(TrailVertex), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trail.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, slots * particles * 2 * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+    for (int step=start; step <= end; step++)
+    {
+      trailStep(i, step, verts, hidden, timecolour);
+      writeTrail(trail, verts, hidden, prev, prevhidden, limit);
+      prev.swap(verts);
+      prevhidden.swap(hidden);
+    }
+    debug_print("Trails of %d particles over %d steps (ring of %d steps)\n", particles, end-start+1, slots);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  GL_Error_Check;
+
+  trail.step = drawstate.now;
+  trail.datasteps = datasteps;
+  trail.shown = min(trail.filled, (unsigned int)(end - start + 1));
+  trail.active = true;
+}
+
+void Tracers::trailStep(unsigned int i, int step, std::vector<TrailVertex>& verts, std::vector<bool>& hidden, bool timecolour)
+{
+  //Positions of all particles at a step, ordered by particle index if provided
+  unsigned int particles = geom[i]->width;
+  bool indexed = geom[i]->indices.size() >= (step+1) * particles;
+  Colour white(255, 255, 255);
+  verts.resize(particles);
+  hidden.assign(particles, true);
+  for (unsigned int x=0; x < particles; x++)
+  {
+    unsigned int p = indexed ? geom[i]->indices[step * particles + x] : x;
+    if (p >= particles) continue;
+    int pp = step * particles + x;
+    if (geom[i]->filter(pp)) continue;
+    hidden[p] = false;
+    memcpy(verts[p].pos, geom[i]->vertices[pp], sizeof(float) * 3);
+    if (timecolour)
+      verts[p].colour = white;
+    else
+      geom[i]->getColour(verts[p].colour, pp);
+  }
+}
+
+void Tracers::writeTrail(TracerTrail& trail, std::vector<TrailVertex>& verts, std::vector<bool>& hidden,
+                         std::vector<TrailVertex>& prev, std::vector<bool>& prevhidden, float limit)
+{
+  //Overwrite the oldest slot with a new step and join it to the previous head
+  unsigned int particles = trail.particles;
+  unsigned int slot = (trail.head + 1) % trail.slots;
+  for (unsigned int p=0; p < particles; p++)
+    verts[p].slot = slot;
+  glBindBuffer(GL_ARRAY_BUFFER, trail.vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, slot * particles * sizeof(TrailVertex), particles * sizeof(TrailVertex), &verts[0]);
+
+  if (trail.filled > 0)
+  {
+    //Segments from previous head, degenerate where either end is filtered or the jump exceeds the limit
+    std::vector<GLuint> segments(particles * 2);
+    Vec3d scale(view->scale);
+    for (unsigned int p=0; p < particles; p++)
+    {
+      GLuint a = trail.head * particles + p;
+      GLuint b = slot * particles + p;
+      Vec3d diff = Vec3d(verts[p].pos) - Vec3d(prev[p].pos);
+      diff *= scale;
+      if (hidden[p] || prevhidden[p] || (limit > 0.f && diff.magnitude() > limit))
+        b = a;
+      segments[p*2] = a;
+      segments[p*2+1] = b;
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trail.ibo);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, trail.head * particles * 2 * sizeof(GLuint), particles * 2 * sizeof(GLuint), &segments[0]);
+  }
+
+  trail.head = slot;
+  if (trail.filled < trail.slots) trail.filled++;
+}
+
+void Tracers::draw()
+{
+  Glyphs::draw();
+
+  Shader* prog = drawstate.prog[lucTracerType];
+  if (!prog || !prog->program) return;
+  glPushAttrib(GL_ENABLE_BIT);
+  GLint aSlot = prog->attribs["aSlot"];
+  for (unsigned int i=0; i<geom.size(); i++)
+  {
+    auto it = trails.find(geom[i]->draw);
+    if (it == trails.end() || !it->second.active || it->second.shown < 2 || !drawable(i)) continue;
+    TracerTrail& trail = it->second;
+    Properties& props = geom[i]->draw->properties;
+
+    //Set draw state
+    setState(i, prog);
+    float lineWidth = (float)props["linewidth"] * (float)props["scalelines"] * view->scale2d;
+    if (lineWidth <= 0) lineWidth = 1.0;
+    glLineWidth(lineWidth);
+
+    //Age of each vertex is calculated from its slot relative to the head
+    prog->setUniformf("uHead", trail.head);
+    prog->setUniformf("uSlots", trail.slots);
+    prog->setUniformf("uFilled", trail.shown);
+    prog->setUniformi("uFade", (bool)props["fade"]);
+    ColourMap* cmap = geom[i]->draw->colourMap;
+    bool timecolour = cmap && cmap->texture && !geom[i]->colourData();
+    prog->setUniformi("uTimeColour", timecolour);
+    if (timecolour)
+    {
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, cmap->texture->id);
+      prog->setUniformi("uColourMap", 0);
+    }
+
+    int stride = sizeof(TrailVertex);
+    glBindBuffer(GL_ARRAY_BUFFER, trail.vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, trail.ibo);
+    glVertexPointer(3, GL_FLOAT, stride, (GLvoid*)0);
+    glColorPointer(4, GL_UNSIGNED_BYTE, stride, (GLvoid*)(3*sizeof(float)));
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    if (aSlot >= 0)
+    {
+      glEnableVertexAttribArray(aSlot);
+      glVertexAttribPointer(aSlot, 1, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(3*sizeof(float)+sizeof(Colour)));
+    }
+
+    //Segment blocks from the oldest shown step to the head, wrapping at most once
+    unsigned int blocks = trail.shown - 1;
+    unsigned int oldest = (trail.head + trail.slots - blocks) % trail.slots;
+    unsigned int first = min(blocks, trail.slots - oldest);
+    unsigned int block = trail.particles * 2;
+    glDrawElements(GL_LINES, first * block, GL_UNSIGNED_INT, (GLvoid*)(oldest * block * sizeof(GLuint)));
+    if (blocks > first)
+      glDrawElements(GL_LINES, (blocks - first) * block, GL_UNSIGNED_INT, (GLvoid*)0);
+
+    if (aSlot >= 0) glDisableVertexAttribArray(aSlot);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPopAttrib();
+  glUseProgram(0);
+  GL_Error_Check;
+}
@@ -35,18 +35,24 @@
 
 #include "Geometry.h"
 
-//Triangle centroid for depth sorting
-#define centroid(v1,v2,v3) {centroids.emplace_back((v1[0]+v2[0]+v3[0])/3, (v1[1]+v2[1]+v3[1])/3, (v1[2]+v2[2]+v3[2])/3);}
+//Triangle centroid for depth sorting, written at c and advanced
+#define centroid(c,v1,v2,v3) {*(c)++ = Vec3d((v1[0]+v2[0]+v3[0])/3, (v1[1]+v2[1]+v3[1])/3, (v1[2]+v2[2]+v3[2])/3);}
+
+//Vertices per block of work when optimising meshes in parallel (multiple of 3, whole triangles)
+#define MESH_BLOCK (3 << 16)
 
 TriSurfaces::TriSurfaces(DrawState& drawstate, bool flat2Dflag) : Geometry(drawstate)
 {
   type = lucTriangleType;
+  partial = true;
   tricount = 0;
   idxcount = 0;
   vbo = 0;
-  indexvbo = 0;
-  tidx = swap = NULL;
+  indexvbo = backvbo = 0;
+  listed = false;
   flat2d = flat2Dflag;
+  //Background sort finished, draw with the new order
+  sorter.completed = [this]() {if (this->drawstate.redisplay) this->drawstate.redisplay();};
 }
 
 TriSurfaces::~TriSurfaces()
@@ -56,24 +62,26 @@ TriSurfaces::~TriSurfaces()
 
 void TriSurfaces::close()
 {
-  if (!drawstate.global("gpucache"))
-  {
-    if (vbo)
-      glDeleteBuffers(1, &vbo);
-    if (indexvbo)
-      glDeleteBuffers(1, &indexvbo);
-    vbo = 0;
-    indexvbo = 0;
+  if (vbo)
+    glDeleteBuffers(1, &vbo);
+  if (indexvbo)
+    glDeleteBuffers(1, &indexvbo);
+  if (backvbo)
+    glDeleteBuffers(1, &backvbo);
+  vbo = 0;
+  indexvbo = backvbo = 0;
 
-    reload = true;
-  }
+  reload = true;
 
-  if (tidx)
-    delete[] tidx;
-  if (swap)
-    delete[] swap;
+  tidx.clear();
+  opaqueidx.clear();
+  sorter.clear();
+  listed = false;
+}
 
-  tidx = swap = NULL;
+size_t TriSurfaces::gpuMemory()
+{
+  return bufferSize(vbo) + bufferSize(indexvbo) + bufferSize(backvbo);
 }
 
 int TriSurfaces::triCount(int index)
@@ -123,11 +131,11 @@ void TriSurfaces::update()
 
   //Only reload the vbo data when required
   //Not needed when objects hidden/shown but required if colours changed
-  //if ((lastcount != total && reload) || !tidx)
+  //if ((lastcount != total && reload) || !listed)
   if ((lastcount != total && reload) || vbo == 0)
   {
     //Load & optimise the mesh data (on first load and if total changes)
-    if (!tidx || lastcount != total)
+    if (!listed || lastcount != total)
       loadMesh();
 
     //Send the data to the GPU via VBO
@@ -136,9 +144,11 @@ void TriSurfaces::update()
     //Initial render
     //render();
   }
+  else if (!updateBuffers())
+    loadBuffers();
 
   //Reload the list if count changes
-  if (!tidx || tricount == 0 || tricount*3 != idxcount)
+  if (!listed || tricount == 0 || tricount*3 != idxcount)
     loadList();
 
   if (reload || idxcount == 0)
@@ -148,6 +158,148 @@ void TriSurfaces::update()
   }
 }
 
+//Optimised mesh cache, meshes stored by hash of their source data, least recently used first
+//shared by all surfaces so static meshes are only optimised once when revisited each timestep
+//Files (.lvmesh, native little-endian): LVMeshHeader, vertices, normals, values, indices
+#define LVMESH_MAGIC "LVMESH"
+#define LVMESH_VERSION 2
+
+struct LVMeshHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t endian;    //0x01020304 as written
+  uint64_t hash;
+  uint32_t flags;     //vnormals, optimise, vertColour bits
+  uint32_t vertices;  //Float counts
+  uint32_t normals;
+  uint32_t values;
+  uint32_t indices;
+  uint32_t reserved;
+};
+
+static std::mutex meshcache_mutex;
+static std::map<uint64_t, MeshData> meshcache;
+static std::deque<uint64_t> meshcache_lru;
+
+static std::string meshCacheFile(DrawState& drawstate, uint64_t hash)
+{
+  std::string dir = drawstate.global("meshcachepath");
+  if (dir.length() == 0) return "";
+  std::stringstream ss;
+  ss << dir;
+  if (dir[dir.length()-1] != '/') ss << "/";
+  ss << std::hex << std::setw(16) << std::setfill('0') << hash << ".lvmesh";
+  return ss.str();
+}
+
+static bool readMeshFile(const std::string& path, uint64_t hash, MeshData& mesh)
+{
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file.is_open()) return false;
+  LVMeshHeader header;
+  file.read((char*)&header, sizeof(LVMeshHeader));
+  unsigned int flags = mesh.vnormals | mesh.optimise << 1 | mesh.vertColour << 2;
+  if (!file || strncmp(header.magic, LVMESH_MAGIC, 8) != 0 || header.version != LVMESH_VERSION ||
+      header.endian != 0x01020304 || header.hash != hash || header.flags != flags)
+    return false;
+  mesh.vertices.resize(header.vertices);
+  mesh.normals.resize(header.normals / 3);
+  mesh.values.resize(header.values);
+  mesh.indices.resize(header.indices);
+  file.read((char*)mesh.vertices.data(), sizeof(float) * mesh.vertices.size());
+  file.read((char*)mesh.normals.data(), sizeof(Vec3d) * mesh.normals.size());
+  file.read((char*)mesh.values.data(), sizeof(float) * mesh.values.size());
+  file.read((char*)mesh.indices.data(), sizeof(GLuint) * mesh.indices.size());
+  return !file.fail();
+}
+
+static bool writeMeshFile(const std::string& path, uint64_t hash, MeshData& mesh)
+{
+  LVMeshHeader header;
+  memset(&header, 0, sizeof(LVMeshHeader));
+  strcpy(header.magic, LVMESH_MAGIC);
+  header.version = LVMESH_VERSION;
+  header.endian = 0x01020304;
+  header.hash = hash;
+  header.flags = mesh.vnormals | mesh.optimise << 1 | mesh.vertColour << 2;
+  header.vertices = mesh.vertices.size();
+  header.normals = mesh.normals.size() * 3;
+  header.values = mesh.values.size();
+  header.indices = mesh.indices.size();
+
+  //Write to a temporary file then rename so partial files are never read
+  std::string tmp = path + ".tmp";
+  std::ofstream file(tmp.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) return false;
+  file.write((const char*)&header, sizeof(LVMeshHeader));
+  file.write((const char*)mesh.vertices.data(), sizeof(float) * mesh.vertices.size());
+  file.write((const char*)mesh.normals.data(), sizeof(Vec3d) * mesh.normals.size());
+  file.write((const char*)mesh.values.data(), sizeof(float) * mesh.values.size());
+  file.write((const char*)mesh.indices.data(), sizeof(GLuint) * mesh.indices.size());
+  file.close();
+  if (file.fail() || rename(tmp.c_str(), path.c_str()) != 0)
+  {
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool loadCachedMesh(DrawState& drawstate, uint64_t hash, MeshData& mesh)
+{
+  {
+    std::lock_guard<std::mutex> guard(meshcache_mutex);
+    std::map<uint64_t, MeshData>::iterator it = meshcache.find(hash);
+    if (it != meshcache.end())
+    {
+      mesh = it->second;
+      //Move to most recently used
+      meshcache_lru.erase(std::find(meshcache_lru.begin(), meshcache_lru.end(), hash));
+      meshcache_lru.push_back(hash);
+      return true;
+    }
+  }
+
+  std::string path = meshCacheFile(drawstate, hash);
+  if (path.length() == 0) return false;
+  if (readMeshFile(path, hash, mesh)) return true;
+  //Clear any partially read data
+  mesh.vertices.clear();
+  mesh.normals.clear();
+  mesh.values.clear();
+  mesh.indices.clear();
+  return false;
+}
+
+static void storeCachedMesh(DrawState& drawstate, uint64_t hash, MeshData& mesh, bool file)
+{
+  std::string path = meshCacheFile(drawstate, hash);
+  if (file && path.length() > 0 && !writeMeshFile(path, hash, mesh))
+    debug_print("Failed to write mesh cache file: %s\n", path.c_str());
+
+  //Cached meshes are counted with geometry memory against the cachesize limit
+  bool keep = drawstate.global("meshcache");
+  if (!keep) return;
+  float cachesize = drawstate.global("cachesize");
+  long limit = cachesize > 0 ? cachesize * 1000000.0 : LONG_MAX;
+  if ((long)mesh.bytes() > limit) return;
+  std::lock_guard<std::mutex> guard(meshcache_mutex);
+  if (meshcache.find(hash) != meshcache.end()) return;
+  meshcache[hash] = mesh;
+  meshcache_lru.push_back(hash);
+  membytes__ += mesh.bytes();
+  if (membytes__ > mempeak__) mempeak__ = membytes__.load();
+  //Remove least recently used meshes over the limit
+  while (membytes__ > limit && meshcache_lru.size() > 1)
+  {
+    uint64_t old = meshcache_lru.front();
+    meshcache_lru.pop_front();
+    membytes__ -= meshcache[old].bytes();
+    meshcache.erase(old);
+  }
+}
+
 void TriSurfaces::loadMesh()
 {
   // Load & optimise triangle meshes...
@@ -162,9 +314,19 @@ void TriSurfaces::loadMesh()
   GLuint unique = 0;
   tricount = 0;
   elements = 0;
-  //Reset triangle centroid data
+  //Reset triangle centroid data, each element writes from its own offset
+  std::vector<unsigned int> offsets(geom.size());
+  unsigned int ccount = 0;
+  for (unsigned int index = 0; index < geom.size(); index++)
+  {
+    offsets[index] = ccount;
+    if (geom[index]->count > 0) ccount += triCount(index);
+  }
   centroids.clear();
-  centroids.reserve(total);
+  centroids.resize(ccount);
+
+  //Unstructured meshes, optimised after the others
+  std::vector<unsigned int> meshes;
   for (unsigned int index = 0; index < geom.size(); index++)
   {
     bool vnormals = geom[index]->draw->properties["vertexnormals"];
@@ -174,15 +336,16 @@ void TriSurfaces::loadMesh()
     if (geom[index]->indices.size() > 0)
     {
       unsigned i1, i2, i3;
+      Vec3d* c = &centroids[offsets[index]];
       for (unsigned int j=0; j < geom[index]->indices.size()-2; j += 3)
       {
         i1 = geom[index]->indices[j];
         i2 = geom[index]->indices[j+1];
         i3 = geom[index]->indices[j+2];
 
-        centroid(geom[index]->vertices[i1],
-                 geom[index]->vertices[i2],
-                 geom[index]->vertices[i3]);
+        centroid(c, geom[index]->vertices[i1],
+                    geom[index]->vertices[i2],
+                    geom[index]->vertices[i3]);
 
         elements += 3;
       }
@@ -196,141 +359,144 @@ void TriSurfaces::loadMesh()
       continue;
     }
 
-    //Add vertices to a vector with indices
-    //Sort vertices vector with std::sort & custom compare sort( vec.begin(), vec.end() );
-    //Iterate, for duplicates replace indices with index of first
-    //Remove duplicate vertices Triangles stored as list of indices
-    unsigned int hasColours = geom[index]->colourCount();
-    bool vertColour = hasColours && (hasColours >= geom[index]->count);
-    t1=tt=clock();
-
-    //Add vertices to vector
-    std::vector<Vertex> verts(geom[index]->count);
-    std::vector<Vec3d> normals(vnormals ? geom[index]->count : 0);
-    std::vector<GLuint> indices;
-    for (unsigned int j=0; j < geom[index]->count; j++)
-    {
-      verts[j].id = verts[j].ref = j;
-      verts[j].vert = geom[index]->vertices[j];
-    }
-    t2 = clock();
-    debug_print("  %.4lf seconds to add to sort vector\n", (t2-t1)/(double)CLOCKS_PER_SEC);
-
-    int triverts = 0;
     bool grid = (geom[index]->width * geom[index]->height == geom[index]->count);
     if (grid)
     {
       //Structured mesh grid, 2 triangles per element, 3 indices per tri
+      t1 = clock();
+      std::vector<Vec3d> normals(vnormals ? geom[index]->count : 0);
+      std::vector<GLuint> indices;
       int els = (geom[index]->width-1) * (geom[index]->height-1);
-      triverts = els * 6;
+      int triverts = els * 6;
       indices.resize(triverts);
       if (vnormals && geom[index]->normals.size() == 0)
         calcGridNormals(index, normals);
-      calcGridIndices(index, indices);
+      calcGridIndices(index, indices, offsets[index]);
       unique += geom[index]->count; //For calculating index offset (voffset)
       elements += triverts;
-    }
-    else
-    {
-      //Unstructured mesh, 1 index per vertex
-      triverts = geom[index]->count;
-      indices.resize(triverts);
-      calcTriangleNormals(index, verts, normals);
-      elements += triverts;
-    }
-
-    //Now have list of vertices sorted by vertex pos with summed normals and references of duplicates replaced
-    t1 = clock();
 
-    if (grid)
-    {
       //Replace normals
       if (vnormals)
       {
         geom[index]->normals = Coord3DValues();
         read(geom[index], normals.size(), lucNormalData, &normals[0]);
       }
+
+      //Read the indices for loading sort list and later use (json export etc)
+      geom[index]->indices.read(indices.size(), &indices[0]);
+      t2 = clock();
+      debug_print("  %.4lf seconds to load grid surface %d\n", (t2-t1)/(double)CLOCKS_PER_SEC, index);
     }
     else
     {
-      //Switch out the optimised vertices and normals with the old data stores
-      Coord3DValues newverts = Coord3DValues();
-      if (vnormals) 
-      {
-        geom[index]->normals = Coord3DValues();
-        geom[index]->data[lucNormalData] = &geom[index]->normals;
-      }
-      geom[index]->indices = UIntValues();
-      geom[index]->count = 0;
-      geom[index]->data[lucVertexData] = &newverts;
-      geom[index]->data[lucIndexData] = &geom[index]->indices;
-      //Recreate value data as optimised version is smaller, re-load necessary values
-      FloatValues* oldvalues = geom[index]->colourData();
-      FloatValues* newvalues = NULL;
-      if (oldvalues)
-      {
-        newvalues = new FloatValues();
-        newvalues->label = oldvalues->label;
-        newvalues->minimum = oldvalues->minimum;
-        newvalues->maximum = oldvalues->maximum;
-      }
-      bool optimise = geom[index]->draw->properties["optimise"];
-      for (unsigned int v=0; v<verts.size(); v++)
-      {
-        //Re-write optimised data with unique vertices only
-        if (!optimise || verts[v].id == verts[v].ref)
-        {
-          //Reference id == self, not a duplicate
-
-          //Average final colour value
-          if (vertColour && newvalues)
-          {
-            if (verts[v].vcount > 1)
-              oldvalues->value[verts[v].id] /= verts[v].vcount;
-            newvalues->read(1, &oldvalues->value[verts[v].id]);
-          }
-
-          //Save an index lookup entry (Grid indices loaded in previous step)
-          indices[verts[v].id] = geom[index]->count;
-
-          //Replace verts & normals
-          read(geom[index], 1, lucVertexData, verts[v].vert);
-          if (vnormals)
-          {
-            //Normalise final vector first
-            normals[verts[v].id].normalise();
-            read(geom[index], 1, lucNormalData, normals[verts[v].id].ref());
-          }
-          unique++;
-        }
-        else
-        {
-          //Duplicate vertex, use index reference
-          indices[verts[v].id] = indices[verts[v].ref];
-        }
-      }
-      //Replace vertex containers
-      geom[index]->vertices = newverts;
-      geom[index]->data[lucVertexData] = &geom[index]->vertices;
-      //printf("OBJ %s EL %d, optimised vertices: %d\n", geom[index]->draw->name().c_str(), index, geom[index]->vertices.size());
-      if (newvalues)
-        geom[index]->values[geom[index]->draw->colourIdx] = newvalues;
-      if (oldvalues) delete oldvalues;
+      //Unstructured mesh, 1 index per vertex
+      meshes.push_back(index);
+      elements += geom[index]->count;
     }
+  }
 
+  //Optimise unstructured meshes: remove duplicate vertices, calc vertex normals and average colours
+  //Elements are processed in parallel, large elements also split their work across threads
+  t1 = clock();
+  int threads = drawstate.global("threads");
+  std::vector<MeshData> optimised(meshes.size());
+  std::vector<unsigned int> large;
+  for (unsigned int m=0; m < meshes.size(); m++)
+  {
+    GeomData* g = geom[meshes[m]];
+    //Vertex elimination currently only works for per-vertex colouring,
+    // if less colour values provided, must precalc own indices to skip this step
+    unsigned int hasColours = g->colourCount();
+    optimised[m].vertColour = hasColours && (hasColours >= g->count) && g->colourData();
+    if (hasColours && !optimised[m].vertColour) debug_print("WARNING: Not enough colour values for per-vertex normalisation! %d < %d\n", hasColours, g->count);
+    optimised[m].vnormals = g->draw->properties["vertexnormals"];
+    optimised[m].optimise = g->draw->properties["optimise"];
+    if (g->count > MESH_BLOCK)
+      large.push_back(m);
+  }
+
+  //Reuse meshes already optimised from identical source data, only centroids are required
+  std::vector<uint64_t> hashes(meshes.size());
+  std::vector<bool> cached(meshes.size());
+  std::string cachepath = drawstate.global("meshcachepath");
+  bool usecache = drawstate.global("meshcache");
+  if (cachepath.length() > 0) usecache = true;
+  unsigned int hits = 0;
+  for (unsigned int m=0; m < meshes.size() && usecache; m++)
+  {
+    hashes[m] = meshHash(meshes[m], optimised[m], threads);
+    cached[m] = loadCachedMesh(drawstate, hashes[m], optimised[m]);
+    if (cached[m]) hits++;
+  }
+  if (usecache)
+  {
     t2 = clock();
-    debug_print("  %.4lf seconds to normalise (and re-buffer)\n", (t2-t1)/(double)CLOCKS_PER_SEC);
+    debug_print("  %.4lf seconds to find %d/%d cached meshes\n", (t2-t1)/(double)CLOCKS_PER_SEC, hits, meshes.size());
     t1 = clock();
+  }
 
-    //Read the indices for loading sort list and later use (json export etc)
-    geom[index]->indices.read(indices.size(), &indices[0]);
+  parallel_for(meshes.size(), [&](unsigned int m)
+  {
+    if (geom[meshes[m]]->count > MESH_BLOCK) return;
+    if (cached[m])
+      calcCentroids(meshes[m], offsets[meshes[m]], 1);
+    else
+      optimiseMesh(meshes[m], optimised[m], offsets[meshes[m]], 1);
+  }, threads);
+  for (unsigned int l=0; l < large.size(); l++)
+  {
+    if (cached[large[l]])
+      calcCentroids(meshes[large[l]], offsets[meshes[large[l]]], threads);
+    else
+      optimiseMesh(meshes[large[l]], optimised[large[l]], offsets[meshes[large[l]]], threads);
+  }
+  t2 = clock();
+  debug_print("  %.4lf seconds to optimise %d meshes\n", (t2-t1)/(double)CLOCKS_PER_SEC, meshes.size() - hits);
 
-    t2 = clock();
-    debug_print("  %.4lf seconds to reload & clean up\n", (t2-t1)/(double)CLOCKS_PER_SEC);
-    t1 = clock();
-    debug_print("  Total %.4lf seconds.\n", (t2-tt)/(double)CLOCKS_PER_SEC);
+  //Store newly optimised meshes for reuse
+  for (unsigned int m=0; m < meshes.size() && usecache; m++)
+  {
+    if (!cached[m])
+      storeCachedMesh(drawstate, hashes[m], optimised[m], true);
   }
 
+  //Switch out the optimised vertices, normals and colour values with the old data stores
+  t1 = clock();
+  for (unsigned int m=0; m < meshes.size(); m++)
+  {
+    int index = meshes[m];
+    MeshData& mesh = optimised[m];
+    GLuint count = mesh.vertices.size() / 3;
+    geom[index]->vertices = Coord3DValues();
+    geom[index]->count = 0;
+    read(geom[index], count, lucVertexData, &mesh.vertices[0]);
+    if (mesh.vnormals)
+    {
+      geom[index]->normals = Coord3DValues();
+      read(geom[index], count, lucNormalData, &mesh.normals[0]);
+    }
+    if (mesh.vertColour)
+    {
+      //Recreate value data as optimised version is smaller
+      FloatValues* oldvalues = geom[index]->colourData();
+      FloatValues* newvalues = new FloatValues();
+      newvalues->label = oldvalues->label;
+      newvalues->minimum = oldvalues->minimum;
+      newvalues->maximum = oldvalues->maximum;
+      newvalues->read(mesh.values.size(), &mesh.values[0]);
+      geom[index]->values[geom[index]->draw->colourIdx] = newvalues;
+      delete oldvalues;
+    }
+
+    //Read the indices for loading sort list and later use (json export etc)
+    geom[index]->indices = UIntValues();
+    geom[index]->indices.read(mesh.indices.size(), &mesh.indices[0]);
+    unique += count;
+    //printf("OBJ %s EL %d, optimised vertices: %d\n", geom[index]->draw->name().c_str(), index, geom[index]->vertices.size());
+  }
+  t2 = clock();
+  debug_print("  %.4lf seconds to reload & clean up\n", (t2-t1)/(double)CLOCKS_PER_SEC);
+
   //debug_print("  *** There were %d unique vertices out of %d total. Buffer allocated for %d\n", unique, total*3, bsize/datasize);
   t2 = clock();
   debug_print("  %.4lf seconds to optimise triangle mesh\n", (t2-tt)/(double)CLOCKS_PER_SEC);
@@ -344,12 +510,12 @@ void TriSurfaces::loadList()
 
   debug_print("Loading up to %d triangles into list...\n", total);
 
-  //Create sorting array
-  if (tidx) delete[] tidx;
-  tidx = new TIndex[total];
-  if (swap) delete[] swap;
-  swap = new TIndex[total];
-  if (tidx == NULL || swap == NULL) abort_program("Memory allocation error (failed to allocate %d bytes)", sizeof(TIndex) * total);
+  //Create sorting arrays, transparent triangles are sorted by centroid, opaque are not
+  tidx.resize(total * 3);
+  opaqueidx.clear();
+  sorter.resize(total);
+  unsigned int sorted = 0;
+  listed = true;
 
   //Element counts to actually plot (exclude filtered/hidden) per geom entry
   counts.clear();
@@ -362,7 +528,7 @@ void TriSurfaces::loadList()
   for (unsigned int index = 0; index < geom.size(); voffset += geom[index]->count, index++)
   {
     counts[index] = 0;
-    if (!drawable(index)) 
+    if (!drawable(index) || isCulled(index))
     {
       offset += geom[index]->indices.size()/3; //Need to include hidden in centroid offset
       continue;
@@ -377,28 +543,29 @@ void TriSurfaces::loadList()
       //voffset is offset of the last vertex added to the vbo from the previous object
       assert(offset < total);
       if (!internal && geom[index]->filter(geom[index]->indices[t])) continue; //If first vertex filtered, skip whole tri
-      tidx[tricount].index[0] = geom[index]->indices[t] + voffset;
-      tidx[tricount].index[1] = geom[index]->indices[t+1] + voffset;
-      tidx[tricount].index[2] = geom[index]->indices[t+2] + voffset;
-      tidx[tricount].distance = 0;
-
-      //All opaque triangles at start
+      GLuint* tri = (GLuint*)geom[index]->indices.ref(t);
       if (geom[index]->opaque)
       {
-        tidx[tricount].distance = USHRT_MAX;
-        tidx[tricount].vertex = NULL;
+        //All opaque triangles at start
+        for (int i=0; i<3; i++)
+          opaqueidx.push_back(tri[i] + voffset);
       }
       else
       {
         //Triangle centroid for depth sorting
         assert(offset < centroids.size());
-        tidx[tricount].vertex = centroids[offset].ref();
+        for (int i=0; i<3; i++)
+          tidx[sorted*3+i] = tri[i] + voffset;
+        sorter.set(sorted, centroids[offset].ref());
+        sorted++;
       }
       tricount++;
       counts[index] += 3; //Element count
     }
     //printf("INDEX %d TRIS %d ELS %d offset = %d, tricount = %d VOFFSET = %d\n", index, counts[index]/3, counts[index], offset, tricount, voffset);
   }
+  tidx.resize(sorted * 3);
+  sorter.resize(sorted);
 
   t2 = clock();
   debug_print("  %.4lf seconds to load triangle list (%d)\n", (t2-tt)/(double)CLOCKS_PER_SEC, tricount);
@@ -435,10 +602,39 @@ void TriSurfaces::loadBuffers()
   if (!p) abort_program("VBO setup failed");
 
   //Buffer data for all vertices
-  for (unsigned int index = 0; index < geom.size(); index++)
+  std::vector<unsigned int> objects(geom.size());
+  std::vector<unsigned char*> ptrs(geom.size());
+  unsigned int voffset = 0;
+  t1=tt=clock();
+  for (unsigned int index = 0; index < geom.size(); voffset += geom[index]->count, index++)
   {
-    t1=tt=clock();
+    objects[index] = index;
+    ptrs[index] = ptr + voffset * datasize;
+  }
+  packBuffers(objects, ptrs);
+  uploaded();
+  t2 = clock();
+  debug_print("  %.4lf seconds to reload %d vertices\n", (t2-t1)/(double)CLOCKS_PER_SEC, vcount);
+
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+  GL_Error_Check;
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+  debug_print("  Total %.4lf seconds to update triangle buffers\n", (t2-tt)/(double)CLOCKS_PER_SEC);
+}
+
+void TriSurfaces::packBuffers(const std::vector<unsigned int>& objects, const std::vector<unsigned char*>& ptrs)
+{
+  //Copy vertices of listed objects into vbo data at given pointers, in blocks packed in parallel,
+  //each block resolves its colours in one batch then interleaves attributes
+  struct Block {unsigned int index, start, count; unsigned char* ptr;};
+  std::vector<Block> blocks;
+  std::vector<unsigned int> colranges(geom.size());
+  std::vector<float> shifts(geom.size());
+  unsigned int datasize = sizeof(float) * 8 + sizeof(Colour);
+  for (unsigned int o = 0; o < objects.size(); o++)
+  {
+    unsigned int index = objects[o];
     //Calibrate colour maps on range for this surface
     geom[index]->colourCalibrate();
     unsigned int hasColours = geom[index]->colourCount();
@@ -449,144 +645,419 @@ void TriSurfaces::loadBuffers()
     //if (hasColours && colrange * hasColours != geom[index]->count)
     //   debug_print("WARNING: Vertex Count %d not divisable by colour count %d\n", geom[index]->count, hasColours);
     debug_print("Using 1 colour per %d vertices (%d : %d)\n", colrange, geom[index]->count, hasColours);
+    colranges[index] = colrange;
 
-    Colour colour;
-    bool normals = geom[index]->normals.size() == geom[index]->vertices.size();
-    debug_print("Mesh %d/%d has normals? %d (%d == %d)\n", index, geom.size(), normals, geom[index]->normals.size(), geom[index]->vertices.size());
-    float zero[3] = {0,0,0};
+    debug_print("Mesh %d/%d has normals? %d (%d == %d)\n", index, geom.size(), geom[index]->normals.size() == geom[index]->vertices.size(), geom[index]->normals.size(), geom[index]->vertices.size());
     float shift = geom[index]->draw->properties["shift"];
     if (geom[index]->draw->name().length() == 0) shift = 0.0; //Skip shift for built in objects
     shift *= 0.0001 * view->model_size;
-    std::array<float,3> shiftvert;
-    for (unsigned int v=0; v < geom[index]->count; v++)
+    if (shift > 0) debug_print("Shifting vertices %s (%d) by %f\n", geom[index]->draw->name().c_str(), index, shift);
+    shifts[index] = shift;
+
+    //Blocks start on a colour boundary
+    unsigned int blocksize = (MESH_BLOCK / colrange + 1) * colrange;
+    for (unsigned int v = 0; v < geom[index]->count; v += blocksize)
     {
-      //Have colour values but not enough for per-vertex, spread over range (eg: per triangle)
-      unsigned int cidx = v / colrange;
-      if (cidx * colrange == v)
-        geom[index]->getColour(colour, cidx);
+      Block b = {index, v, min(blocksize, geom[index]->count - v), ptrs[o] + v * datasize};
+      blocks.push_back(b);
+    }
+  }
 
-      float* vert = geom[index]->vertices[v];
+  parallel_for(blocks.size(), [&](unsigned int n)
+  {
+    Block& b = blocks[n];
+    GeomData* g = geom[b.index];
+    unsigned int colrange = colranges[b.index];
+    float shift = shifts[b.index];
+    bool normals = g->normals.size() == g->vertices.size();
+    bool texCoords = g->texCoords.size() > 0;
+    //Have colour values but not enough for per-vertex, spread over range (eg: per triangle)
+    unsigned int cstart = b.start / colrange;
+    std::vector<Colour> colours((b.count + colrange - 1) / colrange);
+    g->getColours(colours.data(), cstart, colours.size());
+    float zero[3] = {0,0,0};
+    std::array<float,3> shiftvert;
+    unsigned char* out = b.ptr;
+    for (unsigned int v = b.start; v < b.start + b.count; v++)
+    {
+      float* vert = g->vertices[v];
       if (shift > 0)
       {
         //Shift vertices
         shiftvert = {vert[0] + shift, vert[1] + shift, vert[2] + shift};
         vert = shiftvert.data();
-        if (v==0) debug_print("Shifting vertices %s (%d) by %f\n", geom[index]->draw->name().c_str(), index, shift);
       }
 
       //Write vertex data to vbo
-      assert((unsigned int)(ptr-p) < bsize);
       //Copies vertex bytes
-      memcpy(ptr, vert, sizeof(float) * 3);
-      ptr += sizeof(float) * 3;
+      memcpy(out, vert, sizeof(float) * 3);
+      out += sizeof(float) * 3;
       //Copies normal bytes
       if (normals)
-        memcpy(ptr, &geom[index]->normals[v][0], sizeof(float) * 3);
+        memcpy(out, &g->normals[v][0], sizeof(float) * 3);
       else
-        memcpy(ptr, zero, sizeof(float) * 3);
-      ptr += sizeof(float) * 3;
+        memcpy(out, zero, sizeof(float) * 3);
+      out += sizeof(float) * 3;
       //Copies texCoord bytes
-      if (geom[index]->texCoords.size() > 0)
-        memcpy(ptr, &geom[index]->texCoords[v][0], sizeof(float) * 2);
-      ptr += sizeof(float) * 2;
+      if (texCoords)
+        memcpy(out, &g->texCoords[v][0], sizeof(float) * 2);
+      out += sizeof(float) * 2;
       //Copies colour bytes
-      memcpy(ptr, &colour, sizeof(Colour));
-      ptr += sizeof(Colour);
+      memcpy(out, &colours[v / colrange - cstart], sizeof(Colour));
+      out += sizeof(Colour);
     }
-    t2 = clock();
-    debug_print("  %.4lf seconds to reload %d vertices\n", (t2-t1)/(double)CLOCKS_PER_SEC, geom[index]->count);
-    t1 = clock();
-  }
+  }, drawstate.global("threads"));
+}
 
-  glUnmapBuffer(GL_ARRAY_BUFFER);
-  GL_Error_Check;
+bool TriSurfaces::updateBuffers()
+{
+  //Upload vbo ranges of changed objects only,
+  //returns false if object vertex counts have changed and a full reload is required
+  std::vector<unsigned int> objects;
+  if (!vbo || !dirtyObjects(objects)) return false;
+  if (objects.size() == 0) return true;
+  clock_t t1 = clock();
+
+  unsigned int datasize = sizeof(float) * 8 + sizeof(Colour);
+  std::vector<unsigned int> offsets(geom.size());
+  for (unsigned int index = 1; index < geom.size(); index++)
+    offsets[index] = offsets[index-1] + geom[index-1]->count;
+  unsigned int count = 0;
+  for (unsigned int o = 0; o < objects.size(); o++)
+    count += geom[objects[o]]->count;
+
+  //Pack into staging buffer then upload each object range
+  std::vector<unsigned char> staging(count * datasize);
+  std::vector<unsigned char*> ptrs(objects.size());
+  ptrs[0] = staging.data();
+  for (unsigned int o = 1; o < objects.size(); o++)
+    ptrs[o] = ptrs[o-1] + geom[objects[o-1]]->count * datasize;
+  packBuffers(objects, ptrs);
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  for (unsigned int o = 0; o < objects.size(); o++)
+  {
+    unsigned int index = objects[o];
+    glBufferSubData(GL_ARRAY_BUFFER, offsets[index] * datasize, geom[index]->count * datasize, ptrs[o]);
+    geom[index]->dirty = false;
+  }
   glBindBuffer(GL_ARRAY_BUFFER, 0);
+  GL_Error_Check;
+  debug_print("  %.4lf seconds to update %d vertices of %d surfaces\n", (clock()-t1)/(double)CLOCKS_PER_SEC, count, objects.size());
+  return true;
+}
 
-  debug_print("  Total %.4lf seconds to update triangle buffers\n", (t2-tt)/(double)CLOCKS_PER_SEC);
+//Spatial hash cells are four times the duplicate vertex tolerance, so matches for a vertex
+//are in its own cell or, when within tolerance of a boundary, the neighbouring cells across it
+#define VERTEX_CELL 250.0
+
+static inline uint64_t cellHash(int64_t x, int64_t y, int64_t z)
+{
+  uint64_t h = (uint64_t)x * 0x9E3779B97F4A7C15ULL ^ (uint64_t)y * 0xC2B2AE3D27D4EB4FULL ^ (uint64_t)z * 0x165667B19E3779F9ULL;
+  return h ^ (h >> 31);
+}
+
+static inline uint64_t vertexHash(const float* v)
+{
+  return cellHash(floor(v[0] * VERTEX_CELL), floor(v[1] * VERTEX_CELL), floor(v[2] * VERTEX_CELL));
+}
+
+static inline bool vertexMatch(const float* a, const float* b)
+{
+  return fabs(a[0] - b[0]) < 0.001 && fabs(a[1] - b[1]) < 0.001 && fabs(a[2] - b[2]) < 0.001;
 }
 
-void TriSurfaces::calcTriangleNormals(int index, std::vector<Vertex> &verts, std::vector<Vec3d> &normals)
+void TriSurfaces::optimiseMesh(int index, MeshData& mesh, unsigned int offset, int threads)
 {
+  //Merge duplicate vertices of an unstructured mesh, averaging normals and colour values,
+  //vertices are grouped by spatial hash into shards which are searched in parallel
   clock_t t1,t2;
   t1 = clock();
-  debug_print("Calculating normals for triangle surface %d size %d\n", index, geom[index]->vertices.size()/3);
-  //Vertex elimination currently only works for per-vertex colouring, 
-  // if less colour values provided, must precalc own indices to skip this step 
-  unsigned int hasColours = geom[index]->colourCount();
-  bool vertColour = (hasColours && hasColours >= geom[index]->vertices.size()/3);
-  if (hasColours && !vertColour) debug_print("WARNING: Not enough colour values for per-vertex normalisation! %d < %d\n", hasColours, geom[index]->vertices.size()/3);
-  bool normal = geom[index]->draw->properties["vertexnormals"];
+  GeomData* g = geom[index];
+  unsigned int count = g->count;
+  unsigned int blocks = (count + MESH_BLOCK - 1) / MESH_BLOCK;
+  debug_print("Calculating normals for triangle surface %d size %d\n", index, count);
+
   //Calculate face normals for each triangle and copy to each face vertex
-  for (unsigned int v=0; v<verts.size()-2 && verts.size() > 2; v += 3)
+  std::vector<Vec3d> normals(mesh.vnormals ? count : 0);
+  Vec3d* c = &centroids[offset];
+  parallel_for(blocks, [&](unsigned int b)
   {
-    //Copies for each vertex
-    if (normal)
+    unsigned int start = b * MESH_BLOCK;
+    unsigned int end = min(start + MESH_BLOCK, count);
+    for (unsigned int v=start; v+2<end; v += 3)
     {
-      normals[v] = vectorNormalToPlane(verts[v].vert, verts[v+1].vert, verts[v+2].vert);
-      normals[v+1] = Vec3d(normals[v]);
-      normals[v+2] = Vec3d(normals[v]);
-    }
+      //Copies for each vertex
+      if (mesh.vnormals)
+      {
+        normals[v] = vectorNormalToPlane(g->vertices[v], g->vertices[v+1], g->vertices[v+2]);
+        normals[v+1] = Vec3d(normals[v]);
+        normals[v+2] = Vec3d(normals[v]);
+      }
 
-    //Calc triangle centroid for sorting
-    centroid(verts[v].vert, verts[v+1].vert, verts[v+2].vert);
-  }
+      //Calc triangle centroid for sorting
+      Vec3d* cv = c + v/3;
+      centroid(cv, g->vertices[v], g->vertices[v+1], g->vertices[v+2]);
+    }
+  }, threads);
   t2 = clock();
   debug_print("  %.4lf seconds to calc facet normals\n", (t2-t1)/(double)CLOCKS_PER_SEC);
   t1 = clock();
 
-  //Sort by vertex
-  std::sort(verts.begin(), verts.end());
-  t2 = clock();
-  debug_print("  %.4lf seconds to sort %d verts\n", (t2-t1)/(double)CLOCKS_PER_SEC, verts.size());
-  t1 = clock();
-
-  //Now have list of vertices sorted by vertex pos
-  //Search for duplicates and replace references to normals
-  int match = 0;
-  int dupcount = 0;
-  bool optimise = geom[index]->draw->properties["optimise"];
-  for (unsigned int v=1; v<verts.size(); v++)
+  //Reference to first matching vertex (self if unique) and count of merged vertices
+  std::vector<GLuint> ref(count);
+  std::vector<GLuint> vcount(count, 1);
+  FloatValues* colours = mesh.vertColour ? g->colourData() : NULL;
+  std::vector<float> colsum;
+  if (colours) colsum.assign(colours->value.begin(), colours->value.begin() + count);
+  if (mesh.optimise)
   {
-    if (optimise && verts[match] == verts[v])
+    //Group vertices by hash into shards, in vertex order
+    unsigned int workers = threads > 0 ? threads : std::thread::hardware_concurrency();
+    unsigned int shards = workers > 1 ? min(workers * 4, blocks) : 1;
+    std::vector<uint64_t> hashes(count);
+    std::vector<GLuint> offsets(shards+1);
+    std::vector<GLuint> order(count);
+    parallel_for(blocks, [&](unsigned int b)
+    {
+      unsigned int end = min((b+1) * MESH_BLOCK, count);
+      for (unsigned int v=b * MESH_BLOCK; v<end; v++)
+        hashes[v] = vertexHash(g->vertices[v]);
+    }, threads);
+    for (unsigned int v=0; v<count; v++)
+      offsets[hashes[v] % shards + 1]++;
+    for (unsigned int s=0; s<shards; s++)
+      offsets[s+1] += offsets[s];
+    std::vector<GLuint> pos(offsets.begin(), offsets.end()-1);
+    for (unsigned int v=0; v<count; v++)
+      order[pos[hashes[v] % shards]++] = v;
+    t2 = clock();
+    debug_print("  %.4lf seconds to hash vertices\n", (t2-t1)/(double)CLOCKS_PER_SEC);
+    t1 = clock();
+
+    // If the angle between a given face normal and the face normal
+    // associated with the first triangle in the list of triangles for the
+    // current vertex is greater than a specified angle, normal is not added
+    // to average normal calculation and the corresponding vertex is given
+    // the facet normal. This preserves hard edges, specific angle to
+    // use depends on the model, but 90 degrees is usually a good start.
+
+    // cosine of angle between vectors = (v1 . v2) / |v1|.|v2|
+    // (angle is less than 90 degrees where dot product is positive, zero length normals always match)
+    //Don't include vertices in the sum if angle between normals too sharp
+    auto duplicate = [&](GLuint v, GLuint match)
+    {
+      if (!vertexMatch(g->vertices[v], g->vertices[match])) return false;
+      return !(mesh.vnormals && normals[v].dot(normals[match]) <= 0 &&
+               normals[v].magnitude() > 0 && normals[match].magnitude() > 0);
+    };
+
+    //Search each shard for duplicates in the same cell, matches are against the unique vertices of the cell
+    //(cells found by hash in an open addressing table, unique vertices of a cell linked in next)
+    struct Cell {uint64_t hash; GLuint first; GLuint last;};
+    std::vector<std::vector<Cell> > tables(shards);
+    std::vector<GLuint> next(count, UINT_MAX);
+    std::atomic<unsigned int> dupcount(0);
+    parallel_for(shards, [&](unsigned int s)
     {
-      // If the angle between a given face normal and the face normal
-      // associated with the first triangle in the list of triangles for the
-      // current vertex is greater than a specified angle, normal is not added
-      // to average normal calculation and the corresponding vertex is given
-      // the facet normal. This preserves hard edges, specific angle to
-      // use depends on the model, but 90 degrees is usually a good start.
-
-      // cosine of angle between vectors = (v1 . v2) / |v1|.|v2|
-      float angle = normal ? RAD2DEG * normals[verts[v].id].angle(normals[verts[match].id]) : 0;
-      //debug_print("angle %f ", angle);
-      //Don't include vertices in the sum if angle between normals too sharp
-      if (angle < 90)
+      //Table grown as cells are added
+      unsigned int size = 1024;
+      unsigned int cells = 0;
+      std::vector<Cell>& table = tables[s];
+      table.assign(size, Cell{0, UINT_MAX, UINT_MAX});
+      unsigned int dups = 0;
+      for (unsigned int o=offsets[s]; o<offsets[s+1]; o++)
       {
-        //Found a duplicate, replace reference idx (original retained in "id")
-        verts[v].ref = verts[match].ref;
-        dupcount++;
+        GLuint v = order[o];
+        uint64_t hash = hashes[v];
+        ref[v] = v;
+        unsigned int slot = (hash >> 32) & (size-1);
+        while (table[slot].first != UINT_MAX && table[slot].hash != hash)
+          slot = (slot + 1) & (size-1);
+        if (table[slot].first == UINT_MAX)
+        {
+          table[slot] = Cell{hash, v, v};
+          if (++cells * 2 > size)
+          {
+            //Rehash into a table of twice the size
+            std::vector<Cell> old(size*2, Cell{0, UINT_MAX, UINT_MAX});
+            old.swap(table);
+            size *= 2;
+            for (unsigned int i=0; i<old.size(); i++)
+            {
+              if (old[i].first == UINT_MAX) continue;
+              unsigned int slot = (old[i].hash >> 32) & (size-1);
+              while (table[slot].first != UINT_MAX)
+                slot = (slot + 1) & (size-1);
+              table[slot] = old[i];
+            }
+          }
+          continue;
+        }
+        for (GLuint match = table[slot].first; match != UINT_MAX; match = next[match])
+        {
+          if (!duplicate(v, match)) continue;
+          //Found a duplicate, replace reference idx
+          ref[v] = match;
+          dups++;
+          break;
+        }
+        if (ref[v] == v)
+        {
+          //New unique vertex in this cell
+          next[table[slot].last] = v;
+          table[slot].last = v;
+        }
+      }
+      dupcount += dups;
+    }, threads);
+
+    //Vertices still unique within tolerance of a cell boundary are then matched against
+    //earlier unique vertices of the neighbouring cells across it (tables are now only read)
+    parallel_for(blocks, [&](unsigned int b)
+    {
+      unsigned int end = min((b+1) * MESH_BLOCK, count);
+      unsigned int dups = 0;
+      for (unsigned int v=b * MESH_BLOCK; v<end; v++)
+      {
+        if (ref[v] != v) continue;
+        int64_t cell[3], side[3];
+        for (int i=0; i<3; i++)
+        {
+          double scaled = g->vertices[v][i] * VERTEX_CELL;
+          cell[i] = floor(scaled);
+          double frac = scaled - cell[i];
+          side[i] = frac < 0.25 ? -1 : (frac > 0.75 ? 1 : 0);
+        }
+        for (int n=1; n<8 && ref[v] == v; n++)
+        {
+          if ((n & 1 && !side[0]) || (n & 2 && !side[1]) || (n & 4 && !side[2])) continue;
+          uint64_t hash = cellHash(cell[0] + (n & 1 ? side[0] : 0), cell[1] + (n & 2 ? side[1] : 0), cell[2] + (n & 4 ? side[2] : 0));
+          std::vector<Cell>& table = tables[hash % shards];
+          unsigned int size = table.size();
+          unsigned int slot = (hash >> 32) & (size-1);
+          while (table[slot].first != UINT_MAX && table[slot].hash != hash)
+            slot = (slot + 1) & (size-1);
+          for (GLuint match = table[slot].first; match < v; match = next[match])
+          {
+            if (!duplicate(v, match)) continue;
+            ref[v] = match;
+            dups++;
+            break;
+          }
+        }
+      }
+      dupcount += dups;
+    }, threads);
 
-        //Add this normal to matched normal
-        if (normal)
-          normals[verts[match].id] += normals[verts[v].id];
+    //Resolve references to the first vertex of each merged group (always earlier, so already resolved)
+    //then add normals and colour values to it, in vertex order so sums do not depend on thread count
+    for (unsigned int v=0; v<count; v++)
+    {
+      GLuint match = ref[v] = ref[ref[v]];
+      if (match == v) continue;
+      if (mesh.vnormals)
+        normals[match] += normals[v];
+      if (colours)
+        colsum[match] += colsum[v];
+      vcount[match]++;
+    }
+    t2 = clock();
+    debug_print("  %.4lf seconds to replace duplicates (%d/%d) in %d shards\n", (t2-t1)/(double)CLOCKS_PER_SEC, dupcount.load(), count, shards);
+    t1 = clock();
+  }
+  else
+  {
+    for (unsigned int v=0; v<count; v++)
+      ref[v] = v;
+  }
 
-        //Colour value, add to matched
-        if (vertColour && geom[index]->colourData())
-          geom[index]->colourData()->value[verts[match].id] += geom[index]->colourData()->value[verts[v].id];
+  //Number the unique vertices in order, duplicates always follow the vertex they reference
+  std::vector<GLuint> newidx(count);
+  GLuint unique = 0;
+  mesh.indices.resize(count);
+  for (unsigned int v=0; v<count; v++)
+  {
+    if (ref[v] == v) newidx[v] = unique++;
+    mesh.indices[v] = newidx[ref[v]];
+  }
 
-        verts[match].vcount++;
-        verts[v].vcount = 0;
+  //Write the unique vertices, normalised normals and averaged colour values
+  mesh.vertices.resize(unique * 3);
+  if (mesh.vnormals) mesh.normals.resize(unique);
+  if (colours) mesh.values.resize(unique);
+  parallel_for(blocks, [&](unsigned int b)
+  {
+    unsigned int start = b * MESH_BLOCK;
+    unsigned int end = min(start + MESH_BLOCK, count);
+    for (unsigned int v=start; v<end; v++)
+    {
+      if (ref[v] != v) continue;
+      GLuint n = newidx[v];
+      memcpy(&mesh.vertices[n*3], g->vertices[v], sizeof(float) * 3);
+      if (mesh.vnormals)
+      {
+        normals[v].normalise();
+        mesh.normals[n] = normals[v];
       }
+      if (colours)
+        mesh.values[n] = colsum[v] / vcount[v];
     }
-    else
+  }, threads);
+  t2 = clock();
+  debug_print("  %.4lf seconds to write %d unique vertices\n", (t2-t1)/(double)CLOCKS_PER_SEC, unique);
+}
+
+uint64_t TriSurfaces::meshHash(int index, MeshData& mesh, int threads)
+{
+  //Hash of the source data and options an optimised mesh is built from,
+  //each block hashed in parallel then combined in order
+  GeomData* g = geom[index];
+  unsigned int count = g->count;
+  unsigned int blocks = (count + MESH_BLOCK - 1) / MESH_BLOCK;
+  FloatValues* colours = mesh.vertColour ? g->colourData() : NULL;
+  std::vector<uint64_t> bhash(blocks);
+  parallel_for(blocks, [&](unsigned int b)
+  {
+    unsigned int start = b * MESH_BLOCK;
+    unsigned int end = min(start + MESH_BLOCK, count);
+    uint64_t h = 0xCBF29CE484222325ULL;
+    const uint32_t* words = (const uint32_t*)g->vertices[start];
+    for (unsigned int i=0; i < (end-start)*3; i++)
+      h = (h ^ words[i]) * 0x100000001B3ULL;
+    if (colours)
     {
-      //First occurrence, following comparisons will be against this vertex...
-      match = v;
+      words = (const uint32_t*)&colours->value[start];
+      for (unsigned int i=0; i < end-start; i++)
+        h = (h ^ words[i]) * 0x100000001B3ULL;
     }
+    bhash[b] = h;
+  }, threads);
+
+  uint64_t hash = 0xCBF29CE484222325ULL ^ (uint64_t)count << 3 ^ (mesh.vnormals | mesh.optimise << 1 | mesh.vertColour << 2);
+  for (unsigned int b=0; b<blocks; b++)
+  {
+    hash = (hash ^ bhash[b]) * 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 29;
   }
-  t2 = clock();
-  debug_print("  %.4lf seconds to replace duplicates (%d/%d) \n", (t2-t1)/(double)CLOCKS_PER_SEC, dupcount, verts.size());
-  t1 = clock();
+  return hash;
+}
+
+void TriSurfaces::calcCentroids(int index, unsigned int offset, int threads)
+{
+  //Triangle centroids for sorting only, when optimised mesh data is already available
+  GeomData* g = geom[index];
+  unsigned int count = g->count;
+  unsigned int blocks = (count + MESH_BLOCK - 1) / MESH_BLOCK;
+  Vec3d* c = &centroids[offset];
+  parallel_for(blocks, [&](unsigned int b)
+  {
+    unsigned int start = b * MESH_BLOCK;
+    unsigned int end = min(start + MESH_BLOCK, count);
+    Vec3d* cv = c + start/3;
+    for (unsigned int v=start; v+2<end; v += 3)
+      centroid(cv, g->vertices[v], g->vertices[v+1], g->vertices[v+2]);
+  }, threads);
 }
 
 void TriSurfaces::calcTriangleNormalsWithIndices(int index)
@@ -617,10 +1088,9 @@ void TriSurfaces::calcTriangleNormalsWithIndices(int index)
 
   //Normalise to combine and load normal data
   for (unsigned int n=0; n<normals.size(); n++)
-  {
     normals[n].normalise();
-    read(geom[index], 1, lucNormalData, normals[n].ref());
-  }
+  if (normals.size())
+    read(geom[index], normals.size(), lucNormalData, &normals[0]);
   t2 = clock();
   debug_print("  %.4lf seconds to normalise (%d) \n", (t2-t1)/(double)CLOCKS_PER_SEC, normals.size());
 }
@@ -697,7 +1167,7 @@ void TriSurfaces::calcGridNormals(int i, std::vector<Vec3d> &normals)
   t1 = clock();
 }
 
-void TriSurfaces::calcGridIndices(int i, std::vector<GLuint> &indices)
+void TriSurfaces::calcGridIndices(int i, std::vector<GLuint> &indices, unsigned int offset)
 {
   //Normals: calculate from surface geometry
   clock_t t1,t2;
@@ -706,6 +1176,7 @@ void TriSurfaces::calcGridIndices(int i, std::vector<GLuint> &indices)
 
   // Calc pre-vertex normals for irregular meshes by averaging four surrounding triangle facet normals
   unsigned int o = 0;
+  Vec3d* c = &centroids[offset];
   for (unsigned int j = 0 ; j < geom[i]->height-1; j++ )
   {
     for (unsigned int k = 0 ; k < geom[i]->width-1; k++ )
@@ -717,12 +1188,12 @@ void TriSurfaces::calcGridIndices(int i, std::vector<GLuint> &indices)
       unsigned int offset3 = (j+1) * geom[i]->width + k + 1;
       assert(o <= indices.size()-6);
       //Tri 1
-      centroid(geom[i]->vertices[offset0], geom[i]->vertices[offset1], geom[i]->vertices[offset2]);
+      centroid(c, geom[i]->vertices[offset0], geom[i]->vertices[offset1], geom[i]->vertices[offset2]);
       indices[o++] = offset0;
       indices[o++] = offset1;
       indices[o++] = offset2;
       //Tri 2
-      centroid(geom[i]->vertices[offset1], geom[i]->vertices[offset3], geom[i]->vertices[offset2]);
+      centroid(c, geom[i]->vertices[offset1], geom[i]->vertices[offset3], geom[i]->vertices[offset2]);
       indices[o++] = offset1;
       indices[o++] = offset3;
       indices[o++] = offset2;
@@ -734,56 +1205,58 @@ void TriSurfaces::calcGridIndices(int i, std::vector<GLuint> &indices)
 }
 
 //Depth sort the triangles before drawing, called whenever the viewing angle has changed
-void TriSurfaces::depthSort()
+//Returns false if the previous order was kept
+bool TriSurfaces::depthSort()
 {
   //Skip if nothing to render or in 2d
-  if (tricount == 0 || elements == 0 || !view->is3d) return;
+  if (tricount == 0 || elements == 0 || !view->is3d) return true;
   clock_t t1,t2;
   t1 = clock();
-  assert(tidx);
 
-  //Calculate min/max distances from view plane
-  float maxdist, mindist;
-  view->getMinMaxDistance(&mindist, &maxdist);
+  //Skip sort if all opaque
+  if (sorter.size() == 0)
+  {
+    debug_print("No sort necessary\n");
+    return true;
+  }
 
-  //Update eye distances, clamping int distance to integer between 1 and 65534
-  float multiplier = (USHRT_MAX-1.0) / (maxdist - mindist);
-  unsigned int opaqueCount = 0;
-  float fdistance;
-  for (unsigned int i = 0; i < tricount; i++)
+  bool sorted = false;
+  bool background = backgroundSort();
+  if (view->sort)
   {
-    //Distance from viewing plane is -eyeZ
-    //Max dist 65535 reserved for opaque triangles
-    if (tidx[i].distance < USHRT_MAX)
+    //Calculate min/max distances from view plane
+    float maxdist, mindist;
+    view->getMinMaxDistance(&mindist, &maxdist);
+
+    //Update eye distances, quantised to integer keys and sort,
+    //reusing the previous order for small changes in view direction
+    int threads = drawstate.global("threads");
+    if (background)
+      sorter.request(view->modelView, mindist, maxdist, drawstate.global("sortskip"), threads);
+    else
     {
-      assert(tidx[i].vertex);
-      fdistance = eyeDistance(view->modelView, tidx[i].vertex);
-      fdistance = min(maxdist, max(mindist, fdistance)); //Clamp to range
-      tidx[i].distance = (unsigned short)(multiplier * (fdistance - mindist));
-      //if (i%10000==0) printf("%d : centroid %f %f %f\n", i, tidx[i].vertex[0], tidx[i].vertex[1], tidx[i].vertex[2]);
-      //Reverse as radix sort is ascending and we want to draw by distance descending
-      //tidx[i].distance = USHRT_MAX - (unsigned short)(multiplier * (fdistance - mindist));
-      //assert(tidx[i].distance >= 1 && tidx[i].distance <= USHRT_MAX);
+      sorter.wait();
+      sorted = sorter.update(view->modelView, mindist, maxdist, drawstate.global("sortskip"), threads);
     }
-    else
-      opaqueCount++;
   }
-  t2 = clock();
-  debug_print("  %.4lf seconds to calculate distances\n", (t2-t1)/(double)CLOCKS_PER_SEC);
-  t1 = clock();
 
-  //Skip sort if all opaque
-  if (opaqueCount == tricount) 
+  if (background)
   {
-    debug_print("No sort necessary\n");
-    return;
+    //Drawing continues with the previous order until the background sort completes
+    if (idxcount != elements)
+    {
+      //No previous order to draw, wait for this one
+      sorter.wait();
+      sorted = true;
+    }
+    else
+      sorted = sorter.collect();
   }
-
-  //Depth sort using 2-byte key radix sort, 10 times faster than equivalent quicksort
-  radix_sort<TIndex>(tidx, swap, tricount, 2);
   t2 = clock();
-  debug_print("  %.4lf seconds to sort %d triangles\n", (t2-t1)/(double)CLOCKS_PER_SEC, tricount);
+  if (!sorted) debug_print("  Sort skipped or not yet completed, previous order kept\n");
+  debug_print("  %.4lf seconds to sort %d triangles\n", (t2-t1)/(double)CLOCKS_PER_SEC, sorter.size());
   t1 = clock();
+  return sorted;
 }
 
 //Reloads triangle indices, required after data update and depth sort
@@ -791,25 +1264,18 @@ void TriSurfaces::render()
 {
   clock_t t1,t2;
   if (tricount == 0 || elements == 0) return;
-  assert(tidx);
+  assert(listed);
 
   //First, depth sort the triangles
-  if (view->is3d && view->sort)
-  {
-    depthSort();
-  }
-  else if (idxcount == elements)
+  bool sorted = false;
+  if (view->is3d && (view->sort || sorter.busy()))
+    sorted = depthSort();
+  if (!sorted && idxcount == elements)
   {
-    //Nothing has changed, skip
+    //Nothing has changed (or previous sort order kept), skip
     debug_print("Redraw skipped, cached %d == %d\n", idxcount, elements);
     return;
   }
-  if (tricount > total)
-  {
-    //Will overflow tidx buffer
-    fprintf(stderr, "Too many triangles! %d > %d\n", tricount, total);
-    tricount = total;
-  }
 
   t1 = clock();
 
@@ -817,6 +1283,14 @@ void TriSurfaces::render()
   if (!indexvbo)
     glGenBuffers(1, &indexvbo);
 
+  //Sorting in background, upload to the previous buffer, then draw from it
+  if (backgroundSort())
+  {
+    if (!backvbo)
+      glGenBuffers(1, &backvbo);
+    std::swap(indexvbo, backvbo);
+  }
+
   //Always set data size again in case changed
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexvbo);
   GL_Error_Check;
@@ -837,15 +1311,18 @@ void TriSurfaces::render()
   ptr = p = (unsigned char*)glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY);
   GL_Error_Check;
   if (!p) abort_program("glMapBuffer failed");
+  //Opaque triangles first
+  memcpy(ptr, opaqueidx.data(), sizeof(GLuint) * opaqueidx.size());
+  ptr += sizeof(GLuint) * opaqueidx.size();
+  idxcount = opaqueidx.size();
   //Reverse order farthest to nearest
-  idxcount = 0;
-  for(int i=tricount-1; i>=0; i--)
-  //for(int i=0; i<tricount; i++)
+  std::vector<SortKey>& order = sorter.order();
+  for(int i=sorter.size()-1; i>=0; i--)
   {
     idxcount += 3;
     assert((unsigned int)(ptr-p) < 3 * tricount * sizeof(GLuint));
     //Copies index bytes
-    memcpy(ptr, tidx[i].index, sizeof(GLuint) * 3);
+    memcpy(ptr, &tidx[order[i].index*3], sizeof(GLuint) * 3);
     ptr += sizeof(GLuint) * 3;
   }
   glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
@@ -860,10 +1337,17 @@ void TriSurfaces::render()
 void TriSurfaces::draw()
 {
   GL_Error_Check;
+  //Reload the list if objects have moved in or out of view
+  if (listed && cull())
+  {
+    loadList();
+    elements = tricount * 3;
+    idxcount = 0;
+  }
   if (elements == 0) return;
 
   //Re-render the triangles if view has rotated
-  if (view->sort || idxcount != elements) render();
+  if (view->sort || idxcount != elements || sorter.busy()) render();
 
   // Draw using vertex buffer object
   clock_t t0 = clock();
@@ -40,8 +40,8 @@
 
 FILE* infostream = NULL;
 
-long membytes__ = 0;
-long mempeak__ = 0;
+std::atomic<long> membytes__(0);
+std::atomic<long> mempeak__(0);
 
 void abort_program(const char * s, ...)
 {
@@ -295,6 +295,49 @@ bool Properties::typecheck(json& val, json& def)
   return false;
 }
 
+void parallel_for(unsigned int count, const std::function<void(unsigned int)>& func, unsigned int threads)
+{
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads > count) threads = count;
+  if (threads <= 1)
+  {
+    for (unsigned int i=0; i<count; i++)
+      func(i);
+    return;
+  }
+
+  //Workers take the next index until all done, first error is passed back to caller
+  std::atomic<unsigned int> next(0);
+  std::exception_ptr error = NULL;
+  std::mutex error_mutex;
+  auto worker = [&]()
+  {
+    unsigned int i;
+    while ((i = next++) < count)
+    {
+      try
+      {
+        func(i);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> guard(error_mutex);
+        if (!error) error = std::current_exception();
+        next = count;
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for (unsigned int t=1; t<threads; t++)
+    pool.push_back(std::thread(worker));
+  worker();
+  for (unsigned int t=0; t<pool.size(); t++)
+    pool[t].join();
+
+  if (error) std::rethrow_exception(error);
+}
+
 void debug_print(const char *fmt, ...)
 {
   if (fmt == NULL || infostream == NULL) return;
@@ -121,9 +121,13 @@ public:
 
 std::string GetBinaryPath(const char* argv0, const char* progname);
 
+//Run func(i) for i = 0..count-1 on worker threads (threads=0: one per core)
+void parallel_for(unsigned int count, const std::function<void(unsigned int)>& func, unsigned int threads=0);
+
 //General purpose geometry data store types...
-extern long membytes__;
-extern long mempeak__;
+//Geometry memory usage counters (updated from loader threads)
+extern std::atomic<long> membytes__;
+extern std::atomic<long> mempeak__;
 
 class DataContainer
 {
@@ -137,6 +141,7 @@ public:
   std::string label;
 
   DataContainer() : next(0), datasize(1), offset(0), minimum(0), maximum(1), label("") {}
+  virtual ~DataContainer() {}
 
   //Pure virtual methods
   virtual unsigned int bytes() = 0;
@@ -146,6 +151,7 @@ public:
   virtual void setOffset() = 0;
   virtual void erase(unsigned int start, unsigned int end) = 0;
   virtual void* ref(unsigned i=0) = 0;
+  virtual void adopt(DataContainer* other) = 0;
 
   void setup(float min, float max)
   {
@@ -180,7 +186,25 @@ public:
   std::vector<dtype> value;
 
   DataValues() {}
-  virtual ~DataValues() {};
+  DataValues(const DataValues& other) : DataContainer(other), value(other.value)
+  {
+    membytes__ += sizeof(dtype)*value.size();
+    if (membytes__ > mempeak__) mempeak__ = membytes__.load();
+  }
+
+  virtual ~DataValues()
+  {
+    //Keep memory usage counter in sync when freed without clear()
+    membytes__ -= sizeof(dtype)*value.size();
+  }
+
+  DataValues& operator=(const DataValues& other)
+  {
+    membytes__ += (long)sizeof(dtype)*((long)other.value.size() - (long)value.size());
+    DataContainer::operator=(other);
+    value = other.value;
+    return *this;
+  }
 
   unsigned int bytes() {return sizeof(dtype)*size();}
 
@@ -194,7 +218,8 @@ public:
       if (size < oldsize*2) size = oldsize*2;
       resize(size);
     }
-    memcpy(&value[next], data, n * sizeof(dtype));
+    //NULL data reserves space to be filled in place
+    if (data) memcpy(&value[next], data, n * sizeof(dtype));
     next += n;
   }
 
@@ -215,9 +240,11 @@ public:
     unsigned int oldsize = value.size();
     if (oldsize < size)
     {
+      //Allocate exactly the requested size so usage counter matches
+      value.reserve(size);
       value.resize(size);
       membytes__ += sizeof(dtype)*(size-oldsize);
-      if (membytes__ > mempeak__) mempeak__ = membytes__;
+      if (membytes__ > mempeak__) mempeak__ = membytes__.load();
       //printf("============== MEMORY total %.3f mb, added %d ==============\n", membytes__/1000000.0f, (size-oldsize));
     }
   }
@@ -233,6 +260,40 @@ public:
     //printf("============== MEMORY total %.3f mb, removed %d ==============\n", membytes__/1000000.0f, count);
   }
 
+  //Take over the data of another store of the same type without copying,
+  //(copies if this store already has data or types differ)
+  void adopt(DataContainer* other)
+  {
+    DataValues<dtype>* src = dynamic_cast<DataValues<dtype>*>(other);
+    if (!src || next > 0)
+    {
+      DataValues<dtype>::read(other->bytes() / sizeof(dtype), other->ref());
+      other->clear();
+      return;
+    }
+    //Swap storage, both remain counted in memory usage until source cleared
+    value.swap(src->value);
+    next = src->next;
+    offset = 0;
+    src->next = 0;
+    src->clear();
+  }
+
+  void adopt(std::vector<dtype>& data)
+  {
+    if (next > 0)
+    {
+      DataValues<dtype>::read(data.size(), data.data());
+      data.clear();
+      return;
+    }
+    clear();
+    value.swap(data);
+    next = value.size();
+    membytes__ += sizeof(dtype)*value.size();
+    if (membytes__ > mempeak__) mempeak__ = membytes__.load();
+  }
+
   //Update saved position
   void setOffset()
   {
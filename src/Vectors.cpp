@@ -42,17 +42,20 @@ Vectors::Vectors(DrawState& drawstate) : Glyphs(drawstate)
 
 void Vectors::update()
 {
-  //Convert vectors to triangles
+  //Convert vectors to triangles, or arrow template instances when supported
   lines->clear();
   tris->clear();
+  instances->reset();
+  bool instanced = !tessellate && Instances::supported(drawstate);
   clock_t t1,tt;
   tt=clock();
   int tot = 0;
   Vec3d scale(view->scale);
   tris->unscale = view->scale[0] != 1.0 || view->scale[1] != 1.0 || view->scale[2] != 1.0;
   tris->iscale = Vec3d(1.0/view->scale[0], 1.0/view->scale[1], 1.0/view->scale[2]);
+  instances->unscale = tris->unscale;
+  instances->iscale = tris->iscale;
   float minL = view->model_size * 0.01; //Minimum length for visibility
-  Colour colour;
   for (unsigned int i=0; i<geom.size(); i++)
   {
     if (geom[i]->vectors.size() < geom[i]->count) continue;
@@ -88,34 +91,80 @@ void Vectors::update()
 
     geom[i]->colourCalibrate();
     bool flat = props["flat"] || quality < 1;
+    if (instanced && !flat)
+      instances->add(geom[i]->draw, GLYPH_ARROW, quality);
 
-    for (unsigned int v=0; v < geom[i]->count; v++)
+    //Arrow head size as a multiple of radius (see drawVector)
+    float head = arrowHead;
+    if (head > 0 && head < 1.0)
+      head = 0.5 * head / RADIUS_DEFAULT_RATIO;
+
+    bool visible = drawable(i);
+
+    //Arrows for a range of elements, called on worker threads
+    GlyphGenerator arrows = [&](Geometry* tris, Geometry* lines, Instances* instances, DrawingObject* draw, unsigned int start, unsigned int end)
     {
-      if (!drawable(i) || geom[i]->filter(v)) continue;
-      Vec3d pos(geom[i]->vertices[v]);
-      Vec3d vec(geom[i]->vectors[v]);
-      geom[i]->getColour(colour, v);
-
-      //Always draw the lines so when zoomed out shaft visible (prevents visible boundary between 2d/3d renders)
-      lines->drawVector(geom[i]->draw, pos.ref(), vec.ref(), scaling, radius, radius, arrowHead, 0);
-      //Per arrow colours (can do this as long as sub-renderer always outputs same tri count)
-      lines->read(geom[i]->draw, 1, lucRGBAData, &colour.value);
-
-      //Scale position & vector manually (global scaling is disabled to avoid distorting glyphs)
-      if (tris->unscale)
+      Colour colour;
+      for (unsigned int v=start; v < end; v++)
       {
-        pos *= scale;
-        vec *= scale;
-      }
+        if (!visible || geom[i]->filter(v)) continue;
+        Vec3d pos(geom[i]->vertices[v]);
+        Vec3d vec(geom[i]->vectors[v]);
+        geom[i]->getColour(colour, v);
 
-      if (!flat && vec.magnitude() * scaling >= minL)
-      {
-        tris->drawVector(geom[i]->draw, pos.ref(), vec.ref(), scaling, radius, radius, arrowHead, quality);
+        //Always draw the lines so when zoomed out shaft visible (prevents visible boundary between 2d/3d renders)
+        lines->drawVector(draw, pos.ref(), vec.ref(), scaling, radius, radius, arrowHead, 0);
         //Per arrow colours (can do this as long as sub-renderer always outputs same tri count)
-        tris->read(geom[i]->draw, 1, lucRGBAData, &colour.value);
+        lines->read(draw, 1, lucRGBAData, &colour.value);
+
+        //Scale position & vector manually (global scaling is disabled to avoid distorting glyphs)
+        if (tris->unscale)
+        {
+          pos *= scale;
+          vec *= scale;
+        }
+
+        if (!flat && vec.magnitude() * scaling >= minL && instanced)
+        {
+          //Arrow dimensions and orientation as calculated by drawVector
+          float length = vec.magnitude() * scaling;
+          if (length < FLT_EPSILON || std::isinf(length)) continue;
+          float r = radius > 0 ? radius : length * RADIUS_DEFAULT_RATIO;
+          float hr = head > 0 ? head * r : 0;
+          float headD = hr * 2;
+          if (length <= headD)
+          {
+            headD = length;
+            hr = length * 0.5;
+          }
+          if (hr <= 1.0e-7) hr = headD = 0;
+          float dims[4] = {r, hr, length, headD};
+
+          Quaternion rot;
+          Vec3d rvector(vec);
+          rvector.normalise();
+          float rangle = RAD2DEG * rvector.angle(Vec3d(0.0, 0.0, 1.0));
+          if (rangle == 180.0)
+          {
+            rot.y = 1;
+            rot.w = 0.0;
+          }
+          else if (rangle > 0.0)
+          {
+            rot.fromAxisAngle(Vec3d(-rvector.y, rvector.x, 0), rangle);
+          }
+          instances->push(pos, rot, dims, colour);
+        }
+        else if (!flat && vec.magnitude() * scaling >= minL)
+        {
+          tris->drawVector(draw, pos.ref(), vec.ref(), scaling, radius, radius, arrowHead, quality);
+          //Per arrow colours (can do this as long as sub-renderer always outputs same tri count)
+          tris->read(draw, 1, lucRGBAData, &colour.value);
+        }
       }
+    };
 
-    }
+    generate(geom[i]->draw, geom[i]->count, flat || instanced ? 0 : quality, arrows);
 
     //Adjust bounding box
     //tris->compareMinMax(geom[i]->min, geom[i]->max);
@@ -229,6 +229,39 @@ void View::getMinMaxDistance(float* mindist, float* maxdist)
   //printf("DISTANCE MIN %f MAX %f\n", *mindist, *maxdist);
 }
 
+void View::getFrustum()
+{
+  //Save clip planes, extracted from combined projection and modelview matrices
+  float P[16], C[16];
+  glGetFloatv(GL_PROJECTION_MATRIX, P);
+  glGetFloatv(GL_MODELVIEW_MATRIX, modelView);
+  for (int j=0; j<4; j++)
+    for (int i=0; i<4; i++)
+      C[j*4+i] = P[i] * modelView[j*4] + P[4+i] * modelView[j*4+1] + P[8+i] * modelView[j*4+2] + P[12+i] * modelView[j*4+3];
+  //Left, right, bottom, top, near, far
+  for (int p=0; p<6; p++)
+  {
+    int row = p / 2;
+    float sign = p % 2 ? -1.0 : 1.0;
+    for (int j=0; j<4; j++)
+      frustum[p][j] = C[j*4+3] + sign * C[j*4+row];
+  }
+}
+
+bool View::boxVisible(const float* bmin, const float* bmax)
+{
+  //Box is outside if the corner furthest along any clip plane normal is behind it
+  for (int p=0; p<6; p++)
+  {
+    float* f = frustum[p];
+    float x = f[0] > 0 ? bmax[0] : bmin[0];
+    float y = f[1] > 0 ? bmax[1] : bmin[1];
+    float z = f[2] > 0 ? bmax[2] : bmin[2];
+    if (f[0] * x + f[1] * y + f[2] * z + f[3] < 0) return false;
+  }
+  return true;
+}
+
 void View::autoRotate()
 {
   //If model is 2d plane on X or Y axis, rotate to face camera
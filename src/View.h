@@ -138,6 +138,7 @@ public:
   float eye_shift;           // Stereo eye shift factor
   float eye_sep_ratio;       // Eye separation ratio to focal length
   float modelView[16];
+  float frustum[6][4];       // Clip planes from last getFrustum()
   float scale2d;
 
   View(DrawState& drawstate, float xf = 0, float yf = 0, float nearc = 0.0f, float farc = 0.0f);
@@ -150,6 +151,8 @@ public:
   bool init(bool force=false, float* newmin=NULL, float* newmax=NULL);
   void checkClip(float& near_clip, float& far_clip);
   void getMinMaxDistance(float* mindist, float* maxdist);
+  void getFrustum();
+  bool boxVisible(const float* bmin, const float* bmax);
   void autoRotate();
   std::string rotateString();
   std::string translateString();
@@ -41,4 +41,14 @@ typedef enum
   lucMaxDataType
 } lucGeometryDataType;
 
+/* Compression codecs for geometry data blobs */
+typedef enum
+{
+  lucCodecAuto = -1,      //No codec stored (older databases), zlib compressed if smaller than data
+  lucCodecNone,
+  lucCodecDeflate,        //zlib
+  lucCodecShuffleDeflate, //Bytes of 4 byte elements grouped by significance then zlib
+  lucMaxCodec
+} lucBlobCodec;
+
 #endif /* Types__ */
@@ -36,6 +36,118 @@
 #include "Geometry.h"
 #include "IsoSurface.h"
 
+//Voxels of a volume in the layout uploaded to its texture, either a
+//single cube or a stack of slices, with any texture crop applied
+class VolumeData
+{
+public:
+  std::vector<GLubyte*> slices;
+  unsigned int dims[3];
+  unsigned int offset[2];
+  unsigned int width;
+  unsigned int bpv;
+  int type;
+
+  VolumeData(std::vector<GeomData*>& geom, unsigned int i, unsigned int count, bool texcompress);
+
+  GLubyte* row(unsigned int y, unsigned int z)
+  {
+    return slices[z] + ((offset[1] + y) * width + offset[0]) * bpv;
+  }
+
+  //Value as sampled from the texture, first channel, bytes normalised to [0,1]
+  float value(unsigned int x, unsigned int y, unsigned int z)
+  {
+    GLubyte* voxel = row(y, z) + x * bpv;
+    if (type == VOLUME_FLOAT) return *(float*)voxel;
+    return voxel[0] / 255.0;
+  }
+};
+
+VolumeData::VolumeData(std::vector<GeomData*>& geom, unsigned int i, unsigned int count, bool texcompress)
+  : width(geom[i]->width), bpv(0), type(VOLUME_NONE)
+{
+  dims[0] = geom[i]->width;
+  dims[1] = geom[i]->height;
+  dims[2] = geom[i]->depth > 1 ? geom[i]->depth : count;
+  offset[0] = offset[1] = 0;
+
+  //Single volume cube
+  if (geom[i]->depth > 1)
+  {
+    GLubyte* data = NULL;
+    if (geom[i]->colours.size() > 0)
+    {
+      bpv = 4;
+      type = texcompress ? VOLUME_RGBA_COMPRESSED : VOLUME_RGBA;
+      data = (GLubyte*)geom[i]->colours.ref();
+    }
+    else if (geom[i]->luminance.size() > 0)
+    {
+      bpv = 1;
+      type = texcompress ? VOLUME_BYTE_COMPRESSED : VOLUME_BYTE;
+      data = (GLubyte*)geom[i]->luminance.ref();
+    }
+    else if (geom[i]->colourData())
+    {
+      bpv = 4;
+      type = VOLUME_FLOAT;
+      data = (GLubyte*)geom[i]->colourData()->ref();
+    }
+    if (data)
+    {
+      for (unsigned int z=0; z<dims[2]; z++)
+        slices.push_back(data + z * dims[0] * dims[1] * bpv);
+    }
+    return;
+  }
+
+  //Collection of 2D slices, texture crop?
+  DrawingObject* current = geom[i]->draw;
+  unsigned int texsize[3], texoffset[3];
+  Properties::toArray<unsigned int>(current->properties["texturesize"], texsize, 3);
+  Properties::toArray<unsigned int>(current->properties["textureoffset"], texoffset, 3);
+  for (int d=0; d<3; d++)
+  {
+    if (texsize[d] > 0 && texsize[d] < dims[d])
+      dims[d] = texsize[d];
+  }
+  offset[0] = texoffset[0];
+  offset[1] = texoffset[1];
+
+  for (unsigned int j=i; j<i+dims[2]; j++)
+  {
+    if (geom[i]->colours.size() > 0)
+    {
+      bpv = 4;
+      type = texcompress ? VOLUME_RGBA_COMPRESSED : VOLUME_RGBA;
+      slices.push_back((GLubyte*)geom[j]->colours.ref());
+    }
+    else if (geom[i]->rgb.size() > 0)
+    {
+      bpv = 3;
+      type = texcompress ? VOLUME_RGB_COMPRESSED : VOLUME_RGB;
+      slices.push_back((GLubyte*)geom[j]->rgb.ref());
+    }
+    else if (geom[i]->luminance.size() > 0)
+    {
+      bpv = 1;
+      type = texcompress ? VOLUME_BYTE_COMPRESSED : VOLUME_BYTE;
+      slices.push_back((GLubyte*)geom[j]->luminance.ref());
+    }
+    else if (geom[i]->colourData())
+    {
+      //Float luminance or bytes packed into float container
+      bpv = (4 * geom[i]->colourData()->size()) / (float)(geom[i]->width * geom[i]->height);
+      if (bpv == 1)
+        type = texcompress ? VOLUME_BYTE_COMPRESSED : VOLUME_BYTE;
+      else
+        type = VOLUME_FLOAT;
+      slices.push_back((GLubyte*)geom[j]->colourData()->ref());
+    }
+  }
+}
+
 Volumes::Volumes(DrawState& drawstate) : Geometry(drawstate)
 {
   type = lucVolumeType;
@@ -47,6 +159,8 @@ Volumes::Volumes(DrawState& drawstate) : Geometry(drawstate)
 Volumes::~Volumes()
 {
   delete twoTriangles;
+  for (auto& t : textures)
+    freeTextures(t.second);
 }
 
 void Volumes::close()
@@ -63,11 +177,80 @@ void Volumes::close()
     {
       delete geom[i]->texture;
       geom[i]->texture = NULL;
+      if (textures.find(geom[i]->draw) != textures.end())
+        freeTextures(textures[geom[i]->draw]);
       reload = true;
     }
   }
 }
 
+void Volumes::freeTextures(VolumeTextures& vt)
+{
+  for (auto block : vt.blocks)
+    delete block.texture;
+  vt.blocks.clear();
+  for (auto level : vt.levels)
+    delete level;
+  vt.levels.clear();
+  vt.level = 0;
+  if (vt.brickmap) delete vt.brickmap;
+  vt.brickmap = NULL;
+  vt.occupied.clear();
+}
+
+size_t Volumes::gpuMemory()
+{
+  //Volume textures, compressed formats counted at uncompressed size
+  size_t bytes = twoTriangles->gpuMemory();
+  std::vector<ImageLoader*> volumes;
+  for (unsigned int i=0; i<geom.size(); i++)
+  {
+    if (!geom[i]->texture || !geom[i]->texture->texture) continue;
+    //Split volumes are stored in blocks, the object texture only holds the dimensions
+    auto it = textures.find(geom[i]->draw);
+    if (it != textures.end() && it->second.blocks.size())
+    {
+      for (auto block : it->second.blocks)
+        volumes.push_back(block.texture);
+    }
+    else
+      volumes.push_back(geom[i]->texture);
+    //Reduced resolution levels
+    if (it != textures.end())
+    {
+      for (auto level : it->second.levels)
+        if (level) volumes.push_back(level);
+    }
+  }
+
+  for (auto vol : volumes)
+  {
+    TextureData* tex = vol->texture;
+    size_t texel = 1;
+    switch (vol->type)
+    {
+    case VOLUME_FLOAT:
+    case VOLUME_RGBA:
+    case VOLUME_RGBA_COMPRESSED:
+      texel = 4;
+      break;
+    case VOLUME_RGB:
+    case VOLUME_RGB_COMPRESSED:
+      texel = 3;
+      break;
+    }
+    bytes += (size_t)tex->width * tex->height * max(1, (int)tex->depth) * texel;
+  }
+
+  //Brick maps, one byte per brick
+  for (auto& t : textures)
+  {
+    if (t.second.brickmap)
+      bytes += t.second.bricks.count();
+  }
+  return bytes;
+}
+
 void Volumes::draw()
 {
   //clock_t t1,t2,tt;
@@ -94,6 +277,10 @@ void Volumes::draw()
   glUseProgram(0);
   glBindTexture(GL_TEXTURE_3D, 0);
   glBindTexture(GL_TEXTURE_2D, 0);
+  //Brick map
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_3D, 0);
+  glActiveTexture(GL_TEXTURE0);
   //t2 = clock(); debug_print("  Draw %.4lf seconds.\n", (t2-tt)/(double)CLOCKS_PER_SEC);
 
 }
@@ -155,6 +342,11 @@ void Volumes::update()
     //Required to cache colour value info
     geom[i]->colourCalibrate();
 
+    //Volumes beyond the texture size limit are split into blocks
+    unsigned int limit = maxtex;
+    int texlimit = geom[i]->draw->properties["texturelimit"];
+    if (texlimit > 0 && texlimit < maxtex) limit = texlimit;
+
     //Single volume cube
     if (geom[i]->depth > 1)
     {
@@ -163,9 +355,16 @@ void Volumes::update()
       if (!geom[i]->texture || !geom[i]->texture->texture || geom[i]->texture->texture->width == 0) //Width set to 0 to flag reload
       {
         //Determine type of data then load the texture
-        if (!geom[i]->texture) geom[i]->texture = new ImageLoader(); //Add a new texture container
         unsigned int bpv = 4;
-        if (geom[i]->colours.size() > 0)
+        bool split = geom[i]->width > limit || geom[i]->height > limit || geom[i]->depth > limit;
+        freeTextures(textures[current]);
+        if (split)
+          loadBlocks(i, limit, texcompress);
+        else if (!geom[i]->texture) geom[i]->texture = new ImageLoader(); //Add a new texture container
+
+        if (split)
+          debug_print("volume %d split into %d blocks\n", i, textures[current].blocks.size());
+        else if (geom[i]->colours.size() > 0)
         {
           int type = texcompress ? VOLUME_RGBA_COMPRESSED : VOLUME_RGBA;
           geom[i]->texture->load3D(geom[i]->width, geom[i]->height, geom[i]->depth, geom[i]->colours.ref(), type);
@@ -183,6 +382,8 @@ void Volumes::update()
           geom[i]->texture->load3D(geom[i]->width, geom[i]->height, geom[i]->depth, geom[i]->colourData()->ref(), VOLUME_FLOAT);
         }
         debug_print("volume %d width %d height %d depth %d (bpv %d)\n", i, geom[i]->width, geom[i]->height, geom[i]->depth, bpv);
+        loadBricks(i, texcompress);
+        loadLevels(i, limit, texcompress);
       }
       continue;
     }
@@ -211,7 +412,7 @@ void Volumes::update()
       Properties::toArray<unsigned int>(current->properties["texturesize"], texsize, 3);
       Properties::toArray<unsigned int>(current->properties["textureoffset"], texoffset, 3);
       unsigned int dims[3] = {geom[i]->width, geom[i]->height, slices[current]};
-      bool crop = false;
+      bool crop = false, split = false;
       for (int d=0; d<3; d++)
       {
         if (texsize[d] > 0 && texsize[d] < dims[d]) 
@@ -221,17 +422,20 @@ void Volumes::update()
         }
         if (texoffset[d] > 0) crop = true;
         //Check within tex limits
-        assert(dims[d] <= (unsigned)maxtex);
+        if (dims[d] > limit) split = true;
       }
       if (crop)
         debug_print("Cropping volume %d x %d ==> %d x %d @ %d,%d\n", geom[i]->width, geom[i]->height, dims[0], dims[1], (int)texoffset[0], (int)texoffset[1]);
 
       //Init/allocate/bind texture
-      if (!geom[i]->texture) geom[i]->texture = new ImageLoader(); //Add a new texture container
+      freeTextures(textures[current]);
+      if (!split && !geom[i]->texture) geom[i]->texture = new ImageLoader(); //Add a new texture container
       unsigned int bpv = 4;
       int type = 0;
       GL_Error_Check;
-      if (geom[i]->colours.size() > 0)
+      if (split)
+        loadBlocks(i, limit, texcompress);
+      else if (geom[i]->colours.size() > 0)
       {
         //RGBA colours
         type = texcompress ? VOLUME_RGBA_COMPRESSED : VOLUME_RGBA;
@@ -322,6 +526,8 @@ void Volumes::update()
 
       //Calibrate on data now so if colour bar drawn it will have correct range
       geom[i]->colourCalibrate();
+      loadBricks(i, texcompress);
+      loadLevels(i, limit, texcompress);
     }
 
     //Setup gradient texture from colourmap
@@ -332,10 +538,303 @@ void Volumes::update()
   //Restore padding
   glPopClientAttrib();
   GL_Error_Check;
+
+  //Release textures of volume objects no longer present
+  for (auto it = textures.begin(); it != textures.end(); )
+  {
+    if (slices.find(it->first) == slices.end())
+    {
+      freeTextures(it->second);
+      it = textures.erase(it);
+    }
+    else
+      ++it;
+  }
+
   t2 = clock();
   debug_print("  Total %.4lf seconds.\n", (t2-tt)/(double)CLOCKS_PER_SEC);
 }
 
+void Volumes::loadBlocks(unsigned int i, unsigned int limit, bool texcompress)
+{
+  //Split a volume too large for a single texture into blocks, each block texture
+  //includes an apron of neighbouring voxels from the adjacent blocks so interpolation,
+  //isosurface normals and the step back into the previous block are seamless
+  DrawingObject* draw = geom[i]->draw;
+  VolumeData data(geom, i, slices[draw], texcompress);
+  VolumeTextures& vt = textures[draw];
+  freeTextures(vt);
+  if (data.type == VOLUME_NONE) return;
+  if (limit < 4) limit = 4;
+
+  //Apron covers one ray step and the normal sampling offset plus a voxel for interpolation
+  int samples = draw->properties["samples"];
+  float isosmooth = draw->properties["isosmooth"];
+  if (samples < 1) samples = 1;
+  unsigned int count[3], size[3], apron[3];
+  for (int d=0; d<3; d++)
+  {
+    apron[d] = 1 + ceil(1.732 * data.dims[d] / samples + fabs(isosmooth));
+    if (apron[d] > (limit - 2) / 2) apron[d] = (limit - 2) / 2;
+    unsigned int inner = limit - 2 * apron[d];
+    count[d] = data.dims[d] <= limit ? 1 : (data.dims[d] + inner - 1) / inner;
+    size[d] = (data.dims[d] + count[d] - 1) / count[d];
+  }
+
+  std::vector<GLubyte> buffer;
+  for (unsigned int bz=0; bz<count[2]; bz++)
+  {
+    for (unsigned int by=0; by<count[1]; by++)
+    {
+      for (unsigned int bx=0; bx<count[0]; bx++)
+      {
+        VolumeBlock block;
+        unsigned int b[3] = {bx, by, bz}, res[3];
+        for (int d=0; d<3; d++)
+        {
+          block.offset[d] = b[d] * size[d];
+          block.size[d] = min(size[d], data.dims[d] - block.offset[d]);
+          block.start[d] = block.offset[d] > apron[d] ? block.offset[d] - apron[d] : 0;
+          res[d] = min(block.offset[d] + block.size[d] + apron[d], data.dims[d]) - block.start[d];
+        }
+
+        //Copy the block a slice at a time
+        block.texture = new ImageLoader();
+        block.texture->load3D(res[0], res[1], res[2], NULL, data.type);
+        unsigned int rowbytes = res[0] * data.bpv;
+        buffer.resize(rowbytes * res[1]);
+        for (unsigned int z=0; z<res[2]; z++)
+        {
+          for (unsigned int y=0; y<res[1]; y++)
+            memcpy(&buffer[y * rowbytes], data.row(block.start[1] + y, block.start[2] + z) + block.start[0] * data.bpv, rowbytes);
+          block.texture->load3Dslice(z, buffer.data());
+        }
+        vt.blocks.push_back(block);
+        GL_Error_Check;
+      }
+    }
+  }
+  debug_print("Volume %d x %d x %d exceeds texture limit %d, loaded as %d x %d x %d blocks\n",
+              data.dims[0], data.dims[1], data.dims[2], limit, count[0], count[1], count[2]);
+
+  //The object texture stands in for the blocks, holding type and dimensions only
+  if (!geom[i]->texture) geom[i]->texture = new ImageLoader();
+  if (!geom[i]->texture->texture) geom[i]->texture->texture = new TextureData();
+  TextureData* tex = geom[i]->texture->texture;
+  geom[i]->texture->type = data.type;
+  tex->width = data.dims[0];
+  tex->height = data.dims[1];
+  tex->depth = data.dims[2];
+}
+
+void Volumes::loadBricks(unsigned int i, bool texcompress)
+{
+  //Summarise value ranges in bricks, rebuilt whenever the volume texture is reloaded
+  DrawingObject* draw = geom[i]->draw;
+  VolumeTextures& vt = textures[draw];
+  vt.bricks = VolumeBricks();
+  vt.occupied.clear();
+  VolumeData data(geom, i, slices[draw], texcompress);
+  for (int d=0; d<3; d++)
+    vt.res[d] = data.dims[d];
+  vt.type = data.type;
+
+  //Compressed textures are lossy, ranges of the source data would not bound the sampled values
+  unsigned int size = draw->properties["bricksize"];
+  if (size == 0 || texcompress || data.type == VOLUME_NONE) return;
+
+  clock_t t1 = clock();
+  vt.bricks.build(data.dims, size, [&](unsigned int x, unsigned int y, unsigned int z) {return data.value(x, y, z);}, drawstate.global("threads"));
+  debug_print("Volume bricks %d x %d x %d of size %d took %.4lf seconds.\n", vt.bricks.dims[0], vt.bricks.dims[1], vt.bricks.dims[2], size, (clock()-t1)/(double)CLOCKS_PER_SEC);
+}
+
+void Volumes::loadLevels(unsigned int i, unsigned int limit, bool texcompress)
+{
+  //Reduced resolution copies of the volume to draw while the view is moving,
+  //each level halves the last by averaging or taking the maximum of 2x2x2 voxels
+  DrawingObject* draw = geom[i]->draw;
+  VolumeTextures& vt = textures[draw];
+  unsigned int count = draw->properties["texturelevels"];
+  if (count == 0) return;
+  VolumeData data(geom, i, slices[draw], texcompress);
+  if (data.type == VOLUME_NONE) return;
+  std::string filter = draw->properties["levelfilter"];
+  bool maxfilter = filter == "max";
+
+  clock_t t1 = clock();
+  unsigned int bpv = data.bpv;
+  unsigned int dims[3] = {data.dims[0], data.dims[1], data.dims[2]};
+  std::vector<GLubyte> source, level;
+  //Rows of the level being reduced, first level is read from the volume data
+  auto row = [&](unsigned int y, unsigned int z) -> GLubyte*
+  {
+    if (source.empty()) return data.row(y, z);
+    return &source[((size_t)z * dims[1] + y) * dims[0] * bpv];
+  };
+
+  for (unsigned int l=0; l<count; l++)
+  {
+    unsigned int ldims[3];
+    for (int d=0; d<3; d++)
+      ldims[d] = (dims[d] + 1) / 2;
+    level.resize((size_t)ldims[0] * ldims[1] * ldims[2] * bpv);
+
+    parallel_for(ldims[2], [&](unsigned int z)
+    {
+      //Odd dimensions repeat the last voxel
+      unsigned int z1 = min(2*z+1, dims[2]-1);
+      for (unsigned int y=0; y<ldims[1]; y++)
+      {
+        unsigned int y1 = min(2*y+1, dims[1]-1);
+        GLubyte* rows[4] = {row(2*y, 2*z), row(y1, 2*z), row(2*y, z1), row(y1, z1)};
+        GLubyte* out = &level[((size_t)z * ldims[1] + y) * ldims[0] * bpv];
+        for (unsigned int x=0; x<ldims[0]; x++)
+        {
+          unsigned int xs[2] = {2*x*bpv, min(2*x+1, dims[0]-1)*bpv};
+          if (data.type == VOLUME_FLOAT)
+          {
+            float v = maxfilter ? -HUGE_VALF : 0.0;
+            for (int r=0; r<4; r++)
+            {
+              for (int s=0; s<2; s++)
+              {
+                float f = *(float*)(rows[r] + xs[s]);
+                if (!maxfilter) v += f;
+                else if (f > v) v = f;
+              }
+            }
+            ((float*)out)[x] = maxfilter ? v : v * 0.125;
+          }
+          else
+          {
+            //Byte channels filtered independently
+            for (unsigned int c=0; c<bpv; c++)
+            {
+              unsigned int v = 0;
+              for (int r=0; r<4; r++)
+              {
+                for (int s=0; s<2; s++)
+                {
+                  unsigned int b = rows[r][xs[s] + c];
+                  if (!maxfilter) v += b;
+                  else if (b > v) v = b;
+                }
+              }
+              out[x*bpv+c] = maxfilter ? v : (v + 4) / 8;
+            }
+          }
+        }
+      }
+    }, drawstate.global("threads"));
+
+    //Only levels within the texture limit are loaded
+    ImageLoader* tex = NULL;
+    if (ldims[0] <= limit && ldims[1] <= limit && ldims[2] <= limit)
+    {
+      tex = new ImageLoader();
+      tex->load3D(ldims[0], ldims[1], ldims[2], level.data(), data.type);
+      GL_Error_Check;
+    }
+    vt.levels.push_back(tex);
+    debug_print("Volume level %d: %d x %d x %d%s\n", l+1, ldims[0], ldims[1], ldims[2], tex ? "" : " (exceeds texture limit)");
+
+    source.swap(level);
+    for (int d=0; d<3; d++)
+      dims[d] = ldims[d];
+    if (dims[0] == 1 && dims[1] == 1 && dims[2] == 1) break;
+  }
+  debug_print("Volume levels (%s filter) took %.4lf seconds.\n", maxfilter ? "max" : "box", (clock()-t1)/(double)CLOCKS_PER_SEC);
+}
+
+unsigned int Volumes::selectLevel(VolumeTextures& vt, const float* modelView)
+{
+  //Coarsest level while the view is moving, refined a level at a time when idle
+  if (vt.levels.empty() || drawstate.automate) return 0;
+  if (memcmp(modelView, vt.view, sizeof(vt.view)) != 0)
+  {
+    memcpy(vt.view, modelView, sizeof(vt.view));
+    vt.level = vt.levels.size();
+    drawstate.fulldetail = false;
+  }
+  else if (drawstate.fulldetail && vt.level > 0)
+    vt.level--;
+
+  //Levels too large to load are skipped, finer levels are also not loaded
+  while (vt.level > 0 && !vt.levels[vt.level-1])
+    vt.level--;
+
+  //Request refinement once idle
+  if (vt.level > 0) drawstate.reduced = true;
+  return vt.level;
+}
+
+bool Volumes::brickMap(unsigned int i, float isovalue, bool iso, float density, const float range[2], ColourMap* cmap)
+{
+  //Flag the bricks that can contribute to the image with the current settings,
+  //returns false when there is no empty space to skip
+  VolumeTextures& vt = textures[geom[i]->draw];
+  VolumeBricks& bricks = vt.bricks;
+  if (!bricks.count()) return false;
+
+  Properties& props = geom[i]->draw->properties;
+  float power = props["power"];
+  float dmin = props["dminclip"], dmax = props["dmaxclip"];
+  float r = range[1] - range[0];
+  if (r <= 0.0) r = 1.0;
+  //Margin allowing for rounding differences to the shader calculations
+  const float eps = 0.00001;
+
+  std::vector<GLubyte> occupied(bricks.count());
+  bool empty = false;
+  for (unsigned int b=0; b<bricks.count(); b++)
+  {
+    //Any sample in the brick inside an isosurface?
+    bool visible = iso && bricks.maximum[b] >= isovalue - eps * r;
+    if (!visible && density > 0.0)
+    {
+      //Normalise and clip the density range as the shader does
+      float lo = (bricks.minimum[b] - range[0]) / r;
+      float hi = (bricks.maximum[b] - range[0]) / r;
+      lo = max(lo, dmin - eps);
+      hi = min(hi, dmax + eps);
+      lo = min(max(lo, 0.0), 1.0);
+      hi = min(max(hi, 0.0), 1.0);
+      if (lo <= hi)
+      {
+        if (cmap)
+          visible = !cmap->empty(pow(lo, power), pow(hi, power));
+        else
+          visible = hi > 0.0;
+      }
+    }
+    occupied[b] = visible ? 255 : 0;
+    if (!visible) empty = true;
+  }
+
+  if (!vt.brickmap || occupied != vt.occupied)
+  {
+    if (!vt.brickmap) vt.brickmap = new TextureData();
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, vt.brickmap->id);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, bricks.dims[0], bricks.dims[1], bricks.dims[2], 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, occupied.data());
+    glPopClientAttrib();
+    glActiveTexture(GL_TEXTURE0);
+    vt.brickmap->width = bricks.dims[0];
+    vt.brickmap->height = bricks.dims[1];
+    vt.brickmap->depth = bricks.dims[2];
+    vt.occupied = occupied;
+    GL_Error_Check;
+  }
+  return empty;
+}
+
 void Volumes::render(int i)
 {
   float dims[3] = {geom[i]->vertices[1][0] - geom[i]->vertices[0][0],
@@ -357,7 +856,6 @@ void Volumes::render(int i)
     return;
   }
   float res[3] = {(float)voltexture->width, (float)voltexture->height, (float)voltexture->depth};
-  glUniform3fv(prog->uniforms["uResolution"], 1, res);
   glUniform4fv(prog->uniforms["uViewport"], 1, viewport);
 
   //User settings
@@ -389,7 +887,6 @@ void Volumes::render(int i)
   glUniform3fv(prog->uniforms["uBBMax"], 1, bbMax);
   glUniform1i(prog->uniforms["uEnableColour"], hasColourMap ? 1 : 0);
   glUniform1f(prog->uniforms["uPower"], props["power"]);
-  glUniform1i(prog->uniforms["uSamples"], props["samples"]);
   float opacity = props["opacity"], density = props["density"];
   glUniform1f(prog->uniforms["uDensityFactor"], density * opacity);
   Colour colour = geom[i]->draw->properties.getColour("colour", 220, 220, 200, 255);
@@ -423,6 +920,22 @@ void Volumes::render(int i)
   glUniform1f(prog->uniforms["uIsoValue"], isoval);
   GL_Error_Check;
 
+  //Empty space map, bricks with nothing to show are skipped in the ray march
+  VolumeTextures& vt = textures[geom[i]->draw];
+  bool skip = brickMap(i, isoval, colour.a > 0, density * opacity, range, hasColourMap ? cmap : NULL);
+  glUniform1i(prog->uniforms["uBricks"], skip ? 1 : 0);
+  glUniform1i(prog->uniforms["uBrickMap"], 2);
+  if (skip)
+  {
+    float brickdims[3];
+    for (int d=0; d<3; d++)
+      brickdims[d] = res[d] / (float)vt.bricks.size;
+    glUniform3fv(prog->uniforms["uBrickDims"], 1, brickdims);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, vt.brickmap->id);
+  }
+  GL_Error_Check;
+
   //Gradient texture
   if (hasColourMap)
   {
@@ -433,7 +946,6 @@ void Volumes::render(int i)
 
   //Volume texture
   glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_3D, voltexture->id);
   glUniform1i(prog->uniforms["uVolume"], 1);
   GL_Error_Check;
 
@@ -491,6 +1003,20 @@ void Volumes::render(int i)
   glUniformMatrix4fv(prog->uniforms["uNMatrix"], 1, GL_FALSE, nMatrix);
   GL_Error_Check;
 
+  //Reduced resolution level while the view is moving, with fewer samples to keep the same per voxel
+  unsigned int level = selectLevel(vt, mvMatrix);
+  TextureData* leveltex = level ? vt.levels[level-1]->texture : NULL;
+  int samples = props["samples"];
+  if (leveltex)
+  {
+    float lres[3] = {(float)leveltex->width, (float)leveltex->height, (float)leveltex->depth};
+    glUniform3fv(prog->uniforms["uResolution"], 1, lres);
+    samples = max(samples >> level, 16);
+  }
+  else
+    glUniform3fv(prog->uniforms["uResolution"], 1, res);
+  glUniform1i(prog->uniforms["uSamples"], samples);
+
   //State...
   glPushAttrib(GL_ENABLE_BIT);
   glEnable(GL_BLEND);
@@ -505,7 +1031,86 @@ void Volumes::render(int i)
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, twoTriangles->indexvbo);
   glVertexPointer(3, GL_FLOAT, stride, (GLvoid*)0); // Load vertex x,y,z only
   glEnableClientState(GL_VERTEX_ARRAY);
-  glDrawElements(GL_TRIANGLES, twoTriangles->elements, GL_UNSIGNED_INT, (GLvoid*)0);
+  if (vt.blocks.empty() || leveltex)
+  {
+    float scale[3] = {1.0, 1.0, 1.0}, offset[3] = {0.0, 0.0, 0.0};
+    glUniform3fv(prog->uniforms["uBlockMin"], 1, bbMin);
+    glUniform3fv(prog->uniforms["uBlockMax"], 1, bbMax);
+    glUniform3fv(prog->uniforms["uTexScale"], 1, scale);
+    glUniform3fv(prog->uniforms["uTexOffset"], 1, offset);
+    glBindTexture(GL_TEXTURE_3D, leveltex ? leveltex->id : voltexture->id);
+    glDrawElements(GL_TRIANGLES, twoTriangles->elements, GL_UNSIGNED_INT, (GLvoid*)0);
+  }
+  else
+  {
+    //Split volume, draw each block back to front, ordered by distance
+    //in blocks from the block containing the camera
+    float cam[3];
+    for (int j=0; j<3; j++)
+    {
+      //Ray origin as calculated in the shader
+      cam[j] = 0.0;
+      for (int k=0; k<4; k++)
+        cam[j] -= mvMatrix[j*4+k] * mvMatrix[12+k];
+    }
+    VolumeBlock& first = vt.blocks.front();
+    VolumeBlock& last = vt.blocks.back();
+    std::vector<std::pair<int, unsigned int> > order;
+    for (unsigned int b=0; b<vt.blocks.size(); b++)
+    {
+      VolumeBlock& block = vt.blocks[b];
+      int distance = 0;
+      bool visible = !skip;
+      unsigned int lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0};
+      for (int d=0; d<3; d++)
+      {
+        int count = last.offset[d] / first.size[d] + 1;
+        int c = floor(cam[d] * res[d] / first.size[d]);
+        if (c < 0) c = 0;
+        if (c > count-1) c = count-1;
+        distance += abs((int)(block.offset[d] / first.size[d]) - c);
+        if (skip)
+        {
+          lo[d] = block.offset[d] / vt.bricks.size;
+          hi[d] = (block.offset[d] + block.size[d] - 1) / vt.bricks.size;
+        }
+      }
+      //Skip blocks with no visible bricks
+      for (unsigned int z=lo[2]; !visible && z<=hi[2]; z++)
+        for (unsigned int y=lo[1]; !visible && y<=hi[1]; y++)
+          for (unsigned int x=lo[0]; !visible && x<=hi[0]; x++)
+            visible = vt.occupied[vt.bricks.index(x, y, z)] > 0;
+      if (visible)
+        order.push_back(std::make_pair(-distance, b));
+    }
+    std::stable_sort(order.begin(), order.end());
+
+    //Only the nearest block writes depth, the others would hide blocks drawn over them
+    GLboolean depthmask;
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &depthmask);
+    for (unsigned int o=0; o<order.size(); o++)
+    {
+      VolumeBlock& block = vt.blocks[order[o].second];
+      TextureData* tex = block.texture->texture;
+      float tres[3] = {(float)tex->width, (float)tex->height, (float)tex->depth};
+      float blockMin[3], blockMax[3], scale[3], offset[3];
+      for (int d=0; d<3; d++)
+      {
+        blockMin[d] = block.offset[d] / res[d];
+        blockMax[d] = (block.offset[d] + block.size[d]) / res[d];
+        scale[d] = res[d] / tres[d];
+        offset[d] = -(float)block.start[d] / tres[d];
+      }
+      glUniform3fv(prog->uniforms["uBlockMin"], 1, blockMin);
+      glUniform3fv(prog->uniforms["uBlockMax"], 1, blockMax);
+      glUniform3fv(prog->uniforms["uTexScale"], 1, scale);
+      glUniform3fv(prog->uniforms["uTexOffset"], 1, offset);
+      glBindTexture(GL_TEXTURE_3D, tex->id);
+      glDepthMask(o == order.size()-1 ? depthmask : GL_FALSE);
+      glDrawElements(GL_TRIANGLES, twoTriangles->elements, GL_UNSIGNED_INT, (GLvoid*)0);
+    }
+    glDepthMask(depthmask);
+  }
   glDisableClientState(GL_VERTEX_ARRAY);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -0,0 +1,57 @@
+#version 120
+//Glyph template mesh drawn once per instance
+attribute vec3 aInstancePosition;
+attribute vec4 aInstanceRotation;
+attribute vec4 aInstanceScale;
+attribute vec4 aInstanceColour;
+varying vec4 vColour;
+varying vec3 vNormal;
+varying vec3 vPosEye;
+varying vec3 vVertex;
+uniform bool uCalcNormal;
+uniform bool uArrow;
+
+//Apply quaternion rotation to vector
+vec3 rotate(vec4 q, vec3 v)
+{
+  vec3 t = 2.0 * cross(q.xyz, v);
+  return v + q.w * t + cross(q.xyz, t);
+}
+
+void main(void)
+{
+  vec3 local;
+  vec3 scale;
+  if (uArrow)
+  {
+    //Arrow template: x,y multiples of shaft or head radius, z of length plus offset in head lengths
+    float radius = mix(aInstanceScale.x, aInstanceScale.y, gl_MultiTexCoord0.y);
+    local = vec3(gl_Vertex.xy * radius, gl_Vertex.z * aInstanceScale.z + gl_MultiTexCoord0.x * aInstanceScale.w);
+    //Head cone height is the head length
+    scale = vec3(radius, radius, mix(aInstanceScale.z, aInstanceScale.w, gl_MultiTexCoord0.y));
+    gl_TexCoord[0] = vec4(0.0);
+  }
+  else
+  {
+    local = gl_Vertex.xyz * aInstanceScale.xyz;
+    scale = aInstanceScale.xyz;
+    gl_TexCoord[0] = gl_MultiTexCoord0;
+  }
+  vec4 vertex = vec4(aInstancePosition + rotate(aInstanceRotation, local), 1.0);
+
+  vec4 mvPosition = gl_ModelViewMatrix * vertex;
+  vPosEye = vec3(mvPosition);
+  gl_Position = gl_ProjectionMatrix * mvPosition;
+
+  if (uCalcNormal || dot(gl_Normal,gl_Normal) < 0.01)
+    vNormal = vec3(0.0);
+  else
+  {
+    //Normals scale inversely to the vertices to stay perpendicular to the surface
+    vec3 normal = normalize(gl_Normal / max(scale, 1.0e-6));
+    vNormal = normalize(mat3(gl_NormalMatrix) * rotate(aInstanceRotation, normal));
+  }
+
+  vColour = aInstanceColour;
+  vVertex = vertex.xyz;
+}
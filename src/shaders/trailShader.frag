@@ -0,0 +1,40 @@
+varying vec4 vColour;
+varying vec3 vVertex;
+varying float vPosition;
+uniform float uOpacity;
+uniform float uBrightness;
+uniform float uContrast;
+uniform float uSaturation;
+uniform vec3 uClipMin;
+uniform vec3 uClipMax;
+uniform bool uFade;
+uniform bool uTimeColour;
+uniform sampler2D uColourMap;
+
+void main(void)
+{
+  //Clip planes in X/Y/Z (shift seems to be required on nvidia)
+  if (any(lessThan(vVertex, uClipMin - vec3(0.01))) || any(greaterThan(vVertex, uClipMax + vec3(0.01)))) discard;
+
+  vec4 colour = vColour;
+  //Colour by time step from colour map
+  if (uTimeColour) colour = texture2D(uColourMap, vec2(vPosition, 0.5));
+  //Fade in from transparent at oldest step
+  if (uFade) colour.a = vPosition;
+  float alpha = colour.a;
+  if (uOpacity > 0.0) alpha *= uOpacity;
+
+  //Brightness adjust
+  colour += uBrightness;
+  //Saturation & Contrast adjust
+  const vec4 LumCoeff = vec4(0.2125, 0.7154, 0.0721, 0.0);
+  vec4 AvgLumin = vec4(0.5, 0.5, 0.5, 0.0);
+  vec4 intensity = vec4(dot(colour, LumCoeff));
+  colour = mix(intensity, colour, uSaturation);
+  colour = mix(AvgLumin, colour, uContrast);
+  colour.a = alpha;
+
+  if (alpha < 0.01) discard;
+
+  gl_FragColor = colour;
+}
@@ -0,0 +1,18 @@
+attribute float aSlot;
+uniform float uHead;
+uniform float uSlots;
+uniform float uFilled;
+varying vec4 vColour;
+varying vec3 vVertex;
+varying float vPosition;
+
+void main(void)
+{
+  vec4 mvPosition = gl_ModelViewMatrix * gl_Vertex;
+  gl_Position = gl_ProjectionMatrix * mvPosition;
+  vColour = gl_Color;
+  vVertex = gl_Vertex.xyz;
+  //Position along trail from oldest step (0) to newest (1)
+  float age = mod(uHead - aSlot + uSlots, uSlots);
+  vPosition = 1.0 - age / max(uFilled - 1.0, 1.0);
+}
@@ -41,6 +41,17 @@ uniform int uFilter;
 uniform vec2 uRange;
 uniform vec2 uDenMinMax;
 
+//Empty space map, one texel per brick, zero where nothing visible
+uniform sampler3D uBrickMap;
+uniform int uBricks;
+uniform vec3 uBrickDims;
+
+//Region covered by the bound volume texture when split into blocks
+uniform vec3 uBlockMin;
+uniform vec3 uBlockMax;
+uniform vec3 uTexScale;
+uniform vec3 uTexOffset;
+
 //#define tex3D(pos) interpolate_tricubic_fast(pos)
 //#define tex3D(pos) texture3Dfrom2D(pos).x
 
@@ -48,7 +59,7 @@ float tex3D(vec3 pos)
 {
   //if (uFilter > 0)
   //  return interpolate_tricubic_fast(pos);
-  return texture3D(uVolume, pos).x; //from2D(pos).x;
+  return texture3D(uVolume, pos * uTexScale + uTexOffset).x; //from2D(pos).x;
 }
 
 // It seems WebGL has no transpose
@@ -108,12 +119,12 @@ vec3 isoNormal(in vec3 pos, in vec3 shift, in float density)
   return normalize(pos1 - pos2);
 }
 
-vec2 rayIntersectBox(vec3 rayDirection, vec3 rayOrigin)
+vec2 rayIntersectBox(vec3 rayDirection, vec3 rayOrigin, vec3 bbMin, vec3 bbMax)
 {
   //Intersect ray with bounding box
   vec3 rayInvDirection = 1.0 / rayDirection;
-  vec3 bbMinDiff = (uBBMin - rayOrigin) * rayInvDirection;
-  vec3 bbMaxDiff = (uBBMax - rayOrigin) * rayInvDirection;
+  vec3 bbMinDiff = (bbMin - rayOrigin) * rayInvDirection;
+  vec3 bbMaxDiff = (bbMax - rayOrigin) * rayInvDirection;
   vec3 imax = max(bbMaxDiff, bbMinDiff);
   vec3 imin = min(bbMaxDiff, bbMinDiff);
   float back = min(imax.x, min(imax.y, imax.z));
@@ -144,35 +155,70 @@ void main()
     float stepSize = 1.732 / float(uSamples); //diagonal of [0,1] normalised coord cube = sqrt(3)
 
     //Intersect ray with bounding box
-    vec2 intersection = rayIntersectBox(rayDirection, rayOrigin);
+    vec2 intersection = rayIntersectBox(rayDirection, rayOrigin, uBBMin, uBBMax);
     //Subtract small increment to avoid errors on front boundary
     intersection.y -= 0.000001;
     //Discard points outside the box (no intersection)
     if (intersection.x <= intersection.y) discard;
 
+    //Intersect with the block being rendered, samples stay on the same
+    //positions along the ray as when the volume is rendered in one pass
+    vec2 block = rayIntersectBox(rayDirection, rayOrigin, max(uBBMin, uBlockMin), min(uBBMax, uBlockMax));
+    block.y -= 0.000001;
+    if (block.x <= block.y) discard;
+    float first = max(ceil((block.y - intersection.y) / stepSize), 0.0);
+
     vec3 rayStart = rayOrigin + rayDirection * intersection.y;
     vec3 rayStop = rayOrigin + rayDirection * intersection.x;
 
     vec3 step = normalize(rayStop-rayStart) * stepSize;
-    vec3 pos = rayStart;
+    vec3 pos = rayStart + step * first;
 
     float T = 1.0;
     vec3 colour = vec3(0.0);
     bool inside = false;
+    //Continuing a ray from the previous block, pick up the isosurface state from its last sample
+    //(clamped to the texture apron around the block in case a step is longer than the apron)
+    if (first > 0.0 && uIsoColour.a > 0.0)
+    {
+      vec3 texel = uTexScale / uResolution;
+      vec3 back = clamp((pos - step) * uTexScale + uTexOffset, 0.5 * texel, 1.0 - 0.5 * texel);
+      inside = texture3D(uVolume, back).x >= uIsoValue;
+    }
     vec3 shift = uIsoSmooth / uResolution;
     //Number of samples to take along this ray before we pass out back of volume...
-    float travel = distance(rayStop, rayStart) / stepSize;
+    float travel = distance(rayOrigin + rayDirection * block.x, rayStart) / stepSize - first;
     int samples = int(ceil(travel));
     float range = uRange.y - uRange.x;
     if (range <= 0.0) range = 1.0;
   
     //Raymarch, front to back
-    vec3 depthHit = rayStart;
+    vec3 depthHit = pos;
+    vec3 occupied = vec3(-1.0);
+    //Step with no zero components for brick exit distances, axis aligned rays would divide by zero
+    vec3 dir = step + vec3(lessThan(abs(step), vec3(1.0e-6))) * 1.0e-6;
     for (int i=0; i < maxSamples; ++i)
     {
       //Render samples until we pass out back of cube or fully opaque
 #ifndef IE11
-      if (i == samples || T < 0.01) break;
+      if (i >= samples || T < 0.01) break;
+
+      //Jump over the samples in an empty brick (not while inside an isosurface, the exit must be found)
+      vec3 brick = floor(pos * uBrickDims);
+      if (uBricks > 0 && !inside && brick != occupied)
+      {
+        if (texture3D(uBrickMap, (brick + 0.5) / ceil(uBrickDims)).x == 0.0)
+        {
+          vec3 exit = max((brick / uBrickDims - pos) / dir, ((brick + 1.0) / uBrickDims - pos) / dir);
+          float remain = min(exit.x, min(exit.y, exit.z));
+          int skip = remain > 1.0 ? int(ceil(remain)) : 1;
+          if (T > depthT) depthHit = pos + step * float(skip-1);
+          pos += step * float(skip);
+          i += skip - 1;
+          continue;
+        }
+        occupied = brick;
+      }
 #else
       //This is slower but allows IE 11 to render, break on non-uniform condition causes it to fail
       if (i == uSamples) break;
@@ -194,7 +240,7 @@ void main()
           //Find closer to exact position by iteration
           //http://sizecoding.blogspot.com.au/2008/08/isosurfaces-in-glsl.html
           float exact;
-          float a = intersection.y + (float(i)*stepSize);
+          float a = intersection.y + ((first + float(i))*stepSize);
           float b = a - stepSize;
           for (int j = 0; j < 5; j++)
           {
@@ -257,16 +303,19 @@ void main()
     }
 
     //Apply brightness, saturation & contrast
-    colour += uBrightness;
+    //(colour is premultiplied, so offsets are weighted by alpha, this keeps them
+    // applied once when blocks of a split volume are composited along the ray)
+    float alpha = 1.0 - T;
+    colour += uBrightness * alpha;
     const vec3 LumCoeff = vec3(0.2125, 0.7154, 0.0721);
     vec3 AvgLumin = vec3(0.5, 0.5, 0.5);
     vec3 intensity = vec3(dot(colour, LumCoeff));
     colour = mix(intensity, colour, uSaturation);
-    colour = mix(AvgLumin, colour, uContrast);
+    colour = mix(AvgLumin * alpha, colour, uContrast);
 
     //TODO: alpha threshold uniform?
     //if (T > 0.95) discard;
-    gl_FragColor = vec4(colour, 1.0 - T);
+    gl_FragColor = vec4(colour, alpha);
 
 #ifndef NO_DEPTH_WRITE
     // Write the depth (!Not supported in WebGL without extension)